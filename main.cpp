@@ -1,4 +1,13 @@
 #include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#ifdef __GLIBC__
+#include <malloc.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 #include "src/Utils.hpp"
 #include "src/Color.hpp"
 #include "src/Camera.hpp"
@@ -7,6 +16,25 @@
 #include "src/Sphere.hpp"
 #include "src/Material.hpp"
 #include "src/BVH.hpp"
+#include "src/BVHCache.hpp"
+#include "src/ParallelBVHBuilder.hpp"
+#include "src/LBVHBuilder.hpp"
+#include "src/DynamicBVH.hpp"
+#include "src/CompiledScene.hpp"
+#include "src/SphereSet.hpp"
+#include "src/QuadSet.hpp"
+#include "src/SceneArena.hpp"
+#include "src/CompressedBVH.hpp"
+#include "src/OutOfCoreScene.hpp"
+#include "src/EnvironmentLight.hpp"
+#include "src/DistributedRender.hpp"
+#include "src/RenderDaemon.hpp"
+#include "src/ProgressiveRenderer.hpp"
+#include "src/BatchRenderer.hpp"
+#include "src/PathGuide.hpp"
+#include "src/PhotonMap.hpp"
+#include "src/RadianceCache.hpp"
+#include "src/Animation.hpp"
 #include "src/Texture.hpp"
 #include "src/Quad.hpp"
 
@@ -30,9 +58,9 @@ inline shared_ptr<HittableList> box(const Vector3& a, const Vector3& b, shared_p
     return sides;
 }
 
-void cornellBox() {
-    HittableList world;
-
+// Cornell box with a rotated box and a glass sphere, and the camera of the README render.
+// Returns the ceiling light's material.
+shared_ptr<Material> cornellScene(HittableList& world, HittableList& lights, Camera& cam) {
     auto red   = make_shared<Lambertian>(Vector3(.65, .05, .05));
     auto white = make_shared<Lambertian>(Vector3(.73, .73, .73));
     auto green = make_shared<Lambertian>(Vector3(.12, .45, .15));
@@ -56,11 +84,9 @@ void cornellBox() {
     world.add(make_shared<Sphere>(Vector3(190,90,190), 90, glass));
 
     auto emptyMaterial = shared_ptr<Material>();
-    HittableList lights;
     lights.add(make_shared<Quad>(Vector3(343,554,332), Vector3(-130,0,0), Vector3(0,0,-105), emptyMaterial));
     lights.add(make_shared<Sphere>(Vector3(190, 90, 190), 90, emptyMaterial));
 
-    Camera cam;
     cam.aspectRatio = 1.0;
     cam.imgWidth = 1200;
     cam.samplePerPixel = 1000;
@@ -70,8 +96,66 @@ void cornellBox() {
     cam.lookAt = Vector3(278, 278, 0);
     cam.up = Vector3(0, 1, 0);
     cam.background = Vector3(0, 0, 0);
+    return lightMat;
+}
 
-    cam.render(world, lights);
+void cornellBox() {
+    HittableList world, lights;
+    Camera cam;
+    cornellScene(world, lights, cam);
+
+    // Bakes the rotated box into world-space quads under one BVH.
+    CompiledScene scene(world);
+    cam.render(scene, lights);
+}
+
+void denoisedCornellBox(int samples, int width) {
+    HittableList world, lights;
+    Camera cam;
+    cornellScene(world, lights, cam);
+    cam.samplePerPixel = samples;
+    cam.imgWidth = width;
+
+    CompiledScene scene(world);
+    FeatureBuffers buffers;
+    cam.render(scene, lights, buffers);
+    writePPM(std::cout, buffers.width, buffers.height, Denoiser().denoise(buffers));
+}
+
+// Renders the Cornell box with all AOVs into one EXR and checks that the direct, indirect and
+// emission channels add back up to the beauty image.
+void aovCornellBox(int samples, int width, const std::string& filename) {
+    HittableList world, lights;
+    Camera cam;
+    auto lightMat = cornellScene(world, lights, cam);
+    cam.samplePerPixel = samples;
+    cam.imgWidth = width;
+    cam.lightGroups.push_back(std::make_pair(std::string("ceiling"), lightMat));
+
+    CompiledScene scene(world);
+    Framebuffer buffer;
+    cam.render(scene, lights, buffer);
+
+    size_t beauty = buffer.find(""), emission = buffer.find("emission");
+    size_t direct = buffer.find("direct"), indirect = buffer.find("indirect");
+    size_t ceiling = buffer.find("light.ceiling");
+    double splitError = 0, groupError = 0, total = 0;
+    for (size_t p = 0; p < size_t(buffer.width()) * buffer.height(); p++) {
+        Vector3 c = buffer.get(beauty, p);
+        Vector3 split = buffer.get(emission, p) + buffer.get(direct, p) + buffer.get(indirect, p);
+        splitError += (c - split).length();
+        groupError += (c - buffer.get(ceiling, p)).length();
+        total += c.length();
+    }
+
+    std::clog << buffer.channels().size() << " channels, " << buffer.width() << "x" << buffer.height()
+              << "; relative error of emission + direct + indirect: " << splitError / total
+              << ", of light.ceiling: " << groupError / total << "\n";
+    if (!buffer.writeEXR(filename)) {
+        std::cerr << "Could not write " << filename << "\n";
+        return;
+    }
+    std::clog << "Wrote " << filename << "\n";
 }
 
 void bouncingSpheres() {
@@ -79,6 +163,7 @@ void bouncingSpheres() {
     auto checker = make_shared<CheckerTexture>(0.4, Vector3(0.0, 0.0, 0.0), Vector3(1.0, 1.0, 1.0));
     world.add(make_shared<Sphere>(Vector3(0, -1000, 0), 1000, make_shared<Lambertian>(checker)));
 
+    auto smallSpheres = make_shared<SphereSet>();
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
             auto chooseMat = randomDouble();
@@ -92,22 +177,25 @@ void bouncingSpheres() {
                     auto albedo = Vector3::random(0.1, 1);
                     auto fuzz = randomDouble(0, 0.6);
                     sphereMaterial = make_shared<Metal>(albedo, fuzz);
-                    world.add(make_shared<Sphere>(center, randomDouble(0.1, 0.3), sphereMaterial));
+                    smallSpheres->add(center, randomDouble(0.1, 0.3), sphereMaterial);
                 } else if (chooseMat < 0.95) {
                     // diffuse
                     auto albedo = Vector3::random() * Vector3::random();
                     sphereMaterial = make_shared<Lambertian>(albedo);
-                    world.add(make_shared<Sphere>(center, randomDouble(0.1, 0.3), sphereMaterial));
+                    smallSpheres->add(center, randomDouble(0.1, 0.3), sphereMaterial);
 
                 } else {
                     // glass
                     sphereMaterial = make_shared<Dielectric>(1.5);
-                    world.add(make_shared<Sphere>(center, randomDouble(0.1, 0.3), sphereMaterial));
+                    smallSpheres->add(center, randomDouble(0.1, 0.3), sphereMaterial);
                 }
             }
         }
     }
 
+    smallSpheres->build();
+    world.add(smallSpheres);
+
     auto material1 = make_shared<Dielectric>(1.5);
     world.add(make_shared<Sphere>(Vector3(0, 1, 0), 1.0, material1));
 
@@ -117,7 +205,7 @@ void bouncingSpheres() {
     auto material3 = make_shared<Metal>(Vector3(0.7, 0.65, 0.55), 0.0);
     world.add(make_shared<Sphere>(Vector3(4, 1, 0), 1.0, material3));
 
-    world = HittableList(make_shared<BVHNode>(world));
+    world = HittableList(BVHCache::loadOrBuild(world, "bvh-cache"));
 
     Camera camera;
 
@@ -139,7 +227,1484 @@ void bouncingSpheres() {
 //    camera.render(world);
 }
 
-int main() {
+
+void movingSpheresScene(HittableList& world, HittableList& lights, Camera& camera) {
+    auto checker = make_shared<CheckerTexture>(0.4, Vector3(0.2, 0.3, 0.1), Vector3(0.9, 0.9, 0.9));
+    world.add(make_shared<Sphere>(Vector3(0, -1000, 0), 1000, make_shared<Lambertian>(checker)));
+
+    // Spheres bounce from the ground to a random height over the clip, i.e. over time [0, 1].
+    for (int a = -8; a < 8; a++) {
+        for (int b = -8; b < 8; b++) {
+            Vector3 center(a + 0.9 * randomDouble(), 0.2, b + 0.9 * randomDouble());
+            Vector3 center2 = center + Vector3(0, randomDouble(0, 1.5), 0);
+            auto albedo = Vector3::random() * Vector3::random();
+            world.add(make_shared<Sphere>(center, center2, 0.2, make_shared<Lambertian>(albedo)));
+        }
+    }
+
+    auto white = make_shared<Lambertian>(Vector3(.73, .73, .73));
+    std::vector<KeyframedTransform::Keyframe> keys = {
+            { 0.0, Vector3(-1, 0, 0), 0 },
+            { 0.5, Vector3(0, 1, 0), 45 },
+            { 1.0, Vector3(1, 0, 0), 90 },
+    };
+    world.add(make_shared<KeyframedTransform>(box(Vector3(-0.5, 0, -0.5), Vector3(0.5, 1, 0.5), white), keys));
+
+    auto lightMat = make_shared<DiffuseLight>(Vector3(7, 7, 7));
+    world.add(make_shared<Quad>(Vector3(-2, 6, -2), Vector3(4, 0, 0), Vector3(0, 0, 4), lightMat));
+
+    lights.add(make_shared<Quad>(Vector3(-2, 6, -2), Vector3(4, 0, 0), Vector3(0, 0, 4), shared_ptr<Material>()));
+
+    camera.onSkyBackground = true;
+    camera.aspectRatio = 16.0 / 9.0;
+    camera.imgWidth = 400;
+    camera.samplePerPixel = 32;
+    camera.maxDepth = 8;
+    camera.fovy = 30;
+    camera.camPos = Vector3(13, 4, 6);
+    camera.lookAt = Vector3(0, 0.5, 0);
+    camera.up = Vector3(0, 1, 0);
+}
+
+void movingSpheres(int frameCount) {
+    HittableList world, lights;
+    Camera camera;
+    movingSpheresScene(world, lights, camera);
+
+    // One hierarchy for the whole clip: each frame refits it to that frame's shutter interval.
+    DynamicBVH bvh(world, Interval(0, 0.5 / frameCount));
+    for (int frame = 0; frame < frameCount; frame++) {
+        camera.shutterOpen = double(frame) / frameCount;
+        camera.shutterClose = (frame + 0.5) / frameCount;
+        bool rebuilt = bvh.update(Interval(camera.shutterOpen, camera.shutterClose));
+
+        char name[32];
+        snprintf(name, sizeof(name), "frame_%03d.ppm", frame);
+        std::clog << "Frame " << frame << (rebuilt ? ": rebuilt BVH" : ": refitted BVH")
+                  << ", SAH ratio " << bvh.costRatio() << "\n";
+
+        std::ofstream out(name);
+        camera.render(bvh, lights, out);
+    }
+}
+
+inline double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void bvhBuildBenchmark(size_t count) {
+    HittableList world;
+    auto mat = make_shared<Lambertian>(Vector3(0.5, 0.5, 0.5));
+    for (size_t i = 0; i < count; i++)
+        world.add(make_shared<Sphere>(Vector3::random(-1000, 1000), randomDouble(0.1, 2.0), mat));
+
+    std::clog << "BVH build benchmark, " << count << " primitives\n";
+
+    auto start = std::chrono::steady_clock::now();
+    BVHNode reference(world);
+    double seconds = secondsSince(start);
+    std::clog << "  BVHNode (median split)   " << seconds << " s, " << count / seconds * 1e-6 << " Mprims/s\n";
+
+    auto boxes = FlatBVHBuilder::primitiveBounds(world.objects);
+    std::vector<FlatBVHNode> nodes;
+    std::vector<uint32_t> primIndices;
+
+    start = std::chrono::steady_clock::now();
+    FlatBVHBuilder::build(boxes, nodes, primIndices);
+    seconds = secondsSince(start);
+    std::clog << "  FlatBVHBuilder (median)  " << seconds << " s, SAH " << sahCost(nodes.data(), nodes.size()) << "\n";
+
+    for (unsigned threads = 1; ; threads = std::min(threads * 2, hardwareThreads())) {
+        start = std::chrono::steady_clock::now();
+        ParallelBVHBuilder(threads).build(boxes, nodes, primIndices);
+        seconds = secondsSince(start);
+        std::clog << "  ParallelBVHBuilder x" << threads << "    " << seconds << " s, "
+                  << count / seconds * 1e-6 << " Mprims/s, " << nodes.size() << " nodes, SAH "
+                  << sahCost(nodes.data(), nodes.size()) << "\n";
+        if (threads == hardwareThreads())
+            break;
+    }
+
+    for (int variant = 0; variant < 3; variant++) {
+        LBVHBuilder lbvh;
+        lbvh.wideCodes = variant == 1;
+        lbvh.optimizeTreelets = variant == 2;
+        start = std::chrono::steady_clock::now();
+        lbvh.build(boxes, nodes, primIndices);
+        seconds = secondsSince(start);
+        const char* name = variant == 0 ? "LBVH 30-bit             "
+                         : variant == 1 ? "LBVH 63-bit             "
+                                        : "LBVH 30-bit + treelets  ";
+        std::clog << "  " << name << seconds * 1000 << " ms, SAH " << sahCost(nodes.data(), nodes.size()) << "\n";
+    }
+}
+
+void shadowRayBenchmark(int gridHalf, size_t rayCount) {
+    // A bouncingSpheres()-style field of small spheres on a ground sphere, lit from above.
+    HittableList world;
+    auto mat = make_shared<Lambertian>(Vector3(0.5, 0.5, 0.5));
+    world.add(make_shared<Sphere>(Vector3(0, -1000, 0), 1000, mat));
+    for (int a = -gridHalf; a < gridHalf; a++) {
+        for (int b = -gridHalf; b < gridHalf; b++) {
+            Vector3 center(a + 0.9 * randomDouble(), 0.2 + randomDouble(0, 0.6), b + 0.9 * randomDouble());
+            world.add(make_shared<Sphere>(center, randomDouble(0.2, 0.45), mat));
+        }
+    }
+    auto bvh = ParallelBVHBuilder::build(world);
+
+    // Shadow segments from visible surface points to random points on a large area light.
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    Vector3 eye(0, 2, 0);
+    while (rays.size() < rayCount) {
+        Vector3 dir = Vector3(randomDouble(-1, 1), randomDouble(-0.6, -0.05), randomDouble(-1, 1));
+        Ray primary(eye, dir);
+        HitRecord rec;
+        if (!bvh->hit(primary, Interval(rayEpsilon, infinity), rec))
+            continue;
+        rec.finalize(primary);
+
+        Vector3 lightPoint(randomDouble(-gridHalf, gridHalf), 30, randomDouble(-gridHalf, gridHalf));
+        rays.push_back(Ray(rec.p, lightPoint - rec.p));
+    }
+
+    std::clog << "Shadow ray benchmark, " << world.objects.size() << " spheres, " << rayCount << " rays\n";
+
+    size_t blocked = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& ray : rays) {
+        HitRecord rec;
+        if (bvh->hit(ray, Interval(rayEpsilon, 1.0), rec))
+            blocked++;
+    }
+    double closestSeconds = secondsSince(start);
+    std::clog << "  closest hit  " << rayCount / closestSeconds * 1e-6 << " Mrays/s (" << blocked << " blocked)\n";
+
+    blocked = 0;
+    start = std::chrono::steady_clock::now();
+    for (const auto& ray : rays) {
+        if (bvh->occluded(ray, 1.0))
+            blocked++;
+    }
+    double occludedSeconds = secondsSince(start);
+    std::clog << "  occluded     " << rayCount / occludedSeconds * 1e-6 << " Mrays/s (" << blocked << " blocked), "
+              << closestSeconds / occludedSeconds << "x\n";
+}
+
+void sceneDispatchBenchmark(int gridHalf, size_t rayCount) {
+    // Spheres and boxes on a ground sphere: the same objects through virtual and switch dispatch.
+    HittableList world;
+    auto mat = make_shared<Lambertian>(Vector3(0.5, 0.5, 0.5));
+    world.add(make_shared<Sphere>(Vector3(0, -1000, 0), 1000, mat));
+    for (int a = -gridHalf; a < gridHalf; a++) {
+        for (int b = -gridHalf; b < gridHalf; b++) {
+            Vector3 corner(a + 0.9 * randomDouble(), 0, b + 0.9 * randomDouble());
+            if (randomDouble() < 0.8)
+                world.add(make_shared<Sphere>(corner + Vector3(0, 0.2, 0), randomDouble(0.1, 0.3), mat));
+            else {
+                auto sides = box(corner, corner + Vector3::random(0.1, 0.4), mat);
+                for (const auto& side : sides->objects)
+                    world.add(side);
+            }
+        }
+    }
+
+    auto bvh = ParallelBVHBuilder::build(world);
+    CompiledScene scene(world);
+
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    Vector3 eye(0, 2, 0);
+    for (size_t i = 0; i < rayCount; i++)
+        rays.push_back(Ray(eye, Vector3(randomDouble(-1, 1), randomDouble(-0.6, -0.05), randomDouble(-1, 1))));
+
+    std::clog << "Scene dispatch benchmark, " << scene.sphereCount() << " spheres, " << scene.quadCount()
+              << " quads, " << scene.genericCount() << " other, " << rayCount << " rays\n";
+
+    auto run = [&](const Hittable& target, const char* name) {
+        double checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& ray : rays) {
+            HitRecord rec;
+            if (target.hit(ray, Interval(rayEpsilon, infinity), rec)) {
+                rec.finalize(ray);
+                checksum += rec.t + rec.normal.y();
+            }
+        }
+        double seconds = secondsSince(start);
+        std::clog << "  " << name << rayCount / seconds * 1e-6 << " Mrays/s (checksum " << checksum << ")\n";
+        return seconds;
+    };
+    double virtualSeconds = run(*bvh, "FlatBVH, virtual hit   ");
+    double switchSeconds = run(scene, "CompiledScene, switch  ");
+    std::clog << "  speedup " << virtualSeconds / switchSeconds << "x\n";
+}
+
+void sphereSetBenchmark(size_t count, size_t rayCount) {
+    // A particle cloud: the same spheres as separate primitives and as SoA batches.
+    HittableList world;
+    auto sphereSet = make_shared<SphereSet>();
+    auto mat = make_shared<Lambertian>(Vector3(0.5, 0.5, 0.5));
+    for (size_t i = 0; i < count; i++) {
+        Vector3 center = Vector3::random(-100, 100);
+        double radius = randomDouble(0.05, 0.2);
+        world.add(make_shared<Sphere>(center, radius, mat));
+        sphereSet->add(center, radius, mat);
+    }
+
+    CompiledScene scene(world);
+    auto start = std::chrono::steady_clock::now();
+    sphereSet->build();
+    std::clog << "Sphere set benchmark, " << count << " spheres, " << rayCount << " rays, build "
+              << secondsSince(start) << " s"
+#ifdef __AVX__
+              << ", AVX kernel\n";
+#else
+              << ", scalar kernel\n";
+#endif
+
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    for (size_t i = 0; i < rayCount; i++) {
+        Vector3 origin = Vector3::random(-100, 100);
+        rays.push_back(Ray(origin, Vector3::random(-1, 1)));
+    }
+
+    auto run = [&](const Hittable& target, const char* name) {
+        double checksum = 0;
+        start = std::chrono::steady_clock::now();
+        for (const auto& ray : rays) {
+            HitRecord rec;
+            if (target.hit(ray, Interval(rayEpsilon, infinity), rec)) {
+                rec.finalize(ray);
+                checksum += rec.t + rec.normal.y();
+            }
+        }
+        double seconds = secondsSince(start);
+        std::clog << "  " << name << rayCount / seconds * 1e-6 << " Mrays/s (checksum " << checksum << ")\n";
+        return seconds;
+    };
+    double sceneSeconds = run(scene, "CompiledScene, 1 sphere/test  ");
+    double setSeconds = run(*sphereSet, "SphereSet, 4 spheres/test     ");
+    std::clog << "  speedup " << sceneSeconds / setSeconds << "x\n";
+}
+
+void quadSetBenchmark(size_t boxCount, size_t rayCount) {
+    // Boxes made by box(): the same quads one at a time and as packed batches.
+    HittableList world;
+    auto quadSet = make_shared<QuadSet>();
+    auto mat = make_shared<Lambertian>(Vector3(0.5, 0.5, 0.5));
+    for (size_t i = 0; i < boxCount; i++) {
+        Vector3 corner = Vector3::random(-100, 100);
+        auto sides = box(corner, corner + Vector3::random(0.1, 1.0), mat);
+        for (const auto& side : sides->objects) {
+            world.add(side);
+            quadSet->add(static_cast<const Quad&>(*side));
+        }
+    }
+
+    CompiledScene scene(world);
+    auto start = std::chrono::steady_clock::now();
+    quadSet->build();
+    std::clog << "Quad set benchmark, " << quadSet->size() << " quads, " << rayCount << " rays, build "
+              << secondsSince(start) << " s"
+#ifdef __AVX__
+              << ", AVX kernel\n";
+#else
+              << ", scalar kernel\n";
+#endif
+
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    for (size_t i = 0; i < rayCount; i++)
+        rays.push_back(Ray(Vector3::random(-100, 100), Vector3::random(-1, 1)));
+
+    auto run = [&](const Hittable& target, const char* name) {
+        double checksum = 0;
+        start = std::chrono::steady_clock::now();
+        for (const auto& ray : rays) {
+            HitRecord rec;
+            if (target.hit(ray, Interval(rayEpsilon, infinity), rec)) {
+                rec.finalize(ray);
+                checksum += rec.t + rec.normal.y();
+            }
+        }
+        double seconds = secondsSince(start);
+        std::clog << "  " << name << rayCount / seconds * 1e-6 << " Mrays/s (checksum " << checksum << ")\n";
+        return seconds;
+    };
+    double sceneSeconds = run(scene, "CompiledScene, 1 quad/test  ");
+    double setSeconds = run(*quadSet, "QuadSet, 4 quads/test       ");
+    std::clog << "  speedup " << sceneSeconds / setSeconds << "x\n";
+}
+
+// bouncingSpheres() grown to (2 * gridHalf)^2 small spheres, one material each, allocated
+// from `arena` or with make_shared.
+HittableList bouncingSpheresWorld(int gridHalf, SceneArena* arena) {
+    HittableList world;
+    auto checker = arenaMake<CheckerTexture>(arena, 0.4, arenaMake<SolidColor>(arena, Vector3(0, 0, 0)),
+                                             arenaMake<SolidColor>(arena, Vector3(1, 1, 1)));
+    world.add(arenaMake<Sphere>(arena, Vector3(0, -1000, 0), 1000, arenaMake<Lambertian>(arena, checker)));
+
+    for (int a = -gridHalf; a < gridHalf; a++) {
+        for (int b = -gridHalf; b < gridHalf; b++) {
+            auto chooseMat = randomDouble();
+            Vector3 center(a + 0.9 * randomDouble(), 0.2, b + 0.9 * randomDouble());
+            shared_ptr<Material> sphereMaterial;
+            if (chooseMat < 0.8) {
+                auto albedo = Vector3::random() * Vector3::random();
+                sphereMaterial = arenaMake<Lambertian>(arena, arenaMake<SolidColor>(arena, albedo));
+            } else if (chooseMat < 0.95) {
+                sphereMaterial = arenaMake<Metal>(arena, Vector3::random(0.5, 1), randomDouble(0, 0.5));
+            } else {
+                sphereMaterial = arenaMake<Dielectric>(arena, 1.5);
+            }
+            world.add(arenaMake<Sphere>(arena, center, 0.2, sphereMaterial));
+        }
+    }
+    return world;
+}
+
+inline size_t heapBytesInUse() {
+#ifdef __GLIBC__
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+// Peak resident set size since the last resetPeakResident(). Linux only; 0 elsewhere.
+inline size_t peakResidentBytes() {
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return std::stoull(line.substr(6)) * 1024;
+#endif
+    return 0;
+}
+
+inline void resetPeakResident() {
+#ifdef __linux__
+    std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+void sceneArenaBenchmark(size_t count, size_t rayCount) {
+    int gridHalf = int(sqrt(double(count)) / 2);
+    std::clog << "Scene arena benchmark, " << 4 * gridHalf * gridHalf << " spheres, " << rayCount << " rays\n";
+
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    for (size_t i = 0; i < rayCount; i++) {
+        Vector3 eye(randomDouble(-gridHalf, gridHalf), 2, randomDouble(-gridHalf, gridHalf));
+        rays.push_back(Ray(eye, Vector3(randomDouble(-1, 1), randomDouble(-0.6, -0.05), randomDouble(-1, 1))));
+    }
+
+    for (int useArena = 0; useArena < 2; useArena++) {
+        size_t heapBefore = heapBytesInUse();
+        auto start = std::chrono::steady_clock::now();
+
+        std::unique_ptr<SceneArena> arena(useArena ? new SceneArena() : nullptr);
+        double buildSeconds, traceSeconds;
+        size_t heapBytes;
+        {
+            HittableList world = bouncingSpheresWorld(gridHalf, arena.get());
+            BVHNode bvh(world, arena.get());
+            world.clear();
+            buildSeconds = secondsSince(start);
+            heapBytes = heapBytesInUse() - heapBefore;
+
+            size_t hits = 0;
+            start = std::chrono::steady_clock::now();
+            for (const auto& ray : rays) {
+                HitRecord rec;
+                if (bvh.hit(ray, Interval(rayEpsilon, infinity), rec)) {
+                    rec.finalize(ray);
+                    hits++;
+                }
+            }
+            traceSeconds = secondsSince(start);
+            start = std::chrono::steady_clock::now();
+        }
+        arena.reset();
+        double teardownSeconds = secondsSince(start);
+
+        std::clog << (useArena ? "  arena       " : "  make_shared ") << "build " << buildSeconds << " s, heap "
+                  << heapBytes / (1024.0 * 1024.0) << " MiB, " << rayCount / traceSeconds * 1e-6
+                  << " Mrays/s, teardown " << teardownSeconds << " s\n";
+    }
+}
+
+void compressedBVHBenchmark(size_t count, size_t rayCount) {
+    // The same SAH tree as 64-byte FlatBVH nodes and as 16-byte quantized nodes, and the
+    // CompressedBVH built directly. Peaks are resident memory above what the scene holds.
+    HittableList world;
+    auto mat = make_shared<Lambertian>(Vector3(0.5, 0.5, 0.5));
+    for (size_t i = 0; i < count; i++)
+        world.add(make_shared<Sphere>(Vector3::random(-100, 100), randomDouble(0.05, 0.2), mat));
+    const double MiB = 1024.0 * 1024.0;
+
+    resetPeakResident();
+    size_t base = peakResidentBytes();
+    auto start = std::chrono::steady_clock::now();
+    CompressedBVH direct(world);
+    double directSeconds = secondsSince(start);
+    size_t directPeak = peakResidentBytes() - base;
+
+    resetPeakResident();
+    base = peakResidentBytes();
+    std::vector<FlatBVHNode> nodes;
+    std::vector<uint32_t> primIndices;
+    start = std::chrono::steady_clock::now();
+    ParallelBVHBuilder().build(FlatBVHBuilder::primitiveBounds(world.objects), nodes, primIndices);
+    double buildSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    CompressedBVH compressed(world.objects, nodes, primIndices);
+    double compressSeconds = secondsSince(start);
+    size_t compressPeak = peakResidentBytes() - base;
+    FlatBVH flat(world.objects, std::move(nodes), std::move(primIndices));
+
+    size_t flatBytes = flat.size() * sizeof(FlatBVHNode);
+    std::clog << "Compressed BVH benchmark, " << count << " spheres, " << rayCount << " rays\n"
+              << "  FlatBVH build " << buildSeconds << " s + compress " << compressSeconds << " s, peak "
+              << compressPeak / MiB << " MiB; direct build " << directSeconds << " s, peak " << directPeak / MiB
+              << " MiB\n"
+              << "  FlatBVH       " << flat.size() << " nodes, " << flatBytes / MiB << " MiB\n"
+              << "  CompressedBVH " << compressed.size() << " nodes, "
+              << compressed.nodeBytes() / MiB << " MiB ("
+              << double(flatBytes) / compressed.nodeBytes() << "x smaller)\n";
+
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    for (size_t i = 0; i < rayCount; i++)
+        rays.push_back(Ray(Vector3::random(-100, 100), Vector3::random(-1, 1)));
+
+    auto run = [&](const Hittable& target, const char* name) {
+        double checksum = 0;
+        size_t occluded = 0;
+        start = std::chrono::steady_clock::now();
+        for (const auto& ray : rays) {
+            HitRecord rec;
+            if (target.hit(ray, Interval(rayEpsilon, infinity), rec)) {
+                rec.finalize(ray);
+                checksum += rec.t + rec.normal.y();
+            }
+        }
+        double seconds = secondsSince(start);
+        for (const auto& ray : rays)
+            occluded += target.occluded(ray, 50) ? 1 : 0;
+        std::clog << "  " << name << rayCount / seconds * 1e-6 << " Mrays/s (checksum " << checksum
+                  << ", " << occluded << " occluded)\n";
+        return seconds;
+    };
+    double flatSeconds = run(flat, "FlatBVH       ");
+    double compressedSeconds = run(compressed, "CompressedBVH ");
+    double directRaySeconds = run(direct, "direct build  ");
+    std::clog << "  ray rate " << flatSeconds / compressedSeconds << "x of FlatBVH, direct build "
+              << flatSeconds / directRaySeconds << "x\n";
+}
+
+void outOfCoreBenchmark(size_t count, size_t rayCount, double budgetMiB) {
+    // A sphere cloud over a ground of quad tiles, written to chunk files and traced through a
+    // residency budget. Small runs are checked against the same scene held in memory.
+    const std::string dir = "ooc-scene";
+    bool compare = count <= 2000000;
+    HittableList world;
+    auto ground = make_shared<Lambertian>(Vector3(0.5, 0.5, 0.5));
+    auto mat = make_shared<Lambertian>(Vector3(0.7, 0.3, 0.3));
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        OutOfCoreWriter writer(dir);
+        for (int i = -50; i < 50; i++) {
+            for (int j = -50; j < 50; j++) {
+                Vector3 Q(4 * i, 0, 4 * j), u(4, 0, 0), v(0, 0, 4);
+                writer.addQuad(Q, u, v, ground);
+                if (compare)
+                    world.add(make_shared<Quad>(Q, u, v, ground));
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            Vector3 center(randomDouble(-200, 200), randomDouble(0.2, 20), randomDouble(-200, 200));
+            double radius = randomDouble(0.05, 0.2);
+            writer.addSphere(center, radius, mat);
+            if (compare)
+                world.add(make_shared<Sphere>(center, radius, mat));
+        }
+        if (!writer.finish()) {
+            std::clog << "Out-of-core benchmark: could not write " << dir << "\n";
+            return;
+        }
+    }
+    double writeSeconds = secondsSince(start);
+
+    std::vector< shared_ptr<Material> > materials = { ground, mat };
+    OutOfCoreScene scene(dir, materials, size_t(budgetMiB * 1024 * 1024));
+    auto stats = scene.stats();
+    std::clog << "Out-of-core benchmark, " << count << " spheres, " << rayCount << " rays, " << stats.chunkCount
+              << " chunks, " << stats.totalBytes / (1024.0 * 1024.0) << " MiB on disk, budget " << budgetMiB
+              << " MiB, write " << writeSeconds << " s\n";
+
+    // Camera rays from above one corner of the field, traced in 16x16 tiles as a tiled
+    // renderer would, so neighbouring rays share chunks.
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    size_t width = size_t(sqrt(double(rayCount)));
+    const size_t tile = 16;
+    Vector3 eye(-220, 40, -220);
+    for (size_t ty = 0; ty < width; ty += tile) {
+        for (size_t tx = 0; tx < width; tx += tile) {
+            for (size_t y = ty; y < std::min(width, ty + tile); y++) {
+                for (size_t x = tx; x < std::min(width, tx + tile); x++) {
+                    Vector3 target(-200 + 400.0 * x / width, 0, 200 - 400.0 * y / width);
+                    rays.push_back(Ray(eye, target - eye));
+                }
+            }
+        }
+    }
+    rayCount = rays.size();
+
+    auto run = [&](const Hittable& target, const char* name) {
+        double checksum = 0;
+        start = std::chrono::steady_clock::now();
+        for (const auto& ray : rays) {
+            HitRecord rec;
+            if (target.hit(ray, Interval(rayEpsilon, infinity), rec)) {
+                rec.finalize(ray);
+                checksum += rec.t + rec.normal.y();
+            }
+        }
+        double seconds = secondsSince(start);
+        std::clog << "  " << name << rayCount / seconds * 1e-6 << " Mrays/s (checksum " << checksum << ")\n";
+        return seconds;
+    };
+    double oocSeconds = run(scene, "OutOfCoreScene ");
+    stats = scene.stats();
+    std::clog << "  page-ins " << stats.pageIns << " (" << double(stats.pageIns) / rayCount << " per ray), evictions "
+              << stats.evictions << ", resident "
+              << stats.residentChunks << " chunks / " << stats.residentBytes / (1024.0 * 1024.0) << " MiB, peak "
+              << stats.peakResidentBytes / (1024.0 * 1024.0) << " MiB\n";
+    if (compare) {
+        CompiledScene inCore(world);
+        double inCoreSeconds = run(inCore, "CompiledScene  ");
+        std::clog << "  slowdown " << oocSeconds / inCoreSeconds << "x\n";
+    }
+}
+
+shared_ptr<EnvironmentLight> proceduralSky(int width, int height) {
+    // A blue gradient with a small, very bright sun: the hard case for unguided sampling.
+    std::vector<Vector3> pixels(size_t(width) * height);
+    Vector3 sun = unitVector(Vector3(1, 0.6, 0.4));
+    for (int j = 0; j < height; j++) {
+        double theta = pi * (j + 0.5) / height;
+        for (int i = 0; i < width; i++) {
+            double phi = 2 * pi * (i + 0.5) / width;
+            Vector3 d(-cos(phi) * sin(theta), cos(theta), sin(phi) * sin(theta));
+            double a = 0.5 * (d.y() + 1.0);
+            Vector3 color = d.y() < 0 ? Vector3(0.3, 0.3, 0.3) : (1.0 - a) * Vector3(1.0, 1.0, 1.0) + a * Vector3(0.5, 0.7, 1.0);
+            if (dot(d, sun) > cos(degrees2radians(1.5)))
+                color = Vector3(1000, 920, 800);
+            pixels[size_t(j) * width + i] = color;
+        }
+    }
+    return make_shared<EnvironmentLight>(width, height, std::move(pixels));
+}
+
+void environmentSetup(shared_ptr<EnvironmentLight> environment, HittableList& world, HittableList& lights, Camera& cam) {
+    world.add(make_shared<Quad>(Vector3(-20, 0, -20), Vector3(40, 0, 0), Vector3(0, 0, 40),
+                                make_shared<Lambertian>(Vector3(0.5, 0.5, 0.5))));
+    world.add(make_shared<Sphere>(Vector3(-2.2, 1, 0), 1.0, make_shared<Lambertian>(Vector3(0.8, 0.3, 0.2))));
+    world.add(make_shared<Sphere>(Vector3(0, 1, 0), 1.0, make_shared<Dielectric>(1.5)));
+    world.add(make_shared<Sphere>(Vector3(2.2, 1, 0), 1.0, make_shared<Metal>(Vector3(0.7, 0.65, 0.55), 0.1)));
+
+    lights.add(environment);
+
+    cam.aspectRatio = 16.0 / 9.0;
+    cam.imgWidth = 400;
+    cam.samplePerPixel = 32;
+    cam.maxDepth = 8;
+    cam.environment = environment;
+
+    cam.fovy = 30;
+    cam.camPos = Vector3(0, 3, 12);
+    cam.lookAt = Vector3(0, 0.8, 0);
+    cam.up = Vector3(0, 1, 0);
+}
+
+void environmentScene(const char* filename) {
+    auto environment = filename ? make_shared<EnvironmentLight>(filename) : proceduralSky(1024, 512);
+    HittableList world, lights;
+    Camera cam;
+    environmentSetup(environment, world, lights, cam);
+    cam.render(world, lights);
+}
+
+void environmentBenchmark(size_t normals) {
+    // Irradiance under the procedural sky at random normals, estimated with uniform hemisphere
+    // sampling, cosine sampling, and the camera's 50/50 mix of cosine and environment sampling,
+    // against the exact sum over the map's pixels.
+    const int width = 512, height = 256;
+    auto sky = proceduralSky(width, height);
+
+    std::vector<Vector3> ns;
+    std::vector<double> reference;
+    for (size_t k = 0; k < normals; k++) {
+        Vector3 n = unitVector(Vector3::random(-1, 1));
+        double e = 0;
+        for (int j = 0; j < height; j++) {
+            double theta = pi * (j + 0.5) / height;
+            double solidAngle = (2 * pi / width) * (pi / height) * sin(theta);
+            for (int i = 0; i < width; i++) {
+                double phi = 2 * pi * (i + 0.5) / width;
+                Vector3 d(-cos(phi) * sin(theta), cos(theta), sin(phi) * sin(theta));
+                e += sky->radiance(d).y() * fmax(0, dot(d, n)) * solidAngle;
+            }
+        }
+        ns.push_back(n);
+        reference.push_back(e);
+    }
+
+    std::clog << "Environment light benchmark, " << width << "x" << height << " sky with sun, " << normals
+              << " normals, relative RMS error of irradiance\n";
+    const char* names[3] = { "uniform hemisphere", "cosine            ", "cosine + env 50/50" };
+    for (int samples = 16; samples <= 1024; samples *= 4) {
+        double error[3] = { 0, 0, 0 };
+        for (size_t k = 0; k < ns.size(); k++) {
+            ONB uvw;
+            uvw.buildFromW(ns[k]);
+            for (int strategy = 0; strategy < 3; strategy++) {
+                double sum = 0;
+                for (int s = 0; s < samples; s++) {
+                    Vector3 d;
+                    double pdf;
+                    if (strategy == 0) {
+                        d = randomHemisphere(ns[k]);
+                        pdf = 1 / (2 * pi);
+                    } else {
+                        d = (strategy == 2 && randomDouble() < 0.5) ? sky->random(Vector3(0, 0, 0))
+                                                                     : uvw.local(randomCosineDirection());
+                        double cosPdf = fmax(0, dot(unitVector(d), ns[k])) / pi;
+                        pdf = strategy == 1 ? cosPdf : 0.5 * cosPdf + 0.5 * sky->pdfValue(Vector3(0, 0, 0), d);
+                    }
+                    double cosine = dot(unitVector(d), ns[k]);
+                    if (cosine > 0 && pdf > 0)
+                        sum += sky->radiance(d).y() * cosine / pdf;
+                }
+                double relative = (sum / samples - reference[k]) / reference[k];
+                error[strategy] += relative * relative;
+            }
+        }
+        for (int strategy = 0; strategy < 3; strategy++)
+            std::clog << "  " << samples << " spp, " << names[strategy] << "  " << sqrt(error[strategy] / ns.size()) << "\n";
+    }
+}
+
+void quadLightBenchmark(size_t samples) {
+    // Irradiance from the Cornell ceiling light at points below it, facing up. Uniform area
+    // sampling against Quad's solid-angle sampling: relative standard deviation per sample.
+    Vector3 Q(343, 554, 332), u(-130, 0, 0), v(0, 0, -105);
+    Quad light(Q, u, v, make_shared<DiffuseLight>(Vector3(15, 15, 15)));
+    Vector3 center = Q + 0.5 * u + 0.5 * v;
+
+    std::clog << "Quad light benchmark, " << samples << " samples per point\n";
+    const double heights[4] = { 1, 10, 100, 550 };
+    for (double h : heights) {
+        Vector3 origin = center + Vector3(40, -h, 20);
+        double sum[2] = { 0, 0 }, sumSquares[2] = { 0, 0 };
+        for (size_t i = 0; i < samples; i++) {
+            Vector3 p = Q + randomDouble() * u + randomDouble() * v;
+            Vector3 d = p - origin;
+            double pdfArea = d.lengthSquared() / (fabs(unitVector(d).y()) * u.length() * v.length());
+            double f = fmax(0, unitVector(d).y()) / pdfArea;
+            sum[0] += f;
+            sumSquares[0] += f * f;
+
+            d = light.random(origin);
+            f = fmax(0, unitVector(d).y()) / light.pdfValue(origin, d);
+            sum[1] += f;
+            sumSquares[1] += f * f;
+        }
+        std::clog << "  " << h << " below:";
+        const char* names[2] = { " area ", ", solid angle " };
+        for (int k = 0; k < 2; k++) {
+            double mean = sum[k] / samples;
+            double deviation = sqrt(fmax(0, sumSquares[k] / samples - mean * mean));
+            std::clog << names[k] << "E=" << mean << " rel.dev " << deviation / mean;
+        }
+        std::clog << "\n";
+    }
+}
+
+void denoiserBenchmark(int samples, int referenceSamples, int width) {
+    // Cornell box at `samples` spp, raw and denoised, against a `referenceSamples` spp render.
+    // Errors are RMS over gamma-encoded, clamped pixels, as written to the image.
+    HittableList world, lights;
+    Camera cam;
+    cornellScene(world, lights, cam);
+    cam.imgWidth = width;
+    CompiledScene scene(world);
+
+    FeatureBuffers reference, noisy;
+    cam.samplePerPixel = referenceSamples;
+    cam.render(scene, lights, reference);
+    cam.samplePerPixel = samples;
+    auto start = std::chrono::steady_clock::now();
+    cam.render(scene, lights, noisy);
+    double renderSeconds = secondsSince(start);
+
+    Denoiser denoiser;
+    start = std::chrono::steady_clock::now();
+    std::vector<Vector3> denoised = denoiser.denoise(noisy);
+    double denoiseSeconds = secondsSince(start);
+
+    auto encode = [](double c) { return fmin(0.999, fmax(0.0, sqrt(c))); };
+    auto error = [&](const std::vector<Vector3>& image) {
+        double sum = 0;
+        for (size_t p = 0; p < image.size(); p++)
+            for (int k = 0; k < 3; k++) {
+                double d = encode(image[p][k]) - encode(reference.color[p][k]);
+                sum += d * d;
+            }
+        return sqrt(sum / (3 * image.size()));
+    };
+    double noisyError = error(noisy.color), denoisedError = error(denoised);
+    std::clog << "Denoiser benchmark, " << noisy.width << "x" << noisy.height << ", " << samples << " spp against "
+              << referenceSamples << " spp, " << denoiser.threads << " threads\n"
+              << "  render " << renderSeconds << " s, denoise " << denoiseSeconds << " s\n"
+              << "  RMS error raw " << noisyError << ", denoised " << denoisedError
+              << " (raw needs ~" << samples * (noisyError / denoisedError) * (noisyError / denoisedError)
+              << " spp for the same error)\n";
+}
+
+// Renders the Cornell box on whichever workers connect to `port` and writes it to stdout.
+void coordinateCornellBox(int port, int samples, int width, int tileSize) {
+    HittableList world, lights;
+    Camera cam;
+    cornellScene(world, lights, cam);
+    cam.imgWidth = width;
+    int height = cam.imageHeight();
+
+    RenderCoordinator coordinator(port);
+    if (!coordinator.listening()) {
+        std::cerr << "Could not listen on port " << port << "\n";
+        return;
+    }
+    std::clog << "Waiting for workers on port " << coordinator.port() << "\n";
+    auto jobs = makeRenderJobs(width, height, tileSize, samples, std::max(1, samples / 4), 0);
+    AccumulationBuffer image(0, 0, width, height);
+    auto start = std::chrono::steady_clock::now();
+    if (!coordinator.render(jobs, image)) {
+        std::cerr << "No workers for " << coordinator.idleTimeout << " s; giving up\n";
+        return;
+    }
+
+    const auto& stats = coordinator.stats();
+    std::clog << jobs.size() << " jobs in " << secondsSince(start) << " s; workers joined " << stats.workersJoined
+              << ", lost " << stats.workersLost << ", jobs reassigned " << stats.jobsReassigned << "\n";
+    writePPM(std::cout, width, height, image.resolve());
+}
+
+// Renders jobs from the coordinator at host:port with a Cornell box of its own.
+size_t cornellBoxWorker(const char* host, int port, int maxJobs) {
+    HittableList world, lights;
+    Camera cam;
+    cornellScene(world, lights, cam);
+    CompiledScene scene(world);
+
+    RenderWorker worker;
+    worker.maxJobs = maxJobs;
+    return worker.run(host, port, [&](const RenderJob& job, AccumulationBuffer& out) {
+        cam.imgWidth = job.imageWidth;
+        cam.render(scene, lights, job, out);
+    });
+}
+
+void distributedBenchmark(int workerCount, int samples, int width) {
+    // Forks local workers, one of which dies after a few jobs when there are others to take
+    // over, and checks the merged image against the same jobs rendered in this process.
+    HittableList world, lights;
+    Camera cam;
+    cornellScene(world, lights, cam);
+    cam.imgWidth = width;
+    int height = cam.imageHeight();
+    CompiledScene scene(world);
+    auto jobs = makeRenderJobs(width, height, 16, samples, std::max(1, samples / 4), 0);
+
+    auto start = std::chrono::steady_clock::now();
+    AccumulationBuffer local(0, 0, width, height), tile;
+    for (const auto& job : jobs) {
+        cam.render(scene, lights, job, tile);
+        local.merge(tile);
+    }
+    double localSeconds = secondsSince(start);
+
+    // The coordinator shuts its workers down when it goes out of scope, so they can be reaped.
+    std::vector<pid_t> children;
+    AccumulationBuffer merged(0, 0, width, height);
+    double distributedSeconds;
+    RenderCoordinator::Stats stats;
+    {
+        RenderCoordinator coordinator;
+        coordinator.jobTimeout = 30;
+        coordinator.idleTimeout = 30;
+        for (int w = 0; w < workerCount; w++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                RenderWorker worker;
+                worker.maxJobs = w == 0 && workerCount > 1 ? 3 : -1;
+                worker.run("127.0.0.1", coordinator.port(), [&](const RenderJob& job, AccumulationBuffer& out) {
+                    cam.render(scene, lights, job, out);
+                });
+                _exit(0);
+            }
+            if (pid < 0) {
+                std::cerr << "Could not fork worker " << w << "\n";
+                break;
+            }
+            children.push_back(pid);
+        }
+        if (children.empty())
+            return;
+
+        start = std::chrono::steady_clock::now();
+        if (!coordinator.render(jobs, merged))
+            std::cerr << "No workers left; the distributed image is incomplete\n";
+        distributedSeconds = secondsSince(start);
+        stats = coordinator.stats();
+    }
+    for (pid_t pid : children)
+        waitpid(pid, nullptr, 0);
+
+    size_t mismatches = 0;
+    for (size_t p = 0; p < merged.sum.size(); p++)
+        if (merged.samples[p] != local.samples[p] || merged.sum[p].x() != local.sum[p].x()
+            || merged.sum[p].y() != local.sum[p].y() || merged.sum[p].z() != local.sum[p].z())
+            mismatches++;
+
+    std::clog << "Distributed benchmark, " << width << "x" << height << ", " << samples << " spp, "
+              << jobs.size() << " jobs, " << workerCount << " workers\n"
+              << "  in-process " << localSeconds << " s, distributed " << distributedSeconds << " s\n"
+              << "  workers joined " << stats.workersJoined << ", lost " << stats.workersLost
+              << ", jobs sent " << stats.jobsSent << ", reassigned " << stats.jobsReassigned << "\n"
+              << "  pixels differing from the in-process render: " << mismatches << "\n";
+}
+
+// The scenes a render daemon can serve.
+void registerDaemonScenes(SceneCache& cache) {
+    cache.registerScene("cornell", []() {
+        auto scene = make_shared<ResidentScene>();
+        cornellScene(scene->world, scene->lights, scene->camera);
+        scene->accelerated = make_shared<CompiledScene>(scene->world);
+        return scene;
+    });
+    cache.registerScene("environment", []() {
+        auto scene = make_shared<ResidentScene>();
+        environmentSetup(proceduralSky(1024, 512), scene->world, scene->lights, scene->camera);
+        scene->accelerated = make_shared<BVHNode>(scene->world);
+        return scene;
+    });
+}
+
+void renderDaemon(const std::string& path) {
+    SceneCache cache;
+    registerDaemonScenes(cache);
+    RenderDaemon daemon(cache);
+    if (!daemon.listen(path)) {
+        std::cerr << "Could not listen on " << path << "\n";
+        return;
+    }
+    std::clog << "Serving on " << path << "\n";
+    daemon.serve();
+}
+
+// Sends the words after the socket path to the daemon as one request; writes the reply to stdout.
+int renderClient(const std::string& path, int argc, char* argv[]) {
+    std::string request;
+    for (int i = 0; i < argc; i++)
+        request += (i ? " " : "") + std::string(argv[i]);
+    RenderClient client;
+    std::string reply;
+    if (!client.connect(path)) {
+        std::cerr << "Could not connect to " << path << "\n";
+        return 1;
+    }
+    if (!client.request(request, reply)) {
+        std::cerr << (reply.empty() ? "Connection lost" : reply) << "\n";
+        return 1;
+    }
+    std::cout << reply;
+    return 0;
+}
+
+void daemonBenchmark(const std::string& sceneName, int requests, int width, int samples) {
+    // Cold start (scene, textures and BVH) against requests to a daemon that keeps the scene
+    // warm, each with a different field of view. Then, with room for one scene, alternating
+    // scenes shows the eviction.
+    std::string path = "/tmp/raytracer-bench-" + std::to_string(getpid()) + ".sock";
+
+    SceneCache cold;
+    registerDaemonScenes(cold);
+    auto start = std::chrono::steady_clock::now();
+    auto coldScene = cold.acquire(sceneName);
+    double buildSeconds = secondsSince(start);
+    if (!coldScene) {
+        std::cerr << "Unknown scene " << sceneName << "\n";
+        return;
+    }
+
+    SceneCache cache;
+    registerDaemonScenes(cache);
+    RenderDaemon daemon(cache);
+    if (!daemon.listen(path)) {
+        std::cerr << "Could not listen on " << path << "\n";
+        return;
+    }
+    std::thread server([&]() { daemon.serve(); });
+
+    RenderClient client;
+    client.connect(path);
+    std::string reply;
+    double firstSeconds = 0, warmSeconds = 0, traceSeconds = 0;
+    for (int i = 0; i < requests; i++) {
+        std::string request = "scene=" + sceneName + " width=" + std::to_string(width) + " spp="
+                            + std::to_string(samples) + " fov=" + std::to_string(coldScene->camera.fovy + 0.1 * i);
+        start = std::chrono::steady_clock::now();
+        if (!client.request(request, reply)) {
+            std::cerr << "Request failed: " << reply << "\n";
+            break;
+        }
+        double seconds = secondsSince(start);
+        if (i == 0) {
+            firstSeconds = seconds;
+        } else {
+            warmSeconds += seconds;
+            traceSeconds += daemon.stats().traceSeconds;
+        }
+    }
+    int warm = std::max(1, requests - 1);
+
+    SceneCache small(1);
+    registerDaemonScenes(small);
+    for (int i = 0; i < 4; i++)
+        small.acquire(i % 2 ? "environment" : "cornell");
+    auto smallStats = small.stats();
+
+    client.request("shutdown", reply);
+    server.join();
+    auto stats = cache.stats();
+    std::clog << "Render daemon benchmark, " << sceneName << ", " << requests << " requests at " << width << " px, "
+              << samples << " spp, " << daemon.threads << " threads\n"
+              << "  scene load " << buildSeconds * 1000 << " ms; first request " << firstSeconds * 1000 << " ms\n"
+              << "  warm requests " << warmSeconds / warm * 1000 << " ms, of which tracing "
+              << traceSeconds / warm * 1000 << " ms\n"
+              << "  cache hits " << stats.hits << ", loads " << stats.loads << "; with room for one scene, "
+              << "alternating 4 requests: loads " << smallStats.loads << ", evictions " << smallStats.evictions << "\n";
+}
+
+// Renders the Cornell box for `seconds` of wall-clock time, or until the estimated noise
+// falls to `noiseTarget`, and writes what it has to stdout.
+void budgetedCornellBox(double seconds, double noiseTarget, int width) {
+    HittableList world, lights;
+    Camera cam;
+    cornellScene(world, lights, cam);
+    cam.imgWidth = width;
+    CompiledScene scene(world);
+
+    ProgressiveRenderer renderer;
+    renderer.timeBudget = seconds;
+    renderer.noiseTarget = noiseTarget;
+    auto result = renderer.render(cam, scene, lights);
+
+    std::clog << "Budget " << seconds << " s on " << renderer.threads << " threads: " << result.passes << " passes in "
+              << result.seconds << " s, samples per pixel " << result.minSamples << "-" << result.maxSamples
+              << " (mean " << result.meanSamples << "), estimated noise " << result.noise
+              << (result.reachedNoiseTarget ? ", noise target reached" : "") << "\n";
+    writePPM(std::cout, result.image.width, result.image.height, result.image.resolve());
+}
+
+// The moving-spheres clip seen from a camera that swings around it, every frame rendered
+// against one BVH over the whole clip and written to frame_NNN.ppm as soon as it is done.
+// Compares with building the scene and rendering each frame on its own.
+void batchAnimation(int frameCount, int width, int samples) {
+    auto start = std::chrono::steady_clock::now();
+    HittableList world, lights;
+    Camera base;
+    movingSpheresScene(world, lights, base);
+    base.imgWidth = width;
+    base.samplePerPixel = samples;
+    BVHNode bvh(world);
+    double buildSeconds = secondsSince(start);
+
+    CameraPath path({
+        { 0.0, Vector3(13, 4, 6), Vector3(0, 0.5, 0), Vector3(0, 1, 0), 30 },
+        { 0.5, Vector3(6, 3, 13), Vector3(0, 0.7, 0), Vector3(0, 1, 0), 35 },
+        { 1.0, Vector3(-6, 5, 12), Vector3(0, 0.5, 0), Vector3(0, 1, 0), 30 },
+    });
+    auto views = path.frames(base, frameCount, 0.5);
+
+    BatchRenderer batch;
+    start = std::chrono::steady_clock::now();
+    batch.render(views, bvh, lights, [&](size_t view, const AccumulationBuffer& image) {
+        char name[32];
+        snprintf(name, sizeof(name), "frame_%03d.ppm", int(view));
+        std::ofstream out(name);
+        writePPM(out, image.width, image.height, image.resolve());
+        std::clog << "Frame " << view << " written after " << secondsSince(start) << " s\n";
+    });
+    double batchSeconds = secondsSince(start);
+
+    // One view the old way, scene build included, for the per-view cost.
+    start = std::chrono::steady_clock::now();
+    {
+        HittableList soloWorld, soloLights;
+        Camera solo;
+        movingSpheresScene(soloWorld, soloLights, solo);
+        BVHNode soloBVH(soloWorld);
+        Camera cam = views.front();
+        AccumulationBuffer image(0, 0, cam.imgWidth, cam.imageHeight());
+        cam.render(soloBVH, soloLights, makeRenderJobs(cam.imgWidth, cam.imageHeight(), 16, samples, samples, 0), image, 1);
+    }
+    double soloSeconds = secondsSince(start);
+
+    std::clog << "Batch of " << frameCount << " frames at " << width << " px, " << samples << " spp on " << batch.threads
+              << " threads: scene build " << buildSeconds * 1000 << " ms once, " << batchSeconds << " s in all ("
+              << batchSeconds / frameCount * 1000 << " ms per frame); a lone frame with its own build takes "
+              << soloSeconds * 1000 << " ms on one thread\n";
+}
+
+// Renders only a pixel rectangle of the Cornell box, written as an image of that size.
+void croppedCornellBox(int x, int y, int w, int h, int samples, int width) {
+    HittableList world, lights;
+    Camera cam;
+    cornellScene(world, lights, cam);
+    cam.imgWidth = width;
+    cam.samplePerPixel = samples;
+    cam.cropX = x;
+    cam.cropY = y;
+    cam.cropWidth = w;
+    cam.cropHeight = h;
+
+    CompiledScene scene(world);
+    cam.render(scene, lights);
+}
+
+void regionOfInterestBenchmark(int width, int samples) {
+    // A region around the glass sphere: rendered alone against the full frame, then, under a
+    // time budget that ends mid-pass, the samples it gets with each tile order.
+    HittableList world, lights;
+    Camera cam;
+    cornellScene(world, lights, cam);
+    cam.imgWidth = width;
+    cam.samplePerPixel = samples;
+    CompiledScene scene(world);
+    int height = cam.imageHeight();
+    PixelRect roi(width / 8, height / 2, width / 4, height / 4);
+
+    auto start = std::chrono::steady_clock::now();
+    AccumulationBuffer full(0, 0, width, height);
+    cam.render(scene, lights, makeRenderJobs(width, height, 16, samples, samples, 0), full, hardwareThreads());
+    double fullSeconds = secondsSince(start);
+
+    cam.cropX = roi.x0;
+    cam.cropY = roi.y0;
+    cam.cropWidth = roi.width;
+    cam.cropHeight = roi.height;
+    start = std::chrono::steady_clock::now();
+    AccumulationBuffer cropped(roi.x0, roi.y0, roi.width, roi.height);
+    cam.render(scene, lights, makeRenderJobs(width, cam.cropRect(), 16, samples, samples, 0), cropped, hardwareThreads());
+    double cropSeconds = secondsSince(start);
+
+    size_t mismatches = 0;
+    for (int y = roi.y0; y < roi.y0 + roi.height; y++)
+        for (int x = roi.x0; x < roi.x0 + roi.width; x++) {
+            Vector3 a = full.sum[size_t(y) * width + x], b = cropped.sum[size_t(y - roi.y0) * roi.width + (x - roi.x0)];
+            if (a.x() != b.x() || a.y() != b.y() || a.z() != b.z())
+                mismatches++;
+        }
+    std::clog << "Region of interest benchmark, " << width << "x" << height << ", " << samples << " spp, region "
+              << roi.width << "x" << roi.height << " at (" << roi.x0 << ", " << roi.y0 << ")\n"
+              << "  full frame " << fullSeconds << " s, crop window " << cropSeconds << " s ("
+              << fullSeconds / cropSeconds << "x), pixels differing from the full frame: " << mismatches << "\n";
+
+    // Budget for about 2.5 passes of the full frame, so the last pass is cut short.
+    cam.cropWidth = cam.cropHeight = 0;
+    std::vector<double> importance(size_t(width) * height, 0);
+    for (int y = roi.y0; y < roi.y0 + roi.height; y++)
+        for (int x = roi.x0; x < roi.x0 + roi.width; x++)
+            importance[size_t(y) * width + x] = 1;
+    const char* names[] = { "shuffled", "center-out", "importance" };
+    TileOrder orders[] = { TileOrder::Shuffled, TileOrder::CenterOut, TileOrder::Importance };
+    for (int k = 0; k < 3; k++) {
+        ProgressiveRenderer renderer;
+        renderer.timeBudget = fullSeconds / samples * 10;
+        renderer.samplesPerPass = 4;
+        renderer.tileOrder = orders[k];
+        renderer.importance = importance;
+        auto result = renderer.render(cam, scene, lights);
+        double inside = 0, outside = 0;
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++) {
+                bool in = x >= roi.x0 && x < roi.x0 + roi.width && y >= roi.y0 && y < roi.y0 + roi.height;
+                (in ? inside : outside) += result.image.samples[size_t(y) * width + x];
+            }
+        double insidePixels = double(roi.width) * roi.height;
+        std::clog << "  " << names[k] << ": mean spp in the region " << inside / insidePixels << ", elsewhere "
+                  << outside / (double(width) * height - insidePixels) << "\n";
+    }
+}
+
+// The Cornell box with a panel hung under the light, so the room is lit almost only by the
+// patch of ceiling around it.
+void panelCornellScene(HittableList& world, HittableList& lights, Camera& cam) {
+    cornellScene(world, lights, cam);
+    auto white = make_shared<Lambertian>(Vector3(.73, .73, .73));
+    world.add(make_shared<Quad>(Vector3(193, 520, 207), Vector3(170, 0, 0), Vector3(0, 0, 145), white));
+}
+
+void guidingBenchmark(int width, double seconds, int referenceSamples) {
+    // The panel Cornell box, whose lit ceiling light sampling cannot find past the panel and
+    // BSDF sampling rarely does. Equal-time renders with and without a guide, whose training
+    // iterations count against its time, against a `referenceSamples` spp render.
+    HittableList world, lights;
+    Camera cam;
+    panelCornellScene(world, lights, cam);
+    cam.imgWidth = width;
+    CompiledScene scene(world);
+    int height = cam.imageHeight();
+    unsigned threads = hardwareThreads();
+
+    auto start = std::chrono::steady_clock::now();
+    AccumulationBuffer reference(0, 0, width, height);
+    cam.render(scene, lights, makeRenderJobs(width, height, 16, referenceSamples, 16, 1), reference, threads);
+    std::vector<Vector3> truth = reference.resolve();
+    double referenceSeconds = secondsSince(start);
+
+    auto error = [&](const AccumulationBuffer& image) {
+        std::vector<Vector3> pixels = image.resolve();
+        double sum = 0, norm = 0;
+        for (size_t p = 0; p < pixels.size(); p++)
+            for (int k = 0; k < 3; k++) {
+                double d = pixels[p][k] - truth[p][k];
+                sum += d * d;
+                norm += truth[p][k] * truth[p][k];
+            }
+        return sqrt(sum / norm);
+    };
+
+    ProgressiveRenderer renderer;
+    renderer.timeBudget = seconds;
+    renderer.threads = threads;
+    auto plain = renderer.render(cam, scene, lights);
+
+    // Training: iterations of 1, 2, 4, ... spp until a quarter of the budget has gone, which
+    // the last, doubled iteration takes to about half.
+    start = std::chrono::steady_clock::now();
+    AABB bounds = scene.boundingBox();
+    cam.guide = make_shared<PathGuide>(bounds);
+    int trainingSamples = 0;
+    for (int spp = 1; secondsSince(start) < seconds / 4; spp *= 2) {
+        AccumulationBuffer discard(0, 0, width, height);
+        cam.render(scene, lights, makeRenderJobs(width, height, 16, spp, spp, 100 + spp), discard, threads);
+        cam.guide->refine();
+        trainingSamples += spp;
+    }
+    cam.guide->learning = false;
+    double trainingSeconds = secondsSince(start);
+    renderer.timeBudget = std::max(0.0, seconds - trainingSeconds);
+    auto guided = renderer.render(cam, scene, lights);
+
+    std::clog << "Path guiding benchmark, " << width << "x" << height << ", " << seconds << " s each, reference "
+              << referenceSamples << " spp (" << referenceSeconds << " s)\n"
+              << "  unguided: " << plain.meanSamples << " spp, relative RMS error " << error(plain.image) << "\n"
+              << "  guided: " << cam.guide->iterations() << " training iterations (" << trainingSamples << " spp, "
+              << trainingSeconds << " s, " << cam.guide->regionCount() << " regions), then " << guided.meanSamples
+              << " spp, relative RMS error " << error(guided.image) << "\n";
+}
+
+// Renders `passes` passes of the Cornell box, each with a new caustic photon map at a smaller
+// radius and `samples` spp, and writes the average to stdout.
+void causticCornellBox(int passes, int samples, int width) {
+    HittableList world, lights;
+    Camera cam;
+    cornellScene(world, lights, cam);
+    cam.imgWidth = width;
+    CompiledScene scene(world);
+    int height = cam.imageHeight();
+
+    cam.caustics = make_shared<PhotonMap>();
+    AccumulationBuffer image(0, 0, width, height);
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+        cam.caustics->tracePass(scene, lights, pass);
+        cam.render(scene, lights, makeRenderJobs(width, height, 16, (pass + 1) * samples, samples, 0, pass * samples),
+                   image, hardwareThreads());
+        std::clog << "\rPass " << pass + 1 << "/" << passes << ", radius " << cam.caustics->radius() << ", "
+                  << cam.caustics->storedPhotons() << " caustic photons " << std::flush;
+    }
+    std::clog << "\n" << secondsSince(start) << " s\n";
+    writePPM(std::cout, width, height, image.resolve());
+}
+
+void causticBenchmark(int width, double seconds, int referenceSamples) {
+    // The Cornell box for `seconds` path traced alone and with a caustic photon map in passes
+    // of 4 spp, against a path-traced `referenceSamples` spp render. Errors are relative RMS
+    // over the whole image and over the bottom quarter, which has the floor and the caustic.
+    HittableList world, lights;
+    Camera cam;
+    cornellScene(world, lights, cam);
+    cam.imgWidth = width;
+    CompiledScene scene(world);
+    int height = cam.imageHeight();
+    unsigned threads = hardwareThreads();
+
+    auto start = std::chrono::steady_clock::now();
+    AccumulationBuffer reference(0, 0, width, height);
+    cam.render(scene, lights, makeRenderJobs(width, height, 16, referenceSamples, 16, 1), reference, threads);
+    std::vector<Vector3> truth = reference.resolve();
+    double referenceSeconds = secondsSince(start);
+
+    auto error = [&](const AccumulationBuffer& image, int fromRow) {
+        std::vector<Vector3> pixels = image.resolve();
+        double sum = 0, norm = 0;
+        for (size_t p = size_t(fromRow) * width; p < pixels.size(); p++)
+            for (int k = 0; k < 3; k++) {
+                double d = pixels[p][k] - truth[p][k];
+                sum += d * d;
+                norm += truth[p][k] * truth[p][k];
+            }
+        return sqrt(sum / norm);
+    };
+
+    ProgressiveRenderer renderer;
+    renderer.timeBudget = seconds;
+    renderer.threads = threads;
+    auto plain = renderer.render(cam, scene, lights);
+
+    const int samples = 4;
+    cam.caustics = make_shared<PhotonMap>();
+    cam.caustics->threads = threads;
+    AccumulationBuffer mapped(0, 0, width, height);
+    start = std::chrono::steady_clock::now();
+    int passes = 0;
+    double photonSeconds = 0;
+    while (secondsSince(start) < seconds) {
+        auto photonStart = std::chrono::steady_clock::now();
+        cam.caustics->tracePass(scene, lights, passes);
+        photonSeconds += secondsSince(photonStart);
+        cam.render(scene, lights, makeRenderJobs(width, height, 16, (passes + 1) * samples, samples, 0, passes * samples),
+                   mapped, threads);
+        passes++;
+    }
+
+    int quarter = height * 3 / 4;
+    std::clog << "Caustic benchmark, " << width << "x" << height << ", " << seconds << " s each, reference "
+              << referenceSamples << " spp (" << referenceSeconds << " s)\n"
+              << "  path traced: " << plain.meanSamples << " spp, relative RMS error " << error(plain.image, 0)
+              << ", bottom quarter " << error(plain.image, quarter) << "\n"
+              << "  photon mapped: " << passes << " passes, " << passes * samples << " spp, "
+              << cam.caustics->photonsPerPass << " photons per pass (" << photonSeconds << " s), final radius "
+              << cam.caustics->radius() << ", relative RMS error " << error(mapped, 0) << ", bottom quarter "
+              << error(mapped, quarter) << "\n";
+}
+
+void radianceCacheBenchmark(int width, int samples, int referenceSamples) {
+    // The panel Cornell box, lit indirectly, at `samples` spp with full paths and with paths
+    // ended at the radiance cache, against a full-path `referenceSamples` spp render. Bias is
+    // the relative difference of the mean luminance; the cache starts empty and fills as the
+    // image renders, pass by pass.
+    HittableList world, lights;
+    Camera cam;
+    panelCornellScene(world, lights, cam);
+    cam.imgWidth = width;
+    CompiledScene scene(world);
+    int height = cam.imageHeight();
+    unsigned threads = hardwareThreads();
+
+    auto start = std::chrono::steady_clock::now();
+    AccumulationBuffer reference(0, 0, width, height);
+    cam.render(scene, lights, makeRenderJobs(width, height, 16, referenceSamples, 16, 1), reference, threads);
+    std::vector<Vector3> truth = reference.resolve();
+    double referenceSeconds = secondsSince(start);
+
+    auto mean = [](const std::vector<Vector3>& pixels) {
+        double sum = 0;
+        for (const Vector3& c : pixels)
+            sum += luminance(c);
+        return sum / pixels.size();
+    };
+    auto report = [&](const char* name, const AccumulationBuffer& image, double seconds) {
+        std::vector<Vector3> pixels = image.resolve();
+        double sum = 0, norm = 0;
+        for (size_t p = 0; p < pixels.size(); p++)
+            for (int k = 0; k < 3; k++) {
+                double d = pixels[p][k] - truth[p][k];
+                sum += d * d;
+                norm += truth[p][k] * truth[p][k];
+            }
+        double error = sqrt(sum / norm);
+        std::clog << "  " << name << ": " << seconds << " s (" << 1e6 * seconds / (double(width) * height * samples)
+                  << " us per sample), relative RMS error " << error << ", bias " << 100 * (mean(pixels) / mean(truth) - 1)
+                  << "%, error x sqrt(time) " << error * sqrt(seconds) << "\n";
+    };
+
+    std::clog << "Radiance cache benchmark, " << width << "x" << height << ", " << samples << " spp, max depth "
+              << cam.maxDepth << ", reference " << referenceSamples << " spp (" << referenceSeconds << " s)\n";
+    auto jobs = makeRenderJobs(width, height, 16, samples, 4, 0);
+    start = std::chrono::steady_clock::now();
+    AccumulationBuffer full(0, 0, width, height);
+    cam.render(scene, lights, jobs, full, threads);
+    report("full paths", full, secondsSince(start));
+
+    cam.radianceCache = make_shared<RadianceCache>();
+    start = std::chrono::steady_clock::now();
+    AccumulationBuffer cached(0, 0, width, height);
+    cam.render(scene, lights, jobs, cached, threads);
+    report("radiance cache", cached, secondsSince(start));
+    std::clog << "  cache: " << cam.radianceCache->usedEntries() << " of " << cam.radianceCache->entryCount()
+              << " entries used, " << cam.radianceCache->bytes() / (1024 * 1024) << " MiB\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "bench-bvh") {
+        bvhBuildBenchmark(argc > 2 ? std::stoul(argv[2]) : 1000000);
+        return 0;
+    }
+    if (mode == "bench-rays") {
+        shadowRayBenchmark(argc > 2 ? std::stoi(argv[2]) : 150, argc > 3 ? std::stoul(argv[3]) : 1000000);
+        return 0;
+    }
+    if (mode == "bench-scene") {
+        sceneDispatchBenchmark(argc > 2 ? std::stoi(argv[2]) : 150, argc > 3 ? std::stoul(argv[3]) : 1000000);
+        return 0;
+    }
+    if (mode == "bench-spheres") {
+        sphereSetBenchmark(argc > 2 ? std::stoul(argv[2]) : 1000000, argc > 3 ? std::stoul(argv[3]) : 200000);
+        return 0;
+    }
+    if (mode == "bench-quads") {
+        quadSetBenchmark(argc > 2 ? std::stoul(argv[2]) : 200000, argc > 3 ? std::stoul(argv[3]) : 200000);
+        return 0;
+    }
+    if (mode == "bench-arena") {
+        sceneArenaBenchmark(argc > 2 ? std::stoul(argv[2]) : 1000000, argc > 3 ? std::stoul(argv[3]) : 1000000);
+        return 0;
+    }
+    if (mode == "bench-cbvh") {
+        compressedBVHBenchmark(argc > 2 ? std::stoul(argv[2]) : 1000000, argc > 3 ? std::stoul(argv[3]) : 200000);
+        return 0;
+    }
+    if (mode == "bench-ooc") {
+        outOfCoreBenchmark(argc > 2 ? std::stoul(argv[2]) : 1000000, argc > 3 ? std::stoul(argv[3]) : 250000,
+                           argc > 4 ? std::stod(argv[4]) : 48);
+        return 0;
+    }
+    if (mode == "bench-env") {
+        environmentBenchmark(argc > 2 ? std::stoul(argv[2]) : 64);
+        return 0;
+    }
+    if (mode == "environment") {
+        environmentScene(argc > 2 ? argv[2] : nullptr);
+        return 0;
+    }
+    if (mode == "bench-quadlight") {
+        quadLightBenchmark(argc > 2 ? std::stoul(argv[2]) : 1000000);
+        return 0;
+    }
+    if (mode == "denoise") {
+        denoisedCornellBox(argc > 2 ? std::stoi(argv[2]) : 32, argc > 3 ? std::stoi(argv[3]) : 600);
+        return 0;
+    }
+    if (mode == "aov") {
+        aovCornellBox(argc > 2 ? std::stoi(argv[2]) : 32, argc > 3 ? std::stoi(argv[3]) : 300,
+                      argc > 4 ? argv[4] : "cornell.exr");
+        return 0;
+    }
+    if (mode == "coordinator") {
+        coordinateCornellBox(argc > 2 ? std::stoi(argv[2]) : 7878, argc > 3 ? std::stoi(argv[3]) : 64,
+                             argc > 4 ? std::stoi(argv[4]) : 300, argc > 5 ? std::stoi(argv[5]) : 32);
+        return 0;
+    }
+    if (mode == "worker") {
+        size_t jobs = cornellBoxWorker(argc > 3 ? argv[3] : "127.0.0.1", argc > 2 ? std::stoi(argv[2]) : 7878,
+                                       argc > 4 ? std::stoi(argv[4]) : -1);
+        std::clog << "Rendered " << jobs << " jobs\n";
+        return 0;
+    }
+    if (mode == "bench-distributed") {
+        distributedBenchmark(argc > 2 ? std::stoi(argv[2]) : 3, argc > 3 ? std::stoi(argv[3]) : 16,
+                             argc > 4 ? std::stoi(argv[4]) : 120);
+        return 0;
+    }
+    if (mode == "daemon") {
+        renderDaemon(argc > 2 ? argv[2] : "/tmp/raytracer.sock");
+        return 0;
+    }
+    if (mode == "client") {
+        return renderClient(argc > 2 ? argv[2] : "/tmp/raytracer.sock", std::max(0, argc - 3), argv + 3);
+    }
+    if (mode == "bench-daemon") {
+        daemonBenchmark(argc > 2 ? argv[2] : "environment", argc > 3 ? std::stoi(argv[3]) : 20,
+                        argc > 4 ? std::stoi(argv[4]) : 64, argc > 5 ? std::stoi(argv[5]) : 2);
+        return 0;
+    }
+    if (mode == "budget") {
+        budgetedCornellBox(argc > 2 ? std::stod(argv[2]) : 2, argc > 3 ? std::stod(argv[3]) : 0,
+                           argc > 4 ? std::stoi(argv[4]) : 300);
+        return 0;
+    }
+    if (mode == "batch") {
+        batchAnimation(argc > 2 ? std::stoi(argv[2]) : 24, argc > 3 ? std::stoi(argv[3]) : 200,
+                       argc > 4 ? std::stoi(argv[4]) : 8);
+        return 0;
+    }
+    if (mode == "crop") {
+        if (argc < 6) {
+            std::cerr << "usage: crop x y width height [spp] [image width]\n";
+            return 1;
+        }
+        croppedCornellBox(std::stoi(argv[2]), std::stoi(argv[3]), std::stoi(argv[4]), std::stoi(argv[5]),
+                          argc > 6 ? std::stoi(argv[6]) : 32, argc > 7 ? std::stoi(argv[7]) : 600);
+        return 0;
+    }
+    if (mode == "bench-roi") {
+        regionOfInterestBenchmark(argc > 2 ? std::stoi(argv[2]) : 240, argc > 3 ? std::stoi(argv[3]) : 16);
+        return 0;
+    }
+    if (mode == "bench-guiding") {
+        guidingBenchmark(argc > 2 ? std::stoi(argv[2]) : 60, argc > 3 ? std::stod(argv[3]) : 30,
+                         argc > 4 ? std::stoi(argv[4]) : 16384);
+        return 0;
+    }
+    if (mode == "caustics") {
+        causticCornellBox(argc > 2 ? std::stoi(argv[2]) : 16, argc > 3 ? std::stoi(argv[3]) : 4,
+                          argc > 4 ? std::stoi(argv[4]) : 300);
+        return 0;
+    }
+    if (mode == "bench-caustics") {
+        causticBenchmark(argc > 2 ? std::stoi(argv[2]) : 60, argc > 3 ? std::stod(argv[3]) : 20,
+                         argc > 4 ? std::stoi(argv[4]) : 16384);
+        return 0;
+    }
+    if (mode == "bench-cache") {
+        radianceCacheBenchmark(argc > 2 ? std::stoi(argv[2]) : 100, argc > 3 ? std::stoi(argv[3]) : 64,
+                               argc > 4 ? std::stoi(argv[4]) : 4096);
+        return 0;
+    }
+    if (mode == "bench-denoise") {
+        denoiserBenchmark(argc > 2 ? std::stoi(argv[2]) : 32, argc > 3 ? std::stoi(argv[3]) : 1024,
+                          argc > 4 ? std::stoi(argv[4]) : 120);
+        return 0;
+    }
+    if (mode == "animation") {
+        movingSpheres(argc > 2 ? std::stoi(argv[2]) : 24);
+        return 0;
+    }
+
 //    bouncingSpheres();
     cornellBox();
 }
@@ -0,0 +1,161 @@
+#ifndef ACCUMULATION_H
+#define ACCUMULATION_H
+
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+// Samples [firstSample, firstSample + sampleCount) of every pixel in a rectangle of the image.
+// Each pixel's samples are drawn from a random stream seeded by (seed, pixel, firstSample),
+// so a job renders the same way wherever and however often it runs.
+struct RenderJob {
+    uint32_t id = 0;
+    int imageWidth = 0;
+    int x0 = 0, y0 = 0, width = 0, height = 0;
+    int firstSample = 0, sampleCount = 0;
+    uint64_t seed = 0;
+
+    uint64_t pixelSeed(int x, int y) const {
+        uint64_t pixel = uint64_t(y) * uint64_t(imageWidth) + uint64_t(x);
+        return mixBits(seed ^ mixBits(pixel ^ mixBits(uint64_t(firstSample))));
+    }
+};
+
+// Sums of radiance samples and their counts over a rectangle of the image. Buffers from
+// different jobs merge by adding both, and the pixel value is the sum over the count.
+struct AccumulationBuffer {
+    int x0 = 0, y0 = 0, width = 0, height = 0;
+    std::vector<Vector3> sum;
+    std::vector<uint32_t> samples;
+
+    AccumulationBuffer() {}
+    AccumulationBuffer(int x0, int y0, int width, int height) { reset(x0, y0, width, height); }
+
+    void reset(int left, int top, int w, int h) {
+        x0 = left;
+        y0 = top;
+        width = w;
+        height = h;
+        sum.assign(size_t(w) * h, Vector3(0, 0, 0));
+        samples.assign(size_t(w) * h, 0);
+    }
+
+    // Adds the part of `other` that overlaps this buffer.
+    void merge(const AccumulationBuffer& other) {
+        int left = std::max(x0, other.x0), right = std::min(x0 + width, other.x0 + other.width);
+        int top = std::max(y0, other.y0), bottom = std::min(y0 + height, other.y0 + other.height);
+        for (int y = top; y < bottom; y++) {
+            for (int x = left; x < right; x++) {
+                size_t from = size_t(y - other.y0) * other.width + (x - other.x0);
+                size_t to = size_t(y - y0) * width + (x - x0);
+                sum[to] += other.sum[from];
+                samples[to] += other.samples[from];
+            }
+        }
+    }
+
+    // Mean radiance of every pixel, black where nothing was sampled.
+    std::vector<Vector3> resolve() const {
+        std::vector<Vector3> out(sum.size());
+        for (size_t p = 0; p < sum.size(); p++)
+            out[p] = samples[p] > 0 ? sum[p] / samples[p] : Vector3(0, 0, 0);
+        return out;
+    }
+};
+
+// A rectangle of pixels.
+struct PixelRect {
+    int x0 = 0, y0 = 0, width = 0, height = 0;
+
+    PixelRect() {}
+    PixelRect(int x0, int y0, int width, int height) : x0(x0), y0(y0), width(width), height(height) {}
+};
+
+// Jobs covering `rect` of an image `imageWidth` pixels wide with samples [firstSample,
+// samplesPerPixel), in passes of `samplesPerJob` samples over square tiles; pass by pass,
+// tiles in scanline order.
+inline std::vector<RenderJob> makeRenderJobs(int imageWidth, const PixelRect& rect, int tileSize, int samplesPerPixel,
+                                             int samplesPerJob, uint64_t seed, int firstSample = 0) {
+    std::vector<RenderJob> jobs;
+    samplesPerJob = std::max(1, samplesPerJob);
+    for (int first = firstSample; first < samplesPerPixel; first += samplesPerJob) {
+        for (int y = rect.y0; y < rect.y0 + rect.height; y += tileSize) {
+            for (int x = rect.x0; x < rect.x0 + rect.width; x += tileSize) {
+                RenderJob job;
+                job.id = uint32_t(jobs.size());
+                job.imageWidth = imageWidth;
+                job.x0 = x;
+                job.y0 = y;
+                job.width = std::min(tileSize, rect.x0 + rect.width - x);
+                job.height = std::min(tileSize, rect.y0 + rect.height - y);
+                job.firstSample = first;
+                job.sampleCount = std::min(samplesPerJob, samplesPerPixel - first);
+                job.seed = seed;
+                jobs.push_back(job);
+            }
+        }
+    }
+    return jobs;
+}
+
+// The same over a whole width x height image.
+inline std::vector<RenderJob> makeRenderJobs(int width, int height, int tileSize, int samplesPerPixel,
+                                             int samplesPerJob, uint64_t seed, int firstSample = 0) {
+    return makeRenderJobs(width, PixelRect(0, 0, width, height), tileSize, samplesPerPixel, samplesPerJob, seed,
+                          firstSample);
+}
+
+enum class TileOrder {
+    Scanline,   // as generated
+    Shuffled,   // a random permutation, which spreads a partial pass over the image
+    CenterOut,  // nearest to the center of the region first
+    Importance, // highest mean importance first
+};
+
+// Sorts `jobs` by `order`, keeping the generated order among equals. Shuffled permutes by
+// `seed`; CenterOut measures from the center of `region`; Importance reads `importance`, one
+// value per pixel of an image `jobs[i].imageWidth` wide.
+inline void prioritizeJobs(std::vector<RenderJob>& jobs, TileOrder order, const PixelRect& region,
+                           const std::vector<double>& importance = std::vector<double>(), uint64_t seed = 0) {
+    if (order == TileOrder::Scanline || jobs.empty())
+        return;
+    if (order == TileOrder::Shuffled) {
+        std::shuffle(jobs.begin(), jobs.end(), std::mt19937(uint32_t(mixBits(seed))));
+        return;
+    }
+
+    std::vector<std::pair<double, size_t>> keys(jobs.size());
+    double cx = region.x0 + 0.5 * region.width, cy = region.y0 + 0.5 * region.height;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const RenderJob& job = jobs[i];
+        double key = 0;
+        if (order == TileOrder::CenterOut) {
+            double dx = job.x0 + 0.5 * job.width - cx, dy = job.y0 + 0.5 * job.height - cy;
+            key = dx * dx + dy * dy;
+        } else {
+            double sum = 0;
+            for (int y = job.y0; y < job.y0 + job.height; y++)
+                for (int x = job.x0; x < job.x0 + job.width; x++) {
+                    size_t p = size_t(y) * job.imageWidth + x;
+                    sum += p < importance.size() ? importance[p] : 0;
+                }
+            key = -sum / std::max(1, job.width * job.height);
+        }
+        keys[i] = std::make_pair(key, i);
+    }
+    std::stable_sort(keys.begin(), keys.end(), [](const std::pair<double, size_t>& a, const std::pair<double, size_t>& b) {
+        return a.first < b.first;
+    });
+
+    std::vector<RenderJob> sorted;
+    sorted.reserve(jobs.size());
+    for (const auto& key : keys)
+        sorted.push_back(jobs[key.second]);
+    jobs.swap(sorted);
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "Utils.hpp"
+#include "Hittable.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Rigid transform (rotation about Y, then translation) interpolated linearly between keyframes.
+// Times outside the keyframe range hold the first or last pose.
+class KeyframedTransform : public Hittable {
+public:
+    struct Keyframe {
+        double time;
+        Vector3 offset;
+        double angleY; // degrees
+    };
+
+    KeyframedTransform(shared_ptr<Hittable> object, std::vector<Keyframe> keys)
+            : object(object), keys(keys)
+    {
+        std::sort(this->keys.begin(), this->keys.end(), [](const Keyframe& a, const Keyframe& b) {
+            return a.time < b.time;
+        });
+        bbox = boundingBoxDuring(Interval(this->keys.front().time, this->keys.back().time));
+    }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const override {
+        Keyframe pose = poseAt(r.time());
+        auto radians = degrees2radians(pose.angleY);
+        auto sinTheta = sin(radians);
+        auto cosTheta = cos(radians);
+
+        Ray localRay = toLocal(r, pose, sinTheta, cosTheta);
+        if (!object->hit(localRay, ray_t, outRec))
+            return false;
+
+        outRec.finalize(localRay);
+
+        auto p = outRec.p;
+        auto normal = outRec.normal;
+        outRec.p = Vector3(cosTheta * p[0] + sinTheta * p[2], p[1], -sinTheta * p[0] + cosTheta * p[2]) + pose.offset;
+        outRec.normal = Vector3(cosTheta * normal[0] + sinTheta * normal[2], normal[1], -sinTheta * normal[0] + cosTheta * normal[2]);
+        return true;
+    }
+
+    bool occluded(const Ray& r, double tMax) const override {
+        Keyframe pose = poseAt(r.time());
+        auto radians = degrees2radians(pose.angleY);
+        return object->occluded(toLocal(r, pose, sin(radians), cos(radians)), tMax);
+    }
+
+    AABB boundingBox() const override { return bbox; }
+
+    AABB boundingBoxDuring(const Interval& time) const override {
+        AABB local = object->boundingBoxDuring(time);
+
+        // Poses at the interval ends and at every keyframe inside it.
+        std::vector<double> times;
+        times.push_back(time.min);
+        for (const auto& key : keys) {
+            if (time.surrounds(key.time))
+                times.push_back(key.time);
+        }
+        times.push_back(time.max);
+
+        // Radius of the local box around the rotation axis, for the arc-vs-chord padding.
+        double radius = 0;
+        for (int i = 0; i < 4; i++) {
+            double x = (i & 1) ? local.x.max : local.x.min;
+            double z = (i & 2) ? local.z.max : local.z.min;
+            radius = fmax(radius, sqrt(x * x + z * z));
+        }
+
+        AABB box = AABB::empty;
+        for (size_t i = 0; i + 1 < times.size(); i++) {
+            // Between keyframes the pose is linear in time; split so each step rotates at most 5
+            // degrees and pad by the largest gap between the arc and its chord.
+            double sweep = fabs(poseAt(times[i + 1]).angleY - poseAt(times[i]).angleY);
+            int steps = std::max(1, int(ceil(sweep / 5.0)));
+            double pad = radius * (1 - cos(degrees2radians(sweep / steps) / 2));
+
+            for (int step = 0; step <= steps; step++) {
+                double t = times[i] + (times[i + 1] - times[i]) * step / steps;
+                AABB posed = transformedBounds(local, poseAt(t));
+                box = AABB(box, AABB(posed.x.expand(2 * pad), posed.y, posed.z.expand(2 * pad)));
+            }
+        }
+        return box;
+    }
+
+    Keyframe poseAt(double time) const {
+        if (time <= keys.front().time)
+            return keys.front();
+        if (time >= keys.back().time)
+            return keys.back();
+
+        size_t next = 1;
+        while (keys[next].time < time)
+            next++;
+        const Keyframe& a = keys[next - 1];
+        const Keyframe& b = keys[next];
+        double f = (time - a.time) / (b.time - a.time);
+        return Keyframe{ time, (1 - f) * a.offset + f * b.offset, (1 - f) * a.angleY + f * b.angleY };
+    }
+
+private:
+    static Ray toLocal(const Ray& r, const Keyframe& pose, double sinTheta, double cosTheta) {
+        auto origin = r.origin() - pose.offset;
+        auto direction = r.direction();
+        Vector3 localOrigin(cosTheta * origin[0] - sinTheta * origin[2], origin[1], sinTheta * origin[0] + cosTheta * origin[2]);
+        Vector3 localDir(cosTheta * direction[0] - sinTheta * direction[2], direction[1], sinTheta * direction[0] + cosTheta * direction[2]);
+        return Ray(localOrigin, localDir, r.time());
+    }
+
+    static AABB transformedBounds(const AABB& local, const Keyframe& pose) {
+        auto radians = degrees2radians(pose.angleY);
+        auto sinTheta = sin(radians);
+        auto cosTheta = cos(radians);
+
+        Vector3 min(infinity, infinity, infinity);
+        Vector3 max(-infinity, -infinity, -infinity);
+        for (int i = 0; i < 8; i++) {
+            auto x = (i & 1) ? local.x.max : local.x.min;
+            auto y = (i & 2) ? local.y.max : local.y.min;
+            auto z = (i & 4) ? local.z.max : local.z.min;
+            Vector3 corner(cosTheta * x + sinTheta * z, y, -sinTheta * x + cosTheta * z);
+            corner += pose.offset;
+            for (int c = 0; c < 3; c++) {
+                min[c] = fmin(min[c], corner[c]);
+                max[c] = fmax(max[c], corner[c]);
+            }
+        }
+        return AABB(min, max);
+    }
+
+    shared_ptr<Hittable> object;
+    std::vector<Keyframe> keys;
+    AABB bbox;
+};
+
+#endif
@@ -6,15 +6,20 @@
 #include "AABB.hpp"
 #include "Hittable.hpp"
 #include "HittableList.hpp"
+#include "SceneArena.hpp"
+
+#include <algorithm>
 
 class BVHNode : public Hittable {
 public:
-    BVHNode(HittableList list) {
-        build(list.objects, 0, list.objects.size());
+    // Interior nodes come from `arena` when one is given.
+    BVHNode(HittableList list, SceneArena* arena = nullptr) {
+        build(list.objects, 0, list.objects.size(), arena);
     }
 
-    BVHNode(std::vector< std::shared_ptr<Hittable> >& objects, size_t start, size_t end) {
-        build(objects, start, end);
+    BVHNode(std::vector< std::shared_ptr<Hittable> >& objects, size_t start, size_t end,
+            SceneArena* arena = nullptr) {
+        build(objects, start, end, arena);
     }
 
     bool hit(const Ray& ray, Interval interval, HitRecord& rec) const override {
@@ -27,12 +32,18 @@ public:
         return hitLeft || hitRight;
     }
 
+    bool occluded(const Ray& ray, double tMax) const override {
+        if (!bbox.hit(ray, Interval(rayEpsilon, tMax)))
+            return false;
+        return left->occluded(ray, tMax) || (right != left && right->occluded(ray, tMax));
+    }
+
     AABB boundingBox() const override {
         return bbox;
     }
 
 private:
-    void build(std::vector< std::shared_ptr<Hittable> >& objects, size_t start, size_t end) {
+    void build(std::vector< std::shared_ptr<Hittable> >& objects, size_t start, size_t end, SceneArena* arena) {
         bbox = AABB::empty;
         for (size_t index=start; index < end; index++)
             bbox = AABB(bbox, objects[index]->boundingBox());
@@ -54,8 +65,8 @@ private:
             std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
             auto mid = start + span / 2;
-            left = make_shared<BVHNode>(objects, start, mid);
-            right = make_shared<BVHNode>(objects, mid, end);
+            left = arenaMake<BVHNode>(arena, objects, start, mid, arena);
+            right = arenaMake<BVHNode>(arena, objects, mid, end, arena);
         }
 
         bbox = AABB(left->boundingBox(), right->boundingBox());
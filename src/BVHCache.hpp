@@ -0,0 +1,187 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "Utils.hpp"
+#include "FlatBVH.hpp"
+#include "MappedFile.hpp"
+#include "ParallelBVHBuilder.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+// On-disk BVH cache. A file holds a header, the FlatBVHNode array and the primitive index
+// array, each 64-byte aligned, so a mapped file is traversed in place with no build step.
+// Files are keyed by a hash of the primitive bounds: the BVH depends on nothing else.
+class BVHCache {
+public:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t nodeSize;
+        uint64_t geometryHash;
+        uint64_t primCount;
+        uint64_t nodeCount;
+        uint64_t nodeOffset;
+        uint64_t primOffset;
+        uint64_t fileSize;
+    };
+
+    static uint64_t hashGeometry(const std::vector< shared_ptr<Hittable> >& objects) {
+        // FNV-1a over the primitive count and the bytes of every bounding box.
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const void* data, size_t len) {
+            auto bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < len; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+        };
+
+        uint64_t count = objects.size();
+        mix(&count, sizeof(count));
+        for (const auto& object : objects) {
+            AABB box = object->boundingBox();
+            double bounds[6] = { box.x.min, box.x.max, box.y.min, box.y.max, box.z.min, box.z.max };
+            mix(bounds, sizeof(bounds));
+        }
+        return hash;
+    }
+
+    static std::string cachePath(const std::string& cacheDir, uint64_t hash) {
+        char name[32];
+        snprintf(name, sizeof(name), "bvh-%016llx.bin", (unsigned long long)hash);
+        return cacheDir + "/" + name;
+    }
+
+    static bool save(const std::string& path, uint64_t hash, const FlatBVH& bvh) {
+        Header header = makeHeader(hash, bvh.primitiveCount(), bvh.size());
+
+        // Write to a temporary file first so a concurrent reader never maps a partial cache.
+        std::string tmpPath = path + ".tmp";
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+
+        std::vector<char> padding(alignment, 0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(padding.data(), std::streamsize(header.nodeOffset - sizeof(header)));
+        out.write(reinterpret_cast<const char*>(bvh.nodeData()), std::streamsize(header.nodeCount * sizeof(FlatBVHNode)));
+        out.write(padding.data(), std::streamsize(header.primOffset - (header.nodeOffset + header.nodeCount * sizeof(FlatBVHNode))));
+        out.write(reinterpret_cast<const char*>(bvh.primitiveIndices()), std::streamsize(header.primCount * sizeof(uint32_t)));
+        out.close();
+
+        if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Maps a cache file and wraps it in a FlatBVH over `objects`. Returns nullptr if the file
+    // is missing, truncated, corrupt or was built for different geometry.
+    static shared_ptr<FlatBVH> load(const std::string& path, uint64_t hash,
+                                    const std::vector< shared_ptr<Hittable> >& objects) {
+        auto file = make_shared<MappedFile>();
+        if (!file->open(path) || file->size() < sizeof(Header))
+            return nullptr;
+
+        Header header;
+        std::memcpy(&header, file->data(), sizeof(header));
+        Header expected = makeHeader(hash, objects.size(), header.nodeCount);
+
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+            || header.version != expected.version
+            || header.nodeSize != expected.nodeSize
+            || header.geometryHash != hash
+            || header.primCount != objects.size()
+            || header.nodeOffset != expected.nodeOffset
+            || header.primOffset != expected.primOffset
+            || header.fileSize != file->size())
+            return nullptr;
+
+        auto nodes = reinterpret_cast<const FlatBVHNode*>(file->data() + header.nodeOffset);
+        auto primIndices = reinterpret_cast<const uint32_t*>(file->data() + header.primOffset);
+        if (!validTree(nodes, size_t(header.nodeCount), primIndices, objects.size()))
+            return nullptr;
+        return make_shared<FlatBVH>(objects, file, nodes, size_t(header.nodeCount), primIndices);
+    }
+
+    static shared_ptr<FlatBVH> loadOrBuild(const HittableList& list, const std::string& cacheDir) {
+        uint64_t hash = hashGeometry(list.objects);
+        std::string path = cachePath(cacheDir, hash);
+
+        if (auto cached = load(path, hash, list.objects)) {
+            std::clog << "BVH cache hit: " << path << "\n";
+            return cached;
+        }
+
+        auto bvh = ParallelBVHBuilder::build(list);
+        mkdir(cacheDir.c_str(), 0755);
+        if (save(path, hash, *bvh))
+            std::clog << "BVH cache written: " << path << "\n";
+        else
+            std::clog << "BVH cache: could not write " << path << "\n";
+        return bvh;
+    }
+
+private:
+    static const uint64_t alignment = 64;
+
+    static uint64_t alignUp(uint64_t offset) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    // Every index is in range and each node but the root is the child of exactly one other, so
+    // what hangs off the root is a tree.
+    static bool validTree(const FlatBVHNode* nodes, size_t nodeCount, const uint32_t* primIndices, size_t primCount) {
+        if (primCount == 0)
+            return nodeCount == 0;
+        if (nodeCount == 0 || nodeCount > 2 * primCount - 1)
+            return false;
+        for (size_t i = 0; i < primCount; i++)
+            if (primIndices[i] >= primCount)
+                return false;
+
+        std::vector<bool> referenced(nodeCount, false);
+        referenced[0] = true;
+        for (size_t i = 0; i < nodeCount; i++) {
+            const FlatBVHNode& node = nodes[i];
+            if (node.isLeaf()) {
+                if (uint64_t(node.left) + node.count > primCount)
+                    return false;
+                continue;
+            }
+            uint32_t children[2] = { node.left, node.right };
+            for (uint32_t child : children) {
+                if (child >= nodeCount || referenced[child])
+                    return false;
+                referenced[child] = true;
+            }
+        }
+        return true;
+    }
+
+    static Header makeHeader(uint64_t hash, uint64_t primCount, uint64_t nodeCount) {
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "RTBVHC01", sizeof(header.magic));
+        header.version = 2;
+        header.nodeSize = sizeof(FlatBVHNode);
+        header.geometryHash = hash;
+        header.primCount = primCount;
+        header.nodeCount = nodeCount;
+        header.nodeOffset = alignUp(sizeof(Header));
+        header.primOffset = alignUp(header.nodeOffset + nodeCount * sizeof(FlatBVHNode));
+        header.fileSize = header.primOffset + primCount * sizeof(uint32_t);
+        return header;
+    }
+};
+
+#endif
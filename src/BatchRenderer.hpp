@@ -0,0 +1,142 @@
+#ifndef BATCH_RENDERER_H
+#define BATCH_RENDERER_H
+
+#include "Accumulation.hpp"
+#include "Camera.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Camera poses at keyframe times, interpolated linearly. Times outside the keyframe range hold
+// the first or last pose.
+class CameraPath {
+public:
+    struct Keyframe {
+        double time;
+        Vector3 camPos;
+        Vector3 lookAt;
+        Vector3 up;
+        double fovy;
+    };
+
+    explicit CameraPath(std::vector<Keyframe> keys) : keys(keys) {
+        std::sort(this->keys.begin(), this->keys.end(), [](const Keyframe& a, const Keyframe& b) {
+            return a.time < b.time;
+        });
+    }
+
+    Keyframe poseAt(double time) const {
+        if (time <= keys.front().time)
+            return keys.front();
+        if (time >= keys.back().time)
+            return keys.back();
+
+        size_t next = 1;
+        while (keys[next].time < time)
+            next++;
+        const Keyframe& a = keys[next - 1];
+        const Keyframe& b = keys[next];
+        double f = (time - a.time) / (b.time - a.time);
+        return Keyframe{ time, (1 - f) * a.camPos + f * b.camPos, (1 - f) * a.lookAt + f * b.lookAt,
+                         (1 - f) * a.up + f * b.up, (1 - f) * a.fovy + f * b.fovy };
+    }
+
+    // `frameCount` copies of `base` posed along the path, frame i at the start of its 1 /
+    // frameCount of the keyframe range, with the shutter open for `shutter` of a frame.
+    std::vector<Camera> frames(const Camera& base, int frameCount, double shutter = 0) const {
+        std::vector<Camera> cameras;
+        double start = keys.front().time, length = keys.back().time - keys.front().time;
+        for (int frame = 0; frame < frameCount; frame++) {
+            double time = start + length * frame / frameCount;
+            Keyframe pose = poseAt(time);
+            Camera cam = base;
+            cam.camPos = pose.camPos;
+            cam.lookAt = pose.lookAt;
+            cam.up = pose.up;
+            cam.fovy = pose.fovy;
+            cam.shutterOpen = time;
+            cam.shutterClose = time + shutter * length / frameCount;
+            cameras.push_back(cam);
+        }
+        return cameras;
+    }
+
+private:
+    std::vector<Keyframe> keys;
+};
+
+// Renders many views of one built scene, each over its crop window if it has one. The tiles of
+// every view go into one queue, view by view, so threads start on the next view while the last
+// tiles of the previous one finish. Each view is handed to `onFrame`, in view order, as soon as
+// it and every view before it are done; the thread that completes it makes the call while the
+// others keep rendering.
+class BatchRenderer {
+public:
+    typedef std::function<void(size_t view, const AccumulationBuffer& image)> FrameCallback;
+
+    unsigned threads = hardwareThreads();
+    int tileSize = 16;
+    uint64_t seed = 0;
+
+    void render(const std::vector<Camera>& views, const Hittable& world, const Hittable& lights,
+                const FrameCallback& onFrame) const {
+        struct View {
+            AccumulationBuffer image;
+            std::atomic<size_t> remaining;
+        };
+        struct Job {
+            size_t view;
+            RenderJob job;
+        };
+
+        std::vector<std::unique_ptr<View>> state;
+        std::vector<Job> jobs;
+        std::vector<bool> finished(views.size(), false);
+        for (size_t v = 0; v < views.size(); v++) {
+            Camera cam = views[v];
+            PixelRect region = cam.cropRect();
+            auto tiles = makeRenderJobs(cam.imgWidth, region, tileSize, cam.samplePerPixel, cam.samplePerPixel, seed);
+            state.push_back(std::unique_ptr<View>(new View()));
+            state.back()->image.reset(region.x0, region.y0, region.width, region.height);
+            state.back()->remaining = tiles.size();
+            finished[v] = tiles.empty();
+            for (const auto& tile : tiles)
+                jobs.push_back(Job{ v, tile });
+        }
+
+        std::atomic<size_t> next(0);
+        std::mutex emitMutex;
+        size_t nextEmit = 0;
+        parallelFor(0, threads, threads, [&](size_t, size_t, unsigned) {
+            AccumulationBuffer tile;
+            for (size_t i = next++; i < jobs.size(); i = next++) {
+                Camera camera(views[jobs[i].view]);
+                camera.render(world, lights, jobs[i].job, tile);
+                View& view = *state[jobs[i].view];
+                // Tiles of a view do not overlap, so they merge without a lock.
+                view.image.merge(tile);
+                if (--view.remaining > 0)
+                    continue;
+
+                std::lock_guard<std::mutex> lock(emitMutex);
+                finished[jobs[i].view] = true;
+                while (nextEmit < views.size() && finished[nextEmit]) {
+                    onFrame(nextEmit, state[nextEmit]->image);
+                    state[nextEmit]->image = AccumulationBuffer();
+                    nextEmit++;
+                }
+            }
+        });
+
+        // Trailing views without tiles (an empty image or no samples).
+        for (; nextEmit < views.size(); nextEmit++)
+            onFrame(nextEmit, state[nextEmit]->image);
+    }
+};
+
+#endif
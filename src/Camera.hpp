@@ -1,10 +1,28 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
 #include "Utils.hpp"
+#include "Accumulation.hpp"
 #include "Color.hpp"
+#include "Denoiser.hpp"
+#include "EnvironmentLight.hpp"
+#include "Framebuffer.hpp"
 #include "Hittable.hpp"
 #include "Material.hpp"
+#include "Parallel.hpp"
+#include "PathGuide.hpp"
 #include "PDF.hpp"
+#include "PhotonMap.hpp"
 #include "Quad.hpp"
+#include "RadianceCache.hpp"
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
@@ -16,24 +34,242 @@ public:
     int maxDepth = 10;
     Vector3 background = Vector3(0, 0, 0);
     bool onSkyBackground = false;
+    // Rays that miss read this map instead of the background. Add it to the lights list as
+    // well to importance-sample it.
+    shared_ptr<EnvironmentLight> environment;
 
     double fovy = 90;
     Vector3 camPos = Vector3(0, 0, -1);
     Vector3 lookAt = Vector3(0, 0, 0);
     Vector3 up = Vector3(0, 1, 0);
 
+    // Rays get a uniformly random time in [shutterOpen, shutterClose].
+    double shutterOpen = 0;
+    double shutterClose = 0;
+
+    // Ambient-occlusion preview: first hits are shaded by the fraction of aoSamples
+    // cosine-distributed rays that reach aoDistance without being blocked.
+    bool ambientOcclusion = false;
+    int aoSamples = 4;
+    double aoDistance = 100;
+
+    // Crop window in pixels: only this rectangle of the image is traced and images cover just
+    // the rectangle. A zero width or height means the whole image.
+    int cropX = 0, cropY = 0, cropWidth = 0, cropHeight = 0;
+
+    // Emission from each of these materials, wherever it lands on a path, also goes to a
+    // "light.<name>" channel of a Framebuffer render.
+    std::vector<std::pair<std::string, shared_ptr<Material>>> lightGroups;
+
+    // Diffuse bounces also sample the guide's learned incident radiance, and record into it
+    // while guide->learning is set.
+    shared_ptr<PathGuide> guide;
+
+    // Caustics at diffuse bounces come from this photon map instead of from paths that find a
+    // light through specular bounces, which the renderer then drops so they count once.
+    // Emitters missing from the lights list send no photons, so they lose their caustics.
+    shared_ptr<PhotonMap> caustics;
+
+    // Diffuse bounces record their outgoing radiance here. Once a path has spread wider than
+    // spreadThreshold times its footprint at the first hit, it ends at a diffuse bounce with
+    // what the cache holds there, except for a trainingFraction of those bounces, which go on
+    // to keep the cache learning (the heuristic of Mueller et al., "Real-time Neural Radiance
+    // Caching for Path Tracing").
+    shared_ptr<RadianceCache> radianceCache;
+    double spreadThreshold = 0.01;
+    double trainingFraction = 1.0 / 16;
+
     void render(const Hittable& world, const Hittable& lights) {
-        initialize();
-        std::cout << "P3\n" << imgWidth << ' ' << imgHeight << "\n255\n";
-        for (int j = 0; j < imgHeight; ++j) {
-            std::clog << "\rScanlines remaining: " << (imgHeight - j) << ' ' << std::flush;
-            for (int i = 0; i < imgWidth; ++i) {
+        render(world, lights, std::cout);
+    }
+
+    void render(const Hittable& world, const Hittable& lights, std::ostream& out) {
+        PixelRect crop = cropRect();
+        out << "P3\n" << crop.width << ' ' << crop.height << "\n255\n";
+        for (int j = crop.y0; j < crop.y0 + crop.height; ++j) {
+            std::clog << "\rScanlines remaining: " << (crop.y0 + crop.height - j) << ' ' << std::flush;
+            for (int i = crop.x0; i < crop.x0 + crop.width; ++i) {
                 Vector3 pixelColor(0, 0, 0);
                 for (int sample = 0; sample < samplePerPixel; ++sample) {
                     Ray ray = getRay(i, j);
                     pixelColor += rayColor(ray, maxDepth, world, lights);
                 }
-                writeColor(std::cout, pixelColor, samplePerPixel);
+                writeColor(out, pixelColor, samplePerPixel);
+            }
+        }
+
+        std::clog << "\rDone.\n";
+    }
+
+    // Image height for the current imgWidth and aspectRatio.
+    int imageHeight() {
+        initialize();
+        return imgHeight;
+    }
+
+    // The crop window clipped to the image, or the whole image when there is none.
+    PixelRect cropRect() {
+        initialize();
+        if (cropWidth <= 0 || cropHeight <= 0)
+            return PixelRect(0, 0, imgWidth, imgHeight);
+        int x0 = std::max(0, std::min(cropX, imgWidth)), y0 = std::max(0, std::min(cropY, imgHeight));
+        int x1 = std::max(x0, std::min(cropX + cropWidth, imgWidth)), y1 = std::max(y0, std::min(cropY + cropHeight, imgHeight));
+        return PixelRect(x0, y0, x1 - x0, y1 - y0);
+    }
+
+    // Traces the samples of `job` into `out`, which is reset to the job's rectangle. Each
+    // pixel reseeds the calling thread's random stream, so the result depends only on the job.
+    void render(const Hittable& world, const Hittable& lights, const RenderJob& job, AccumulationBuffer& out) {
+        initialize();
+        out.reset(job.x0, job.y0, job.width, job.height);
+        for (int j = job.y0; j < job.y0 + job.height; ++j) {
+            for (int i = job.x0; i < job.x0 + job.width; ++i) {
+                seedRandom(job.pixelSeed(i, j));
+                Vector3 color(0, 0, 0);
+                for (int sample = 0; sample < job.sampleCount; ++sample) {
+                    Vector3 c = rayColor(getRay(i, j), maxDepth, world, lights);
+                    if (c.x() == c.x() && c.y() == c.y() && c.z() == c.z())
+                        color += c;
+                }
+                size_t p = size_t(j - job.y0) * job.width + (i - job.x0);
+                out.sum[p] = color;
+                out.samples[p] = uint32_t(job.sampleCount);
+            }
+        }
+    }
+
+    // Renders `jobs` into `image` on `threads` threads, each with its own copy of the camera,
+    // taking the next job as they finish. Jobs that cover the same pixels merge in the order
+    // they complete. No job starts after `deadline`; returns how many were rendered.
+    size_t render(const Hittable& world, const Hittable& lights, const std::vector<RenderJob>& jobs,
+                  AccumulationBuffer& image, unsigned threads,
+                  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max()) const {
+        std::atomic<size_t> next(0), rendered(0);
+        std::mutex mergeMutex;
+        parallelFor(0, threads, threads, [&](size_t, size_t, unsigned) {
+            Camera camera(*this);
+            AccumulationBuffer tile;
+            for (size_t i = next++; i < jobs.size() && std::chrono::steady_clock::now() < deadline; i = next++) {
+                camera.render(world, lights, jobs[i], tile);
+                rendered++;
+                std::lock_guard<std::mutex> lock(mergeMutex);
+                image.merge(tile);
+            }
+        });
+        return rendered;
+    }
+
+    // Renders into `out`: the mean color and its luminance variance per pixel, the same variance
+    // for each sample's color divided by its own albedo, plus first-hit albedo, normal and depth
+    // for the denoiser. Samples are traced in the same order as the streaming render.
+    void render(const Hittable& world, const Hittable& lights, FeatureBuffers& out) {
+        PixelRect crop = cropRect();
+        out.resize(crop.width, crop.height);
+        for (int j = crop.y0; j < crop.y0 + crop.height; ++j) {
+            std::clog << "\rScanlines remaining: " << (crop.y0 + crop.height - j) << ' ' << std::flush;
+            for (int i = crop.x0; i < crop.x0 + crop.width; ++i) {
+                Vector3 color(0, 0, 0), albedo(0, 0, 0), normal(0, 0, 0);
+                double sumLuminance = 0, sumSquares = 0, sumIrradiance = 0, sumIrradianceSquares = 0, depth = 0;
+                for (int sample = 0; sample < samplePerPixel; ++sample) {
+                    PathSample path;
+                    Vector3 c = tracePath(getRay(i, j), world, lights, path);
+                    color += c;
+                    sumLuminance += luminance(c);
+                    sumSquares += luminance(c) * luminance(c);
+                    double irradiance = luminance(demodulate(c, path.albedo));
+                    sumIrradiance += irradiance;
+                    sumIrradianceSquares += irradiance * irradiance;
+                    albedo += path.albedo;
+                    normal += path.normal;
+                    depth += path.depth;
+                }
+
+                size_t p = size_t(j - crop.y0) * crop.width + (i - crop.x0);
+                double mean = sumLuminance / samplePerPixel;
+                out.color[p] = color / samplePerPixel;
+                out.variance[p] = std::max(0.0, sumSquares / samplePerPixel - mean * mean) / samplePerPixel;
+                double meanIrradiance = sumIrradiance / samplePerPixel;
+                out.irradianceVariance[p] =
+                    std::max(0.0, sumIrradianceSquares / samplePerPixel - meanIrradiance * meanIrradiance) / samplePerPixel;
+                out.albedo[p] = albedo / samplePerPixel;
+                out.normal[p] = normal.lengthSquared() > 0 ? unitVector(normal) : normal;
+                out.depth[p] = depth / samplePerPixel;
+            }
+        }
+
+        std::clog << "\rDone.\n";
+    }
+
+    // Renders arbitrary output variables into `out` in one pass, from the same paths as the
+    // beauty image and without extra rays. Radiance channels hold per-pixel means:
+    // "R", "G", "B" is the beauty image and equals emission + direct + indirect, split by how
+    // many scattering events came before the emitter (none, one, more). "background" collects
+    // what rays that miss the scene bring back and "light.<name>" each of lightGroups.
+    // First-hit channels: "albedo", "normal", "depth" (distance), "materialId" (in order of
+    // first appearance, from each pixel's first sample, -1 on a miss) and "samples".
+    // A crop fills only its window of the full image.
+    void render(const Hittable& world, const Hittable& lights, Framebuffer& out) {
+        PixelRect crop = cropRect();
+        out.resize(crop.width, crop.height);
+        out.setDisplayWindow(imgWidth, imgHeight, crop.x0, crop.y0);
+        const size_t beauty = out.addChannel("", "RGB");
+        const size_t emission = out.addChannel("emission", "RGB");
+        const size_t direct = out.addChannel("direct", "RGB");
+        const size_t indirect = out.addChannel("indirect", "RGB");
+        const size_t backgroundChannel = out.addChannel("background", "RGB");
+        std::vector<size_t> groupChannels;
+        for (const auto& group : lightGroups)
+            groupChannels.push_back(out.addChannel("light." + group.first, "RGB"));
+        const size_t albedo = out.addChannel("albedo", "RGB");
+        const size_t normal = out.addChannel("normal", "XYZ");
+        const size_t depth = out.addChannel("depth");
+        const size_t materialId = out.addChannel("materialId");
+        const size_t samples = out.addChannel("samples");
+
+        std::unordered_map<const Material*, int> materialIds;
+        for (int j = crop.y0; j < crop.y0 + crop.height; ++j) {
+            std::clog << "\rScanlines remaining: " << (crop.y0 + crop.height - j) << ' ' << std::flush;
+            for (int i = crop.x0; i < crop.x0 + crop.width; ++i) {
+                PathSample sum;
+                sum.albedo = Vector3(0, 0, 0);
+                sum.lightGroups.assign(lightGroups.size(), Vector3(0, 0, 0));
+                Vector3 color(0, 0, 0);
+                const Material* firstMaterial = nullptr;
+                for (int sample = 0; sample < samplePerPixel; ++sample) {
+                    PathSample path;
+                    color += tracePath(getRay(i, j), world, lights, path);
+                    sum.emission += path.emission;
+                    sum.direct += path.direct;
+                    sum.indirect += path.indirect;
+                    sum.background += path.background;
+                    for (size_t k = 0; k < lightGroups.size(); k++)
+                        sum.lightGroups[k] += path.lightGroups[k];
+                    sum.albedo += path.albedo;
+                    sum.normal += path.normal;
+                    sum.depth += path.depth;
+                    if (sample == 0)
+                        firstMaterial = path.material;
+                }
+
+                size_t p = size_t(j - crop.y0) * crop.width + (i - crop.x0);
+                double scale = 1.0 / samplePerPixel;
+                out.set(beauty, p, scale * color);
+                out.set(emission, p, scale * sum.emission);
+                out.set(direct, p, scale * sum.direct);
+                out.set(indirect, p, scale * sum.indirect);
+                out.set(backgroundChannel, p, scale * sum.background);
+                for (size_t k = 0; k < lightGroups.size(); k++)
+                    out.set(groupChannels[k], p, scale * sum.lightGroups[k]);
+                out.set(albedo, p, scale * sum.albedo);
+                out.set(normal, p, sum.normal.lengthSquared() > 0 ? unitVector(sum.normal) : sum.normal);
+                out.set(depth, p, scale * sum.depth);
+                int id = -1;
+                if (firstMaterial) {
+                    auto inserted = materialIds.insert(std::make_pair(firstMaterial, int(materialIds.size())));
+                    id = inserted.first->second;
+                }
+                out.set(materialId, p, id);
+                out.set(samples, p, samplePerPixel);
             }
         }
 
@@ -46,6 +282,7 @@ private:
     Vector3 pixelDeltaU;
     Vector3 pixelDeltaV;
     Vector3 u, v, w;
+    double pixelAngle = 0; // radians across a pixel at the center of the image
 
     void initialize() {
         imgHeight = static_cast<int>(imgWidth / aspectRatio);
@@ -56,6 +293,7 @@ private:
         auto h = tan(theta/2);
         auto viewportHeight = 2 * h * focalLen;
         auto viewportWidth = viewportHeight * (static_cast<double>(imgWidth) / imgHeight);
+        pixelAngle = 2 * h / imgHeight;
 
         w = unitVector(camPos - lookAt);
         u = unitVector(cross(up, w));
@@ -71,23 +309,102 @@ private:
         pixel00Loc = viewportUpperLeft + 0.5 * (pixelDeltaU + pixelDeltaV);
     }
 
-    Vector3 rayColor(const Ray& ray, int depth, const Hittable& world, const Hittable& lights) const {
+    // What one camera sample saw, gathered while its path is traced.
+    struct PathSample {
+        Vector3 emission, direct, indirect, background;
+        std::vector<Vector3> lightGroups;
+        Vector3 albedo = Vector3(1, 1, 1); // first hit; 1 where the ray misses
+        Vector3 normal;                    // first hit; 0 where the ray misses
+        double depth = 0;
+        const Material* material = nullptr;
+    };
+
+    // One camera sample: its color, with NaN paths dropped, and what the path saw in `path`.
+    Vector3 tracePath(const Ray& ray, const Hittable& world, const Hittable& lights, PathSample& path) const {
+        path.lightGroups.assign(lightGroups.size(), Vector3(0, 0, 0));
+        Vector3 c = rayColor(ray, maxDepth, world, lights, &path, Vector3(1, 1, 1));
+        if (c.x() == c.x() && c.y() == c.y() && c.z() == c.z())
+            return c;
+        path.emission = path.direct = path.indirect = path.background = Vector3(0, 0, 0);
+        path.lightGroups.assign(lightGroups.size(), Vector3(0, 0, 0));
+        return Vector3(0, 0, 0);
+    }
+
+    // Adds radiance arriving at the camera through `throughput` to the channels of `path`;
+    // `mat` is the emitter, null for the background.
+    void recordEmission(PathSample* path, int depth, const Material* mat, const Vector3& radiance) const {
+        int scatterings = maxDepth - depth;
+        if (scatterings == 0)
+            path->emission += radiance;
+        else if (scatterings == 1)
+            path->direct += radiance;
+        else
+            path->indirect += radiance;
+
+        if (!mat)
+            path->background += radiance;
+        for (size_t k = 0; k < lightGroups.size(); k++)
+            if (lightGroups[k].second.get() == mat)
+                path->lightGroups[k] += radiance;
+    }
+
+    // Where a ray is relative to the last diffuse bounce of its path; with a caustic photon
+    // map, emission reached by SpecularAfterDiffuse rays is left to the map.
+    enum PathStage { BeforeDiffuse, FromDiffuse, SpecularAfterDiffuse };
+
+    // What a ray carries down its path besides the throughput.
+    struct PathState {
+        PathStage stage;
+        double pdf; // of the diffuse bounce that sent the ray, else 0
+        // Path footprint left before the radiance cache may end the path; infinite until the
+        // first hit.
+        double spread;
+
+        PathState() : stage(BeforeDiffuse), pdf(0), spread(infinity) {}
+    };
+
+    // `path`, when given, also receives what this ray brings to the camera through
+    // `throughput`, the product of the sampling weights along the path so far.
+    Vector3 rayColor(const Ray& ray, int depth, const Hittable& world, const Hittable& lights,
+                     PathSample* path = nullptr, const Vector3& throughput = Vector3(1, 1, 1),
+                     const PathState& state = PathState()) const {
         HitRecord rec;
 
+        if (ambientOcclusion)
+            return aoColor(ray, world);
+
         if (depth <= 0)
             return Vector3(0, 0, 0);
 
         if (!world.hit(ray, Interval(0.001, infinity), rec)) {
-            if (onSkyBackground) {
+            Vector3 missColor;
+            if (environment) {
+                missColor = environment->radiance(ray.direction());
+            } else if (onSkyBackground) {
                 Vector3 rayDir = unitVector(ray.direction());
                 auto a = 0.5 * (rayDir.y() + 1.0);
-                return (1.0 - a) * Vector3(1.0, 1.0, 1.0) + a * Vector3(0.5, 0.7, 1.0);
+                missColor = (1.0 - a) * Vector3(1.0, 1.0, 1.0) + a * Vector3(0.5, 0.7, 1.0);
             } else {
-                return background;
+                missColor = background;
             }
+            if (path)
+                recordEmission(path, depth, nullptr, throughput * missColor);
+            return missColor;
+        }
+        rec.finalize(ray);
+
+        if (path && depth == maxDepth) {
+            path->albedo = rec.mat->albedoAt(rec);
+            path->normal = rec.normal;
+            path->depth = rec.t * ray.direction().length();
+            path->material = rec.mat.get();
         }
 
         Vector3 emissionColor = rec.mat->emitted(ray, rec, rec.u, rec.v, rec.p);
+        if (caustics && state.stage == SpecularAfterDiffuse)
+            emissionColor = Vector3(0, 0, 0);
+        if (path)
+            recordEmission(path, depth, rec.mat.get(), throughput * emissionColor);
 
         ScatterRecord srec;
         bool isScattered = rec.mat->scatter(ray, rec, srec);
@@ -95,26 +412,103 @@ private:
         if (!isScattered)
             return emissionColor;
 
-        if (srec.isSkipPDF)// pure reflect. ex) Metal
-            return srec.attenuation * rayColor(srec.skipPDFRay, depth - 1, world, lights);
+        // Path spread after Mueller et al.: the sum over segments of sqrt(d^2 / (pdf cos)) is
+        // allowed to reach sqrt(spreadThreshold) times the same for the first hit as seen
+        // from a sphere around the camera, d^2 / (4 pi cos).
+        PathState next;
+        next.spread = state.spread;
+        double footprint = 0;
+        if (radianceCache) {
+            double distance = rec.t * ray.direction().length();
+            double cosine = fmax(1e-4, fabs(dot(unitVector(ray.direction()), rec.normal)));
+            if (state.spread == infinity)
+                next.spread = sqrt(spreadThreshold * distance * distance / (4 * pi * cosine));
+            else if (state.pdf > 0)
+                next.spread -= sqrt(distance * distance / (state.pdf * cosine));
+            footprint = (rec.p - camPos).length() * pixelAngle;
+        }
+
+        if (srec.isSkipPDF) { // pure reflect. ex) Metal
+            next.stage = state.stage == BeforeDiffuse ? BeforeDiffuse : SpecularAfterDiffuse;
+            return srec.attenuation * rayColor(srec.skipPDFRay, depth - 1, world, lights,
+                                               path, throughput * srec.attenuation, next);
+        }
+
+        if (radianceCache && !path && next.spread < 0 && randomDouble() >= trainingFraction) {
+            Vector3 cached;
+            if (radianceCache->lookup(rec.p, rec.normal, footprint, cached))
+                return emissionColor + cached;
+        }
 
         auto lightPDF = make_shared<HittablePDF>(lights, rec.p);
-        MixturePDF mixturePDF(lightPDF, srec.pdf);
+        auto mixturePDF = make_shared<MixturePDF>(lightPDF, srec.pdf);
+        shared_ptr<PDF> samplingPDF = mixturePDF;
+
+        PathGuide::Region* region = guide ? guide->region(rec.p) : nullptr;
+        shared_ptr<GuidePDF> guidePDF;
+        if (region && region->trained()) {
+            guidePDF = make_shared<GuidePDF>(region->sampling);
+            samplingPDF = make_shared<MixturePDF>(guidePDF, mixturePDF, region->guideFraction());
+        }
 
-        Ray scatterRay = Ray(rec.p, mixturePDF.generateRandomVector(), ray.time());
-        double PDF = mixturePDF.pdfValue(scatterRay.direction()); // PDF of whatever outgoing direction we randomly generate
+        Ray scatterRay = Ray(rec.p, samplingPDF->generateRandomVector(), ray.time());
+        double PDF = samplingPDF->pdfValue(scatterRay.direction()); // PDF of whatever outgoing direction we randomly generate
         double scatteringPDF = rec.mat->scatteringPDF(ray, rec, scatterRay);
 
-        Vector3 sampleColor = rayColor(scatterRay, depth - 1, world, lights);
+        next.stage = FromDiffuse;
+        next.pdf = PDF;
+        Vector3 sampleColor = rayColor(scatterRay, depth - 1, world, lights,
+                                       path, path ? throughput * srec.attenuation * scatteringPDF / PDF : throughput,
+                                       next);
         Vector3 scatterColor = (srec.attenuation * scatteringPDF * sampleColor) / PDF;
 
+        if (caustics) {
+            // Diffuse reflection of the photons' irradiance, credited to the lights that sent
+            // them. At least two bounces from the light, so indirect.
+            std::vector<Vector3> perLight;
+            Vector3 causticColor = srec.attenuation / pi * caustics->irradiance(rec.p, rec.normal, path ? &perLight : nullptr);
+            for (size_t k = 0; k < perLight.size(); k++)
+                recordEmission(path, depth - 2, caustics->lightMaterials()[k], throughput * srec.attenuation / pi * perLight[k]);
+            scatterColor += causticColor;
+        }
+
+        if (region && guide->learning) {
+            const Vector3& dir = scatterRay.direction();
+            region->record(dir, luminance(sampleColor), PDF, luminance(srec.attenuation * scatteringPDF * sampleColor),
+                           guidePDF ? guidePDF->pdfValue(dir) : 0, mixturePDF->pdfValue(dir), guidePDF != nullptr);
+        }
+        if (radianceCache)
+            radianceCache->record(rec.p, rec.normal, footprint, scatterColor);
+
         return emissionColor + scatterColor;
     }
 
+    Vector3 aoColor(const Ray& ray, const Hittable& world) const {
+        HitRecord rec;
+        if (!world.hit(ray, Interval(rayEpsilon, infinity), rec))
+            return Vector3(1, 1, 1);
+        rec.finalize(ray);
+
+        ONB uvw;
+        uvw.buildFromW(rec.normal);
+        int unoccluded = 0;
+        for (int i = 0; i < aoSamples; i++) {
+            Ray aoRay(rec.p, uvw.local(randomCosineDirection()), ray.time());
+            if (!world.occluded(aoRay, aoDistance))
+                unoccluded++;
+        }
+        double visibility = double(unoccluded) / aoSamples;
+        return Vector3(visibility, visibility, visibility);
+    }
+
     Ray getRay(int i, int j) const {
         auto pixelCenter = pixel00Loc + (i * pixelDeltaU) + (j * pixelDeltaV);
         auto pixelSample = pixelCenter + pixelSampleSquare();
-        return Ray(camPos, pixelSample - camPos);
+        if (shutterClose <= shutterOpen)
+            return Ray(camPos, pixelSample - camPos, shutterOpen);
+
+        auto time = shutterOpen + randomDouble() * (shutterClose - shutterOpen);
+        return Ray(camPos, pixelSample - camPos, time);
     }
 
     Vector3 pixelSampleSquare() const {
@@ -123,3 +517,5 @@ private:
         return (px * pixelDeltaU) + (py * pixelDeltaV);
     }
 };
+
+#endif
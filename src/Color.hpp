@@ -5,6 +5,7 @@
 #include "Interval.hpp"
 
 #include <iostream>
+#include <vector>
 
 
 inline double linear2gamma(double linear) {
@@ -37,4 +38,11 @@ void writeColor(std::ostream &out, Vector3 pixelColor, int samplesPerPixel) {
         << static_cast<int>(256 * intensity.clamp(b)) << '\n';
 }
 
+// Writes a row-major buffer of linear colors as a PPM image.
+inline void writePPM(std::ostream& out, int width, int height, const std::vector<Vector3>& pixels) {
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+    for (const auto& pixel : pixels)
+        writeColor(out, pixel, 1);
+}
+
 #endif
\ No newline at end of file
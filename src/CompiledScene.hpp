@@ -0,0 +1,339 @@
+#ifndef COMPILED_SCENE_H
+#define COMPILED_SCENE_H
+
+#include "Utils.hpp"
+#include "FlatBVH.hpp"
+#include "HittableList.hpp"
+#include "Parallel.hpp"
+#include "ParallelBVHBuilder.hpp"
+#include "Quad.hpp"
+#include "Sphere.hpp"
+
+#include <cstdint>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+// Scene flattened into one array per primitive type. BVH leaves hold (type, index) references
+// in leaf order and the traversal switches on the type, so spheres and quads are intersected
+// without a virtual call and with their data packed next to each other. Anything that is not
+// exactly a Sphere or a Quad (volumes, nested BVHs, ...) stays a generic Hittable. Static
+// Translate/RotateY chains are baked: their quads and spheres are stored in world space.
+class CompiledScene : public Hittable {
+public:
+    enum class PrimitiveType : uint32_t { Sphere, Quad, Generic };
+
+    struct PrimitiveRef {
+        PrimitiveType type;
+        uint32_t index; // into the array of that type
+    };
+
+    struct SphereData {
+        Vector3 center;
+        Vector3 motion; // center at time t is center + t * motion
+        double radius;
+        uint32_t material;
+    };
+
+    struct QuadData {
+        Vector3 Q;
+        Vector3 edgeA, edgeB; // plane coordinates of P are dot(P - Q, edgeA/B)
+        Vector3 normal;
+        double D;
+        uint32_t material;
+    };
+
+    CompiledScene(const HittableList& list, unsigned threads = hardwareThreads()) {
+        Sources sources;
+        for (const auto& object : list.objects)
+            add(object, Placement(), sources);
+
+        std::vector<uint32_t> primIndices;
+        ParallelBVHBuilder(threads).build(sources.boxes, nodes, primIndices);
+
+        // Store every primitive at its leaf slot so leaves address their data directly.
+        refs.reserve(sources.refs.size());
+        for (uint32_t prim : primIndices) {
+            PrimitiveRef ref = sources.refs[prim];
+            switch (ref.type) {
+            case PrimitiveType::Sphere:
+                spheres.push_back(sources.spheres[ref.index]);
+                ref.index = uint32_t(spheres.size() - 1);
+                break;
+            case PrimitiveType::Quad:
+                quads.push_back(sources.quads[ref.index]);
+                ref.index = uint32_t(quads.size() - 1);
+                break;
+            case PrimitiveType::Generic:
+                generics.push_back(sources.generics[ref.index]);
+                ref.index = uint32_t(generics.size() - 1);
+                break;
+            }
+            refs.push_back(ref);
+        }
+
+        bbox = nodes.empty() ? AABB::empty : nodes[0].bounds();
+    }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const override {
+        return traverseFlatBVH(nodes.empty() ? nullptr : nodes.data(), nullptr, r, ray_t,
+                               [&](uint32_t slot, Interval& t) {
+            const PrimitiveRef& ref = refs[slot];
+            switch (ref.type) {
+            case PrimitiveType::Sphere:
+                if (!hitSphere(spheres[ref.index], r, t, outRec))
+                    return false;
+                break;
+            case PrimitiveType::Quad:
+                if (!hitQuad(quads[ref.index], r, t, outRec))
+                    return false;
+                break;
+            case PrimitiveType::Generic:
+                // Generic hits finalize through their own object.
+                if (!generics[ref.index]->hit(r, t, outRec))
+                    return false;
+                t.max = outRec.t;
+                return true;
+            }
+            outRec.object = this;
+            outRec.primIndex = slot;
+            t.max = outRec.t;
+            return true;
+        });
+    }
+
+    bool occluded(const Ray& r, double tMax) const override {
+        return occludedFlatBVH(nodes.empty() ? nullptr : nodes.data(), nullptr, r, tMax, [&](uint32_t slot) {
+            const PrimitiveRef& ref = refs[slot];
+            switch (ref.type) {
+            case PrimitiveType::Sphere: return occludesSphere(spheres[ref.index], r, tMax);
+            case PrimitiveType::Quad: {
+                HitRecord rec;
+                return hitQuad(quads[ref.index], r, Interval(rayEpsilon, tMax), rec);
+            }
+            case PrimitiveType::Generic: return generics[ref.index]->occluded(r, tMax);
+            }
+            return false;
+        });
+    }
+
+    void finalize(const Ray& r, HitRecord& rec) const override {
+        const PrimitiveRef& ref = refs[rec.primIndex];
+        rec.p = r.at(rec.t);
+
+        if (ref.type == PrimitiveType::Sphere) {
+            const SphereData& s = spheres[ref.index];
+            Vector3 outwardNormal = (rec.p - (s.center + r.time() * s.motion)) / s.radius;
+            rec.setFaceNormal(r, outwardNormal);
+            Sphere::getSphereUV(outwardNormal, rec.u, rec.v);
+            rec.mat = materials[s.material];
+        } else {
+            const QuadData& q = quads[ref.index];
+            rec.mat = materials[q.material];
+            rec.setFaceNormal(r, q.normal);
+        }
+    }
+
+    AABB boundingBox() const override { return bbox; }
+
+    size_t sphereCount() const { return spheres.size(); }
+    size_t quadCount() const { return quads.size(); }
+    size_t genericCount() const { return generics.size(); }
+
+    // Same arithmetic as Sphere::hit and Quad::hit.
+    static bool hitSphere(const SphereData& s, const Ray& r, const Interval& ray_t, HitRecord& outRec) {
+        Vector3 oc = r.origin() - (s.center + r.time() * s.motion);
+        auto a = r.direction().lengthSquared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.lengthSquared() - s.radius * s.radius;
+
+        auto discriminant = half_b * half_b - a*c;
+        if (discriminant < 0)
+            return false;
+        auto sqrtd = sqrt(discriminant);
+
+        auto root = (-half_b - sqrtd) / a;
+        if (!ray_t.surrounds(root)) {
+            root = (-half_b + sqrtd) / a;
+            if (!ray_t.surrounds(root))
+                return false;
+        }
+
+        outRec.t = root;
+        return true;
+    }
+
+    static bool occludesSphere(const SphereData& s, const Ray& r, double tMax) {
+        Vector3 oc = r.origin() - (s.center + r.time() * s.motion);
+        auto a = r.direction().lengthSquared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.lengthSquared() - s.radius * s.radius;
+
+        auto discriminant = half_b * half_b - a*c;
+        if (discriminant < 0)
+            return false;
+        auto sqrtd = sqrt(discriminant);
+
+        Interval ray_t(rayEpsilon, tMax);
+        return ray_t.surrounds((-half_b - sqrtd) / a) || ray_t.surrounds((-half_b + sqrtd) / a);
+    }
+
+    static bool hitQuad(const QuadData& q, const Ray& r, const Interval& ray_t, HitRecord& outRec) {
+        auto denom = dot(q.normal, r.direction());
+        if (fabs(denom) < 1e-8)
+            return false;
+
+        auto t = (q.D - dot(q.normal, r.origin())) / denom;
+        if (!ray_t.contains(t))
+            return false;
+
+        Vector3 planar_hitpt_vector = r.at(t) - q.Q;
+        auto alpha = dot(planar_hitpt_vector, q.edgeA);
+        auto beta = dot(planar_hitpt_vector, q.edgeB);
+        if (!ParallelogramShape::isInterior(alpha, beta))
+            return false;
+
+        outRec.t = t;
+        outRec.u = alpha;
+        outRec.v = beta;
+        return true;
+    }
+
+private:
+    // Rigid object-to-world transform of a static Translate/RotateY chain:
+    // world = rotation * p + offset.
+    struct Placement {
+        double m[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+        Vector3 offset;
+        bool rotated = false;
+        bool moved = false;
+
+        Vector3 vector(const Vector3& v) const {
+            return Vector3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                           m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                           m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+        }
+
+        Vector3 point(const Vector3& p) const { return vector(p) + offset; }
+
+        Placement translated(const Vector3& d) const {
+            Placement result = *this;
+            result.offset = point(d);
+            result.moved = true;
+            return result;
+        }
+
+        // Same rotation as RotateY applies to its hit points.
+        Placement rotatedY(double sinTheta, double cosTheta) const {
+            const double r[3][3] = { { cosTheta, 0, sinTheta }, { 0, 1, 0 }, { -sinTheta, 0, cosTheta } };
+            Placement result = *this;
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++)
+                    result.m[i][j] = m[i][0] * r[0][j] + m[i][1] * r[1][j] + m[i][2] * r[2][j];
+            }
+            result.rotated = true;
+            result.moved = true;
+            return result;
+        }
+    };
+
+    struct Sources {
+        std::vector<PrimitiveRef> refs;
+        std::vector<AABB> boxes;
+        std::vector<SphereData> spheres;
+        std::vector<QuadData> quads;
+        std::vector< shared_ptr<Hittable> > generics;
+    };
+
+    // Whether a transform chain can be baked: only lists, transforms, quads and, as long as no
+    // rotation applies (it would turn their texture coordinates), spheres.
+    static bool bakeable(const Hittable& h, bool rotated) {
+        if (typeid(h) == typeid(HittableList)) {
+            for (const auto& child : static_cast<const HittableList&>(h).objects) {
+                if (!bakeable(*child, rotated))
+                    return false;
+            }
+            return true;
+        }
+        if (typeid(h) == typeid(Translate))
+            return bakeable(*static_cast<const Translate&>(h).child(), rotated);
+        if (typeid(h) == typeid(RotateY))
+            return bakeable(*static_cast<const RotateY&>(h).child(), true);
+        return typeid(h) == typeid(Quad) || (typeid(h) == typeid(Sphere) && !rotated);
+    }
+
+    void add(const shared_ptr<Hittable>& object, const Placement& placement, Sources& out) {
+        const Hittable& h = *object;
+
+        // Plain lists carry no transform, so their members join the top level directly.
+        if (typeid(h) == typeid(HittableList)) {
+            for (const auto& child : static_cast<const HittableList&>(h).objects)
+                add(child, placement, out);
+            return;
+        }
+
+        // Static transform chains are baked into world-space primitives. Anything else inside
+        // them keeps the whole chain as one generic object.
+        if ((typeid(h) == typeid(Translate) || typeid(h) == typeid(RotateY)) && bakeable(h, placement.rotated)) {
+            if (typeid(h) == typeid(Translate)) {
+                const Translate& translate = static_cast<const Translate&>(h);
+                add(translate.child(), placement.translated(translate.translation()), out);
+            } else {
+                const RotateY& rotate = static_cast<const RotateY&>(h);
+                add(rotate.child(), placement.rotatedY(rotate.sinAngle(), rotate.cosAngle()), out);
+            }
+            return;
+        }
+
+        if (typeid(h) == typeid(Sphere)) {
+            const Sphere& sphere = static_cast<const Sphere&>(h);
+            out.spheres.push_back(SphereData{ sphere.centerAt(0) + placement.offset, sphere.motion(),
+                                              sphere.sphereRadius(), materialId(sphere.material()) });
+            out.refs.push_back(PrimitiveRef{ PrimitiveType::Sphere, uint32_t(out.spheres.size() - 1) });
+            out.boxes.push_back(placement.moved ? sphere.boundingBox() + placement.offset : sphere.boundingBox());
+        } else if (typeid(h) == typeid(Quad)) {
+            const Quad& quad = static_cast<const Quad&>(h);
+            Vector3 Q = placement.point(quad.corner());
+            Vector3 u = placement.vector(quad.edgeU());
+            Vector3 v = placement.vector(quad.edgeV());
+
+            QuadData data;
+            data.Q = Q;
+            auto n = cross(u, v);
+            auto w = n / dot(n, n);
+            data.edgeA = cross(v, w);
+            data.edgeB = cross(w, u);
+            data.normal = unitVector(n);
+            data.D = dot(data.normal, data.Q);
+            data.material = materialId(quad.material());
+            out.quads.push_back(data);
+            out.refs.push_back(PrimitiveRef{ PrimitiveType::Quad, uint32_t(out.quads.size() - 1) });
+            out.boxes.push_back(placement.moved ? ParallelogramShape::bounds(Q, u, v) : quad.boundingBox());
+        } else {
+            out.generics.push_back(object);
+            out.refs.push_back(PrimitiveRef{ PrimitiveType::Generic, uint32_t(out.generics.size() - 1) });
+            out.boxes.push_back(object->boundingBox());
+        }
+    }
+
+    uint32_t materialId(const shared_ptr<Material>& mat) {
+        auto found = materialIds.find(mat.get());
+        if (found != materialIds.end())
+            return found->second;
+        materials.push_back(mat);
+        uint32_t id = uint32_t(materials.size() - 1);
+        materialIds[mat.get()] = id;
+        return id;
+    }
+
+    std::vector<FlatBVHNode> nodes;
+    std::vector<PrimitiveRef> refs;
+    std::vector<SphereData> spheres;
+    std::vector<QuadData> quads;
+    std::vector< shared_ptr<Hittable> > generics;
+    std::vector< shared_ptr<Material> > materials;
+    std::unordered_map<const Material*, uint32_t> materialIds;
+    AABB bbox;
+};
+
+#endif
@@ -0,0 +1,628 @@
+#ifndef COMPRESSED_BVH_H
+#define COMPRESSED_BVH_H
+
+#include "Utils.hpp"
+#include "FlatBVH.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE4_1__
+#include <immintrin.h>
+#endif
+
+// 16-byte BVH node. Both child boxes are stored as 8-bit offsets inside this node's own box,
+// which the traversal knows from the parent, so only the root box is kept at full precision.
+// Children are stored as adjacent pairs; a leaf child is a node slot that holds its
+// primitive range instead of boxes.
+struct CompressedBVHNode {
+    uint8_t bounds[2][6]; // per child: min x, y, z and max x, y, z, in 1/255ths of this box
+    uint32_t children;    // bits 0-29: index of the left child, bit 30/31: left/right is a leaf
+
+    static const uint32_t indexMask = 0x3fffffffu;
+    static const uint32_t leftLeaf = 1u << 30;
+    static const uint32_t rightLeaf = 1u << 31;
+
+    uint32_t firstChild() const { return children & indexMask; }
+    bool isLeaf(int child) const { return (children & (child == 0 ? leftLeaf : rightLeaf)) != 0; }
+
+    // Leaf slots reuse the node storage for their primitive range.
+    uint32_t leafFirst() const { return leafField(0); }
+    uint32_t leafCount() const { return leafField(4); }
+
+    void setLeaf(uint32_t first, uint32_t count) {
+        memcpy(&bounds[0][0], &first, sizeof(first));
+        memcpy(&bounds[0][4], &count, sizeof(count));
+        children = 0;
+    }
+
+private:
+    uint32_t leafField(int offset) const {
+        uint32_t value;
+        memcpy(&value, &bounds[0][offset], sizeof(value));
+        return value;
+    }
+};
+
+// A BVH in CompressedBVHNodes, 4x smaller than a FlatBVH. Child boxes decode in float, relative
+// to the scene's center, as origin + q * scale, where the traversal carries each node's origin
+// and scale on its stack. Every decoded box is padded by a small fraction of the scene size,
+// and the encoder checks it against the same arithmetic, so boxes stay conservative.
+//
+// The list constructor builds straight into compressed nodes with binned SAH over float
+// primitive bounds, holding about 64 bytes per primitive at its peak. The other constructor
+// compresses an existing FlatBVH. Bounds are clamped to +-maxCoordinate to stay finite in
+// float, so rays can miss primitives that lie entirely beyond it.
+class CompressedBVH : public Hittable {
+public:
+    CompressedBVH(const HittableList& list, unsigned threads = hardwareThreads())
+            : objects(list.objects), threads(threads == 0 ? 1 : threads) {
+        build();
+    }
+
+    CompressedBVH(const std::vector< shared_ptr<Hittable> >& objects, const std::vector<FlatBVHNode>& flat,
+                  std::vector<uint32_t> primIndices)
+            : objects(objects), primIndices(std::move(primIndices)) {
+        compress(flat);
+    }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const override {
+        return traverse(r, ray_t, false, [&](uint32_t prim, Interval& t) {
+            if (!objects[prim]->hit(r, t, outRec))
+                return false;
+            t.max = outRec.t;
+            return true;
+        });
+    }
+
+    bool occluded(const Ray& r, double tMax) const override {
+        return traverse(r, Interval(rayEpsilon, tMax), true, [&](uint32_t prim, Interval&) {
+            return objects[prim]->occluded(r, tMax);
+        });
+    }
+
+    AABB boundingBox() const override { return bbox; }
+
+    size_t size() const { return nodes.size(); }
+    size_t nodeBytes() const { return nodes.size() * sizeof(CompressedBVHNode) + sizeof(Frame); }
+
+private:
+    // A box coordinate q of a child decodes to origin + q * scale on each axis. The fourth
+    // lanes are zero, for the SIMD path.
+    struct Frame {
+        float origin[4];
+        float scale[4];
+    };
+
+    // A ray in the tree's frame. The fourth lane of invDir is NaN, which the SIMD slab test
+    // ignores.
+    struct RayLanes {
+        float origin[4];
+        float invDir[4];
+    };
+
+    // Float primitive bounds, rounded outwards, for the direct build.
+    struct BuildRef {
+        float min[3];
+        float max[3];
+        uint32_t index;
+    };
+
+    struct Bounds {
+        float min[3] = { INFINITY, INFINITY, INFINITY };
+        float max[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+        void grow(const float lo[3], const float hi[3]) {
+            for (int a = 0; a < 3; a++) {
+                min[a] = std::min(min[a], lo[a]);
+                max[a] = std::max(max[a], hi[a]);
+            }
+        }
+
+        double halfArea() const {
+            double dx = double(max[0]) - min[0], dy = double(max[1]) - min[1], dz = double(max[2]) - min[2];
+            if (dx < 0 || dy < 0 || dz < 0)
+                return 0;
+            return dx * dy + dy * dz + dz * dx;
+        }
+    };
+
+    static const int binCount = 16;
+    static const uint32_t maxLeafSize = 4;
+    static const size_t parallelSubtreeSize = 4096;
+    static const int medianSplitDepth = maxFlatBVHDepth - 32;
+    static constexpr double maxCoordinate = 1e30;
+
+    std::vector< shared_ptr<Hittable> > objects;
+    std::vector<uint32_t> primIndices;
+    std::vector<CompressedBVHNode> nodes;
+    double center[3] = { 0, 0, 0 };
+    float slack = 0;  // added to every decoded box extent
+    float margin = 0; // every decoded box overlaps what it holds by at least this much
+    Frame root;
+    bool rootIsLeaf = false;
+    AABB bbox;
+
+    // Direct build state.
+    unsigned threads = 1;
+    std::vector<BuildRef> refs;
+    std::atomic<uint32_t> nextSlot{ 0 };
+    std::atomic<unsigned> activeThreads{ 0 };
+
+    static double clampCoordinate(double value) {
+        const double limit = maxCoordinate;
+        return std::max(-limit, std::min(limit, value));
+    }
+
+    static float decode(uint8_t q, const Frame& frame, int axis) {
+        return frame.origin[axis] + float(q) * frame.scale[axis];
+    }
+
+    Frame childFrame(const float lo[3], const float hi[3]) const {
+        Frame frame;
+        for (int a = 0; a < 3; a++) {
+            frame.origin[a] = lo[a];
+            frame.scale[a] = (hi[a] - lo[a] + slack) * (1.0f / 255);
+        }
+        frame.origin[3] = frame.scale[3] = 0;
+        return frame;
+    }
+
+    Frame childFrame(const CompressedBVHNode& node, int child, const Frame& frame) const {
+        float lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = decode(node.bounds[child][a], frame, a);
+            hi[a] = decode(node.bounds[child][3 + a], frame, a);
+        }
+        return childFrame(lo, hi);
+    }
+
+    // Sets the center, the padding and the root frame for a tree over [lo, hi].
+    void setRoot(const double bboxLo[3], const double bboxHi[3]) {
+        bbox = AABB(Interval(bboxLo[0], bboxHi[0]), Interval(bboxLo[1], bboxHi[1]), Interval(bboxLo[2], bboxHi[2]));
+        double lo[3], hi[3], extent = 0;
+        for (int a = 0; a < 3; a++) {
+            lo[a] = clampCoordinate(bboxLo[a]);
+            hi[a] = clampCoordinate(bboxHi[a]);
+            center[a] = 0.5 * (lo[a] + hi[a]);
+            extent = std::max(extent, hi[a] - lo[a]);
+        }
+        // 64 float ulps of the largest coordinate, which covers the rounding of every decode.
+        slack = std::max(float(ldexp(0.5 * extent, -18)), 1e-30f);
+        margin = slack / 4;
+        root.origin[3] = root.scale[3] = 0;
+        for (int a = 0; a < 3; a++) {
+            root.origin[a] = float(lo[a] - center[a]) - slack;
+            root.scale[a] = (float(hi[a] - lo[a]) + 2 * slack) * (1.0f / 255);
+            while (decode(255, root, a) < hi[a] - center[a] + slack)
+                root.scale[a] = nextafterf(root.scale[a], INFINITY);
+        }
+    }
+
+    // Conservative 8-bit bounds of [lo, hi] (relative to the center) inside `frame`.
+    void encodeChild(const double lo[3], const double hi[3], const Frame& frame, uint8_t out[6]) const {
+        for (int a = 0; a < 3; a++) {
+            double s = frame.scale[a];
+            int qLo = 0, qHi = 255;
+            if (s > 0) {
+                qLo = int(std::max(0.0, std::min(255.0, floor((lo[a] - frame.origin[a]) / s))));
+                qHi = int(std::max(0.0, std::min(255.0, ceil((hi[a] - frame.origin[a]) / s))));
+            }
+            while (qLo > 0 && decode(uint8_t(qLo), frame, a) > lo[a] - margin)
+                qLo--;
+            while (qHi < 255 && decode(uint8_t(qHi), frame, a) < hi[a] + margin)
+                qHi++;
+            out[a] = uint8_t(qLo);
+            out[3 + a] = uint8_t(std::max(qLo, qHi));
+        }
+    }
+
+    void compress(const std::vector<FlatBVHNode>& flat) {
+        nodes.clear();
+        if (flat.empty()) {
+            bbox = AABB::empty;
+            return;
+        }
+        setRoot(flat[0].min, flat[0].max);
+
+        // Slot 0 is the root, or a leaf slot if the whole tree is one leaf.
+        nodes.resize(1);
+        rootIsLeaf = flat[0].isLeaf();
+        if (rootIsLeaf)
+            nodes[0].setLeaf(flat[0].left, flat[0].count);
+        else
+            compressNode(flat, 0, 0, root);
+    }
+
+    // Fills compressed slot `slot` from flat interior node `index`, whose frame is `frame`.
+    void compressNode(const std::vector<FlatBVHNode>& flat, uint32_t index, uint32_t slot, const Frame& frame) {
+        const FlatBVHNode& node = flat[index];
+        uint32_t firstChild = uint32_t(nodes.size());
+        nodes.resize(nodes.size() + 2);
+
+        CompressedBVHNode packed;
+        packed.children = firstChild;
+        const uint32_t childIndex[2] = { node.left, node.right };
+        for (int c = 0; c < 2; c++) {
+            const FlatBVHNode& child = flat[childIndex[c]];
+            double lo[3], hi[3];
+            for (int a = 0; a < 3; a++) {
+                lo[a] = clampCoordinate(child.min[a]) - center[a];
+                hi[a] = clampCoordinate(child.max[a]) - center[a];
+            }
+            encodeChild(lo, hi, frame, packed.bounds[c]);
+            if (child.isLeaf())
+                packed.children |= c == 0 ? CompressedBVHNode::leftLeaf : CompressedBVHNode::rightLeaf;
+        }
+        nodes[slot] = packed;
+
+        for (int c = 0; c < 2; c++) {
+            const FlatBVHNode& child = flat[childIndex[c]];
+            if (child.isLeaf())
+                nodes[firstChild + c].setLeaf(child.left, child.count);
+            else
+                compressNode(flat, childIndex[c], firstChild + c, childFrame(packed, c, frame));
+        }
+    }
+
+    void build() {
+        size_t n = objects.size();
+        nodes.clear();
+        primIndices.clear();
+        if (n == 0) {
+            bbox = AABB::empty;
+            return;
+        }
+
+        refs.resize(n);
+        parallelFor(0, n, threads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++) {
+                AABB box = objects[i]->boundingBox();
+                for (int a = 0; a < 3; a++) {
+                    const Interval& extent = box.axisInterval(a);
+                    refs[i].min[a] = roundDown(clampCoordinate(extent.min));
+                    refs[i].max[a] = roundUp(clampCoordinate(extent.max));
+                }
+                refs[i].index = uint32_t(i);
+            }
+        });
+
+        Bounds bounds, centroids;
+        rangeBounds(0, n, bounds, centroids);
+        double lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = bounds.min[a];
+            hi[a] = bounds.max[a];
+        }
+        setRoot(lo, hi);
+
+        nodes.resize(2 * n - 1);
+        nextSlot = 1;
+        activeThreads = 1;
+        size_t mid = chooseSplit(0, n, bounds, centroids, 0);
+        rootIsLeaf = mid == n;
+        if (rootIsLeaf) {
+            nodes[0].setLeaf(0, uint32_t(n));
+            nodes.resize(1);
+        } else {
+            buildNode(0, root, 0, mid, n, 0);
+            nodes.resize(nextSlot.load());
+            nodes.shrink_to_fit();
+        }
+
+        primIndices.resize(n);
+        for (size_t i = 0; i < n; i++)
+            primIndices[i] = refs[i].index;
+        std::vector<BuildRef>().swap(refs);
+    }
+
+    static float roundDown(double value) {
+        float f = float(value);
+        return double(f) > value ? nextafterf(f, -INFINITY) : f;
+    }
+
+    static float roundUp(double value) {
+        float f = float(value);
+        return double(f) < value ? nextafterf(f, INFINITY) : f;
+    }
+
+    void rangeBounds(size_t start, size_t end, Bounds& bounds, Bounds& centroids) const {
+        for (size_t i = start; i < end; i++) {
+            const BuildRef& ref = refs[i];
+            float c[3];
+            for (int a = 0; a < 3; a++)
+                c[a] = ref.min[a] + ref.max[a];
+            bounds.grow(ref.min, ref.max);
+            centroids.grow(c, c);
+        }
+    }
+
+    static float centroid(const BuildRef& ref, int axis) { return ref.min[axis] + ref.max[axis]; }
+
+    // Partitions [start, end) for a split and returns its position, or `end` for a leaf.
+    size_t chooseSplit(size_t start, size_t end, const Bounds& bounds, const Bounds& centroids, int depth) {
+        size_t count = end - start;
+        if (count <= 1 || depth >= maxFlatBVHDepth)
+            return end;
+
+        int widest = 0;
+        for (int a = 1; a < 3; a++)
+            if (centroids.max[a] - centroids.min[a] > centroids.max[widest] - centroids.min[widest])
+                widest = a;
+        size_t median = start + count / 2;
+        auto byCentroid = [widest](const BuildRef& p, const BuildRef& q) {
+            return centroid(p, widest) < centroid(q, widest);
+        };
+        // SAH splits can peel off one primitive per level; past this depth ranges are halved.
+        if (depth >= medianSplitDepth) {
+            std::nth_element(refs.begin() + start, refs.begin() + median, refs.begin() + end, byCentroid);
+            return median;
+        }
+
+        Bin bins[3][binCount];
+        double scale[3];
+        for (int a = 0; a < 3; a++) {
+            double extent = double(centroids.max[a]) - centroids.min[a];
+            scale[a] = extent > 0 ? binCount / extent : 0;
+        }
+        for (size_t i = start; i < end; i++) {
+            const BuildRef& ref = refs[i];
+            for (int a = 0; a < 3; a++) {
+                Bin& bin = bins[a][binOf(ref, a, centroids, scale[a])];
+                bin.bounds.grow(ref.min, ref.max);
+                bin.count++;
+            }
+        }
+
+        double bestCost = infinity;
+        int bestAxis = -1, bestSplit = 0;
+        for (int a = 0; a < 3; a++) {
+            if (scale[a] == 0)
+                continue;
+            double rightArea[binCount];
+            uint32_t rightCount[binCount];
+            Bounds acc;
+            uint32_t accCount = 0;
+            for (int b = binCount - 1; b > 0; b--) {
+                acc.grow(bins[a][b].bounds.min, bins[a][b].bounds.max);
+                accCount += bins[a][b].count;
+                rightArea[b] = acc.halfArea();
+                rightCount[b] = accCount;
+            }
+            Bounds left;
+            uint32_t leftCount = 0;
+            for (int b = 1; b < binCount; b++) {
+                left.grow(bins[a][b - 1].bounds.min, bins[a][b - 1].bounds.max);
+                leftCount += bins[a][b - 1].count;
+                if (leftCount == 0 || rightCount[b] == 0)
+                    continue;
+                double cost = leftCount * left.halfArea() + rightCount[b] * rightArea[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = a;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        double parentArea = bounds.halfArea();
+        bool splitPays = bestAxis >= 0 && parentArea > 0 && 1.0 + bestCost / parentArea < double(count);
+        if (count <= maxLeafSize && !splitPays)
+            return end;
+        if (bestAxis < 0) {
+            // All centroids coincide: any split is as good as another.
+            std::nth_element(refs.begin() + start, refs.begin() + median, refs.begin() + end, byCentroid);
+            return median;
+        }
+        auto split = std::partition(refs.begin() + start, refs.begin() + end, [&](const BuildRef& ref) {
+            return binOf(ref, bestAxis, centroids, scale[bestAxis]) < bestSplit;
+        });
+        return size_t(split - refs.begin());
+    }
+
+    struct Bin {
+        Bounds bounds;
+        uint32_t count = 0;
+    };
+
+    static int binOf(const BuildRef& ref, int axis, const Bounds& centroids, double scale) {
+        return std::min(binCount - 1, int((double(centroid(ref, axis)) - centroids.min[axis]) * scale));
+    }
+
+    // Fills interior slot `slot`, whose frame is `frame`, over children [start, mid) and [mid, end).
+    void buildNode(uint32_t slot, const Frame& frame, size_t start, size_t mid, size_t end, int depth) {
+        const size_t range[3] = { start, mid, end };
+        size_t childMid[2];
+        Bounds childBounds[2];
+        for (int c = 0; c < 2; c++) {
+            Bounds centroids;
+            rangeBounds(range[c], range[c + 1], childBounds[c], centroids);
+            childMid[c] = chooseSplit(range[c], range[c + 1], childBounds[c], centroids, depth + 1);
+        }
+
+        uint32_t firstChild = nextSlot.fetch_add(2);
+        CompressedBVHNode packed;
+        packed.children = firstChild;
+        for (int c = 0; c < 2; c++) {
+            double lo[3], hi[3];
+            for (int a = 0; a < 3; a++) {
+                lo[a] = childBounds[c].min[a] - center[a];
+                hi[a] = childBounds[c].max[a] - center[a];
+            }
+            encodeChild(lo, hi, frame, packed.bounds[c]);
+            if (childMid[c] == range[c + 1]) {
+                packed.children |= c == 0 ? CompressedBVHNode::leftLeaf : CompressedBVHNode::rightLeaf;
+                nodes[firstChild + c].setLeaf(uint32_t(range[c]), uint32_t(range[c + 1] - range[c]));
+            }
+        }
+        nodes[slot] = packed;
+
+        Frame frames[2] = { childFrame(packed, 0, frame), childFrame(packed, 1, frame) };
+        bool interior[2] = { !packed.isLeaf(0), !packed.isLeaf(1) };
+        if (interior[0] && interior[1] && end - start >= parallelSubtreeSize && tryAcquireThread()) {
+            std::thread worker([&]() {
+                buildNode(firstChild, frames[0], range[0], childMid[0], range[1], depth + 1);
+            });
+            buildNode(firstChild + 1, frames[1], range[1], childMid[1], range[2], depth + 1);
+            worker.join();
+            activeThreads--;
+            return;
+        }
+        for (int c = 0; c < 2; c++)
+            if (interior[c])
+                buildNode(firstChild + c, frames[c], range[c], childMid[c], range[c + 1], depth + 1);
+    }
+
+    bool tryAcquireThread() {
+        unsigned current = activeThreads.load();
+        while (current < threads) {
+            if (activeThreads.compare_exchange_weak(current, current + 1))
+                return true;
+        }
+        return false;
+    }
+
+    static constexpr float widen = 1 + 1.0f / (1 << 20);
+
+    // Entry distance of the ray into [lo, hi], or infinity on a miss.
+    static float entry(const RayLanes& ray, const float lo[3], const float hi[3], float tMin, float tMax) {
+        for (int a = 0; a < 3; a++) {
+            float t0 = (lo[a] - ray.origin[a]) * ray.invDir[a];
+            float t1 = (hi[a] - ray.origin[a]) * ray.invDir[a];
+            if (t0 > t1) std::swap(t0, t1);
+            t1 *= widen;
+            if (t0 > tMin) tMin = t0;
+            if (t1 < tMax) tMax = t1;
+        }
+        return tMax < tMin ? INFINITY : tMin;
+    }
+
+    // Decodes both children of `node`, sets their entry distances (infinity on a miss) and
+    // frames.
+    void intersectChildren(const CompressedBVHNode& node, const Frame& frame, const RayLanes& ray, float tMin,
+                           float tMax, float tChild[2], Frame children[2]) const {
+#ifdef __SSE4_1__
+        const __m128 origin = _mm_loadu_ps(frame.origin), scale = _mm_loadu_ps(frame.scale);
+        const __m128 rayOrigin = _mm_loadu_ps(ray.origin), rayInvDir = _mm_loadu_ps(ray.invDir);
+        const __m128 tMinLanes = _mm_set1_ps(tMin), tMaxLanes = _mm_set1_ps(tMax);
+        for (int c = 0; c < 2; c++) {
+            int32_t qLo, qHi;
+            memcpy(&qLo, &node.bounds[c][0], sizeof(qLo));
+            memcpy(&qHi, &node.bounds[c][3], sizeof(qHi));
+            __m128 lo = _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(qLo))), scale));
+            __m128 hi = _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(qHi))), scale));
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, rayOrigin), rayInvDir);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, rayOrigin), rayInvDir);
+            // min and max return their second operand on NaN, so NaN lanes drop out here.
+            __m128 tNear = _mm_max_ps(_mm_min_ps(t0, t1), tMinLanes);
+            __m128 tFar = _mm_min_ps(_mm_mul_ps(_mm_max_ps(t0, t1), _mm_set1_ps(widen)), tMaxLanes);
+            tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 3, 0, 1)));
+            tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 0, 3, 2)));
+            tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 3, 0, 1)));
+            tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 0, 3, 2)));
+            float n = _mm_cvtss_f32(tNear), f = _mm_cvtss_f32(tFar);
+            tChild[c] = f < n ? INFINITY : n;
+
+            __m128 childScale = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(hi, lo), _mm_set1_ps(slack)), _mm_set1_ps(1.0f / 255));
+            _mm_storeu_ps(children[c].origin, lo);
+            _mm_storeu_ps(children[c].scale, _mm_blend_ps(childScale, _mm_setzero_ps(), 8));
+        }
+#else
+        for (int c = 0; c < 2; c++) {
+            float lo[3], hi[3];
+            for (int a = 0; a < 3; a++) {
+                lo[a] = frame.origin[a] + float(node.bounds[c][a]) * frame.scale[a];
+                hi[a] = frame.origin[a] + float(node.bounds[c][3 + a]) * frame.scale[a];
+            }
+            tChild[c] = entry(ray, lo, hi, tMin, tMax);
+            children[c] = childFrame(lo, hi);
+        }
+#endif
+    }
+
+    // Closest-hit traversal, or any-hit when `anyHit` is set. The slab test runs in float on
+    // the decoded boxes; exit distances are widened by a few ulps to make up for its rounding.
+    template <typename LeafTest>
+    bool traverse(const Ray& r, Interval ray_t, bool anyHit, LeafTest&& leafTest) const {
+        if (nodes.empty())
+            return false;
+
+        const Vector3 orig = r.origin();
+        const Vector3 dir = r.direction();
+        RayLanes ray;
+        for (int a = 0; a < 3; a++) {
+            ray.origin[a] = float(orig[a] - center[a]);
+            ray.invDir[a] = float(1.0 / dir[a]);
+        }
+        ray.origin[3] = 0;
+        ray.invDir[3] = NAN;
+
+        auto testLeaf = [&](const CompressedBVHNode& leaf) {
+            bool hitAnything = false;
+            for (uint32_t i = 0; i < leaf.leafCount(); i++) {
+                if (leafTest(primIndices[leaf.leafFirst() + i], ray_t)) {
+                    hitAnything = true;
+                    if (anyHit)
+                        break;
+                }
+            }
+            return hitAnything;
+        };
+
+        float rootLo[3], rootHi[3];
+        for (int a = 0; a < 3; a++) {
+            rootLo[a] = decode(0, root, a);
+            rootHi[a] = decode(255, root, a);
+        }
+        if (entry(ray, rootLo, rootHi, float(ray_t.min), float(ray_t.max) * widen) == INFINITY)
+            return false;
+        if (rootIsLeaf)
+            return testLeaf(nodes[0]);
+
+        struct Entry {
+            uint32_t slot;
+            float tEntry;
+            Frame frame;
+        };
+        TraversalStack<Entry> stack;
+        stack.push(Entry{ 0, float(ray_t.min), root });
+        bool hitAnything = false;
+
+        while (!stack.empty()) {
+            Entry current = stack.pop();
+            if (current.tEntry > ray_t.max)
+                continue;
+
+            const CompressedBVHNode& node = nodes[current.slot];
+            float tChild[2];
+            Frame frames[2];
+            intersectChildren(node, current.frame, ray, float(ray_t.min), float(ray_t.max) * widen, tChild, frames);
+
+            // Leaves are tested right away, nearest first; interior children are pushed far first.
+            int first = tChild[0] <= tChild[1] ? 0 : 1;
+            for (int k = 0; k < 2; k++) {
+                int c = k == 0 ? first : 1 - first;
+                if (tChild[c] == INFINITY || !node.isLeaf(c) || tChild[c] > ray_t.max)
+                    continue;
+                if (testLeaf(nodes[node.firstChild() + c])) {
+                    hitAnything = true;
+                    if (anyHit)
+                        return true;
+                }
+            }
+            for (int k = 0; k < 2; k++) {
+                int c = k == 0 ? 1 - first : first;
+                if (tChild[c] != INFINITY && !node.isLeaf(c))
+                    stack.push(Entry{ node.firstChild() + c, tChild[c], frames[c] });
+            }
+        }
+        return hitAnything;
+    }
+};
+
+#endif
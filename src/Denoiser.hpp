@@ -0,0 +1,164 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "Utils.hpp"
+#include "Parallel.hpp"
+
+#include <cmath>
+#include <vector>
+
+// Beauty pass and first-hit features of one render, row-major with the top row first.
+struct FeatureBuffers {
+    int width = 0;
+    int height = 0;
+    std::vector<Vector3> color;    // mean radiance per pixel, linear
+    std::vector<double> variance;  // variance of the mean luminance
+    std::vector<double> irradianceVariance; // the same for color / albedo, demodulated per sample
+    std::vector<Vector3> albedo;   // first-hit Material::albedoAt, 1 where rays miss
+    std::vector<Vector3> normal;   // first-hit shading normal, 0 where rays miss
+    std::vector<double> depth;     // first-hit distance, 0 where rays miss
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        size_t n = size_t(w) * h;
+        color.assign(n, Vector3(0, 0, 0));
+        variance.assign(n, 0);
+        irradianceVariance.assign(n, 0);
+        albedo.assign(n, Vector3(1, 1, 1));
+        normal.assign(n, Vector3(0, 0, 0));
+        depth.assign(n, 0);
+    }
+};
+
+inline double luminance(const Vector3& c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// The albedo the denoiser divides color by, kept away from zero.
+inline Vector3 demodulationAlbedo(const Vector3& a) {
+    return Vector3(std::max(a.x(), 0.01), std::max(a.y(), 0.01), std::max(a.z(), 0.01));
+}
+
+inline Vector3 demodulate(const Vector3& c, const Vector3& albedo) {
+    Vector3 a = demodulationAlbedo(albedo);
+    return Vector3(c.x() / a.x(), c.y() / a.y(), c.z() / a.z());
+}
+
+// Edge-avoiding a-trous wavelet filter in the style of SVGF: the color is divided by the
+// albedo so texture detail survives, then filtered with a 5x5 B3-spline kernel whose taps
+// spread by 1, 2, 4, ... pixels per iteration. Taps are weighted down across normal and depth
+// discontinuities and by luminance differences relative to the local noise level, which is
+// tracked by filtering the demodulated variance alongside the color.
+class Denoiser {
+public:
+    int iterations = 3;
+    double sigmaLuminance = 4;
+    double sigmaNormal = 128;
+    double sigmaDepth = 1;
+    unsigned threads = hardwareThreads();
+
+    std::vector<Vector3> denoise(const FeatureBuffers& in) const {
+        const int width = in.width, height = in.height;
+        const size_t n = size_t(width) * height;
+
+        std::vector<Vector3> irradiance(n);
+        std::vector<double> variance(n);
+        for (size_t p = 0; p < n; p++) {
+            irradiance[p] = demodulate(in.color[p], in.albedo[p]);
+            variance[p] = in.irradianceVariance[p];
+        }
+
+        // Screen-space depth slope, for a depth tolerance that grows with the tap distance.
+        std::vector<double> slope(n);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                size_t p = size_t(y) * width + x;
+                double dx = fabs(in.depth[y * width + std::min(x + 1, width - 1)] - in.depth[y * width + std::max(x - 1, 0)]);
+                double dy = fabs(in.depth[std::min(y + 1, height - 1) * width + x] - in.depth[std::max(y - 1, 0) * width + x]);
+                slope[p] = 0.5 * std::max(dx, dy);
+            }
+        }
+
+        std::vector<Vector3> nextIrradiance(n);
+        std::vector<double> nextVariance(n);
+        for (int i = 0; i < iterations; i++) {
+            int step = 1 << i;
+            parallelFor(0, size_t(height), threads, [&](size_t begin, size_t end, unsigned) {
+                for (int y = int(begin); y < int(end); y++)
+                    for (int x = 0; x < width; x++)
+                        filterPixel(in, irradiance, variance, slope, x, y, step, nextIrradiance, nextVariance);
+            });
+            irradiance.swap(nextIrradiance);
+            variance.swap(nextVariance);
+        }
+
+        std::vector<Vector3> out(n);
+        for (size_t p = 0; p < n; p++)
+            out[p] = irradiance[p] * demodulationAlbedo(in.albedo[p]);
+        return out;
+    }
+
+private:
+    // 3x3 Gaussian of the variance around (x, y), which steadies the luminance weights.
+    static double blurredVariance(const std::vector<double>& variance, int width, int height, int x, int y) {
+        static const double kernel[2] = { 0.25, 0.125 };
+        double sum = 0, weights = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                int qx = x + dx, qy = y + dy;
+                if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+                    continue;
+                double w = kernel[abs(dx)] * kernel[abs(dy)];
+                sum += w * variance[size_t(qy) * width + qx];
+                weights += w;
+            }
+        }
+        return sum / weights;
+    }
+
+    void filterPixel(const FeatureBuffers& in, const std::vector<Vector3>& irradiance,
+                     const std::vector<double>& variance, const std::vector<double>& slope,
+                     int x, int y, int step, std::vector<Vector3>& outIrradiance,
+                     std::vector<double>& outVariance) const {
+        static const double kernel[3] = { 3.0 / 8, 1.0 / 4, 1.0 / 16 };
+        const int width = in.width, height = in.height;
+        const size_t p = size_t(y) * width + x;
+
+        const Vector3 np = in.normal[p];
+        const double zp = in.depth[p];
+        const double lp = luminance(irradiance[p]);
+        const double luminanceScale = sigmaLuminance * sqrt(blurredVariance(variance, width, height, x, y)) + 1e-10;
+
+        Vector3 sum(0, 0, 0);
+        double sumVariance = 0, weights = 0;
+        for (int dy = -2; dy <= 2; dy++) {
+            for (int dx = -2; dx <= 2; dx++) {
+                int qx = x + dx * step, qy = y + dy * step;
+                if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+                    continue;
+                size_t q = size_t(qy) * width + qx;
+
+                double w = kernel[abs(dx)] * kernel[abs(dy)];
+                if (q != p) {
+                    const Vector3 nq = in.normal[q];
+                    // Misses have a zero normal and only blend with other misses.
+                    if (np.lengthSquared() > 0 || nq.lengthSquared() > 0)
+                        w *= pow(std::max(0.0, dot(np, nq)), sigmaNormal);
+                    double distance = step * sqrt(double(dx * dx + dy * dy));
+                    w *= exp(-fabs(zp - in.depth[q]) / (sigmaDepth * slope[p] * distance + 1e-10));
+                    w *= exp(-fabs(lp - luminance(irradiance[q])) / luminanceScale);
+                }
+
+                sum += w * irradiance[q];
+                sumVariance += w * w * variance[q];
+                weights += w;
+            }
+        }
+
+        outIrradiance[p] = sum / weights;
+        outVariance[p] = sumVariance / (weights * weights);
+    }
+};
+
+#endif
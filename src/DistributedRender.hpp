@@ -0,0 +1,443 @@
+#ifndef DISTRIBUTED_RENDER_H
+#define DISTRIBUTED_RENDER_H
+
+#include "Accumulation.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Tile rendering spread over worker processes. A RenderCoordinator listens on a TCP port and
+// hands RenderJobs to whichever workers connect; each RenderWorker renders them with its own
+// copy of the scene and sends back the AccumulationBuffer. Messages are a type and a payload
+// size followed by the payload, in the byte order of the peers.
+namespace Distributed {
+
+enum MessageType : uint32_t {
+    HelloMessage = 1,    // worker -> coordinator, empty
+    JobMessage = 2,      // coordinator -> worker, a RenderJob
+    ResultMessage = 3,   // worker -> coordinator, job id and AccumulationBuffer
+    ShutdownMessage = 4, // coordinator -> worker, empty
+};
+
+const uint32_t maxPayload = 1u << 28;
+
+inline bool sendAll(int fd, const void* data, size_t size) {
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::send(fd, p, size, flags);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+inline bool receiveAll(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = ::recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+inline bool sendMessage(int fd, uint32_t type, const std::string& payload) {
+    uint32_t header[2] = { type, uint32_t(payload.size()) };
+    return sendAll(fd, header, sizeof(header)) && sendAll(fd, payload.data(), payload.size());
+}
+
+inline bool receiveMessage(int fd, uint32_t& type, std::string& payload) {
+    uint32_t header[2];
+    if (!receiveAll(fd, header, sizeof(header)) || header[1] > maxPayload)
+        return false;
+    type = header[0];
+    payload.resize(header[1]);
+    return header[1] == 0 || receiveAll(fd, &payload[0], header[1]);
+}
+
+template <typename T>
+void put(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool get(const std::string& in, size_t& offset, T& value) {
+    if (offset + sizeof(T) > in.size())
+        return false;
+    std::memcpy(&value, in.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+}
+
+inline std::string encodeJob(const RenderJob& job) {
+    std::string out;
+    put(out, job.id);
+    put(out, int32_t(job.imageWidth));
+    put(out, int32_t(job.x0));
+    put(out, int32_t(job.y0));
+    put(out, int32_t(job.width));
+    put(out, int32_t(job.height));
+    put(out, int32_t(job.firstSample));
+    put(out, int32_t(job.sampleCount));
+    put(out, job.seed);
+    return out;
+}
+
+inline bool decodeJob(const std::string& in, RenderJob& job) {
+    size_t offset = 0;
+    int32_t fields[7];
+    if (!get(in, offset, job.id))
+        return false;
+    for (int i = 0; i < 7; i++)
+        if (!get(in, offset, fields[i]))
+            return false;
+    job.imageWidth = fields[0];
+    job.x0 = fields[1];
+    job.y0 = fields[2];
+    job.width = fields[3];
+    job.height = fields[4];
+    job.firstSample = fields[5];
+    job.sampleCount = fields[6];
+    return get(in, offset, job.seed) && job.width >= 0 && job.height >= 0
+        && int64_t(job.width) * job.height <= 1 << 24;
+}
+
+inline std::string encodeResult(uint32_t jobId, const AccumulationBuffer& buffer) {
+    std::string out;
+    out.reserve(20 + buffer.sum.size() * (3 * sizeof(double) + sizeof(uint32_t)));
+    put(out, jobId);
+    put(out, int32_t(buffer.x0));
+    put(out, int32_t(buffer.y0));
+    put(out, int32_t(buffer.width));
+    put(out, int32_t(buffer.height));
+    for (size_t p = 0; p < buffer.sum.size(); p++) {
+        for (int k = 0; k < 3; k++)
+            put(out, buffer.sum[p][k]);
+        put(out, buffer.samples[p]);
+    }
+    return out;
+}
+
+inline bool decodeResult(const std::string& in, uint32_t& jobId, AccumulationBuffer& buffer) {
+    size_t offset = 0;
+    int32_t x0, y0, width, height;
+    if (!get(in, offset, jobId) || !get(in, offset, x0) || !get(in, offset, y0)
+        || !get(in, offset, width) || !get(in, offset, height) || width < 0 || height < 0)
+        return false;
+    if (in.size() - offset != size_t(width) * height * (3 * sizeof(double) + sizeof(uint32_t)))
+        return false;
+    buffer.reset(x0, y0, width, height);
+    for (size_t p = 0; p < buffer.sum.size(); p++) {
+        double c[3];
+        for (int k = 0; k < 3; k++)
+            get(in, offset, c[k]);
+        buffer.sum[p] = Vector3(c[0], c[1], c[2]);
+        get(in, offset, buffer.samples[p]);
+    }
+    return true;
+}
+
+inline void setReceiveTimeout(int fd, double seconds) {
+    timeval tv;
+    tv.tv_sec = long(seconds);
+    tv.tv_usec = long((seconds - double(tv.tv_sec)) * 1e6);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+} // namespace Distributed
+
+// Hands jobs to connected workers and merges their results. A worker that disconnects, sends
+// garbage or stays silent for jobTimeout seconds is dropped and its job goes back to the
+// front of the queue; a new connection must send its Hello within jobTimeout too. Results are
+// merged in job order whatever order they arrive in, so the image is the same as rendering the
+// jobs one after another in a single process.
+class RenderCoordinator {
+public:
+    struct Stats {
+        size_t workersJoined = 0;
+        size_t workersLost = 0;
+        size_t jobsSent = 0;
+        size_t jobsReassigned = 0;
+    };
+
+    double jobTimeout = 120;
+    // render gives up after this many seconds without a worker.
+    double idleTimeout = 120;
+
+    // Listens on host:port; port 0 picks a free port.
+    explicit RenderCoordinator(int port = 0, const char* host = "127.0.0.1") {
+        listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd < 0)
+            return;
+        int yes = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(uint16_t(port));
+        inet_pton(AF_INET, host, &address.sin_addr);
+        socklen_t length = sizeof(address);
+        if (::bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || ::listen(listenFd, 64) != 0
+            || getsockname(listenFd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+            ::close(listenFd);
+            listenFd = -1;
+            return;
+        }
+        boundPort = ntohs(address.sin_port);
+    }
+
+    ~RenderCoordinator() {
+        for (auto& worker : workers) {
+            Distributed::sendMessage(worker.fd, Distributed::ShutdownMessage, std::string());
+            ::close(worker.fd);
+        }
+        if (listenFd >= 0)
+            ::close(listenFd);
+    }
+
+    RenderCoordinator(const RenderCoordinator&) = delete;
+    RenderCoordinator& operator=(const RenderCoordinator&) = delete;
+
+    bool listening() const { return listenFd >= 0; }
+    int port() const { return boundPort; }
+    size_t workerCount() const {
+        size_t count = 0;
+        for (const auto& worker : workers)
+            count += worker.greeted ? 1 : 0;
+        return count;
+    }
+    const Stats& stats() const { return counters; }
+
+    // Runs every job and merges its result into `image`. Waits for workers to connect while
+    // jobs remain and none are alive. Returns false if the coordinator is not listening or no
+    // worker was connected for idleTimeout seconds; `image` then holds the jobs merged so far.
+    bool render(const std::vector<RenderJob>& jobs, AccumulationBuffer& image) {
+        if (!listening())
+            return false;
+
+        std::deque<size_t> pending;
+        for (size_t i = 0; i < jobs.size(); i++)
+            pending.push_back(i);
+        std::vector<bool> done(jobs.size(), false);
+        std::map<size_t, AccumulationBuffer> arrived;
+        size_t nextMerge = 0;
+        Clock::time_point idleSince = Clock::now();
+
+        while (nextMerge < jobs.size()) {
+            // Hand out work; a worker we cannot write to is gone.
+            for (size_t w = 0; w < workers.size() && !pending.empty();) {
+                if (!workers[w].greeted || workers[w].job != noJob) {
+                    w++;
+                    continue;
+                }
+                size_t index = pending.front();
+                pending.pop_front();
+                if (done[index])
+                    continue;
+                RenderJob job = jobs[index];
+                job.id = uint32_t(index);
+                workers[w].job = index;
+                workers[w].started = Clock::now();
+                counters.jobsSent++;
+                if (Distributed::sendMessage(workers[w].fd, Distributed::JobMessage, Distributed::encodeJob(job)))
+                    w++;
+                else
+                    dropWorker(w, pending);
+            }
+
+            for (size_t w = 0; w < workers.size();) {
+                double elapsed = std::chrono::duration<double>(Clock::now() - workers[w].started).count();
+                if ((!workers[w].greeted || workers[w].job != noJob) && elapsed > jobTimeout)
+                    dropWorker(w, pending);
+                else
+                    w++;
+            }
+            if (workerCount() > 0)
+                idleSince = Clock::now();
+            else if (std::chrono::duration<double>(Clock::now() - idleSince).count() > idleTimeout)
+                return false;
+
+            std::vector<pollfd> fds(1 + workers.size());
+            fds[0].fd = listenFd;
+            fds[0].events = POLLIN;
+            for (size_t w = 0; w < workers.size(); w++) {
+                fds[w + 1].fd = workers[w].fd;
+                fds[w + 1].events = POLLIN;
+            }
+            if (::poll(fds.data(), fds.size(), 100) <= 0)
+                continue;
+
+            // Workers first: indices shift as workers are dropped, so walk backwards.
+            for (size_t w = workers.size(); w-- > 0;) {
+                if (!(fds[w + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+                    continue;
+                uint32_t type, jobId;
+                std::string payload;
+                if (!workers[w].greeted) {
+                    if (!Distributed::receiveMessage(workers[w].fd, type, payload)
+                        || type != Distributed::HelloMessage) {
+                        dropWorker(w, pending);
+                        continue;
+                    }
+                    workers[w].greeted = true;
+                    counters.workersJoined++;
+                    continue;
+                }
+                AccumulationBuffer result;
+                if (!Distributed::receiveMessage(workers[w].fd, type, payload) || type != Distributed::ResultMessage
+                    || !Distributed::decodeResult(payload, jobId, result) || jobId != workers[w].job) {
+                    dropWorker(w, pending);
+                    continue;
+                }
+                workers[w].job = noJob;
+                if (!done[jobId]) {
+                    done[jobId] = true;
+                    arrived[jobId] = std::move(result);
+                }
+            }
+            if (fds[0].revents & POLLIN)
+                acceptWorker();
+
+            while (nextMerge < jobs.size() && arrived.count(nextMerge)) {
+                image.merge(arrived[nextMerge]);
+                arrived.erase(nextMerge);
+                nextMerge++;
+            }
+        }
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    static const size_t noJob = size_t(-1);
+
+    struct Worker {
+        int fd;
+        size_t job;
+        Clock::time_point started; // of the job, or of the connection until its Hello
+        bool greeted;
+    };
+
+    void acceptWorker() {
+        int fd = ::accept(listenFd, nullptr, nullptr);
+        if (fd < 0)
+            return;
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        // Bounds how long a worker that stalls mid-message can hold up the loop.
+        Distributed::setReceiveTimeout(fd, jobTimeout);
+        // Its Hello is read by the poll loop.
+        workers.push_back(Worker{ fd, noJob, Clock::now(), false });
+    }
+
+    void dropWorker(size_t w, std::deque<size_t>& pending) {
+        if (workers[w].job != noJob) {
+            pending.push_front(workers[w].job);
+            counters.jobsReassigned++;
+        }
+        if (workers[w].greeted)
+            counters.workersLost++;
+        ::close(workers[w].fd);
+        workers.erase(workers.begin() + std::ptrdiff_t(w));
+    }
+
+    int listenFd = -1;
+    int boundPort = 0;
+    std::vector<Worker> workers;
+    Stats counters;
+};
+
+// Connects to a coordinator and renders the jobs it sends until it is told to stop or the
+// connection drops.
+class RenderWorker {
+public:
+    typedef std::function<void(const RenderJob&, AccumulationBuffer&)> RenderFunction;
+
+    double connectTimeout = 10;
+    // When >= 0, the worker quits without replying to the job after this many, as a crash would.
+    int maxJobs = -1;
+
+    // Returns the number of jobs rendered.
+    size_t run(const char* host, int port, const RenderFunction& render) const {
+        int fd = connectTo(host, port);
+        if (fd < 0)
+            return 0;
+
+        size_t rendered = 0;
+        uint32_t type;
+        std::string payload;
+        RenderJob job;
+        AccumulationBuffer buffer;
+        while (Distributed::sendMessage(fd, rendered == 0 ? Distributed::HelloMessage : Distributed::ResultMessage,
+                                        rendered == 0 ? std::string() : Distributed::encodeResult(job.id, buffer))
+               && Distributed::receiveMessage(fd, type, payload) && type == Distributed::JobMessage
+               && Distributed::decodeJob(payload, job)) {
+            if (maxJobs >= 0 && rendered >= size_t(maxJobs))
+                break;
+            render(job, buffer);
+            rendered++;
+        }
+        ::close(fd);
+        return rendered;
+    }
+
+private:
+    int connectTo(const char* host, int port) const {
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(uint16_t(port));
+        if (inet_pton(AF_INET, host, &address.sin_addr) != 1)
+            return -1;
+
+        // The coordinator may not be up yet.
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(connectTimeout);
+        for (;;) {
+            int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            if (fd < 0)
+                return -1;
+            if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+                int yes = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                return fd;
+            }
+            ::close(fd);
+            if (std::chrono::steady_clock::now() >= deadline)
+                return -1;
+            usleep(100000);
+        }
+    }
+};
+
+#endif
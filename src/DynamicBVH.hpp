@@ -0,0 +1,78 @@
+#ifndef DYNAMIC_BVH_H
+#define DYNAMIC_BVH_H
+
+#include "Utils.hpp"
+#include "FlatBVH.hpp"
+#include "ParallelBVHBuilder.hpp"
+
+#include <vector>
+
+// BVH for animated scenes. Node bounds cover one shutter interval; update() refits them in
+// place for the next interval and only rebuilds once the refitted tree's SAH cost has grown
+// past rebuildThreshold times the cost right after the last build.
+class DynamicBVH : public Hittable {
+public:
+    double rebuildThreshold = 1.5;
+
+    DynamicBVH(HittableList list, const Interval& time) : objects(list.objects) {
+        rebuild(time);
+    }
+
+    void rebuild(const Interval& time) {
+        ParallelBVHBuilder().build(FlatBVHBuilder::primitiveBounds(objects, time), nodes, primIndices);
+        builtCost = currentCost = sahCost(nodes.data(), nodes.size());
+        bbox = nodes.empty() ? AABB::empty : nodes[0].bounds();
+        rebuilds++;
+    }
+
+    void refit(const Interval& time) {
+        refitFlatBVH(nodes.data(), nodes.size(), primIndices.data(), [&](uint32_t prim) {
+            return objects[prim]->boundingBoxDuring(time);
+        });
+        currentCost = sahCost(nodes.data(), nodes.size());
+        bbox = nodes.empty() ? AABB::empty : nodes[0].bounds();
+        refits++;
+    }
+
+    // Prepares the hierarchy for rays with times inside `time`. Returns true if it rebuilt.
+    bool update(const Interval& time) {
+        refit(time);
+        if (currentCost <= rebuildThreshold * builtCost)
+            return false;
+        rebuild(time);
+        return true;
+    }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const override {
+        return traverseFlatBVH(nodes.data(), primIndices.data(), r, ray_t, [&](uint32_t prim, Interval& t) {
+            if (!objects[prim]->hit(r, t, outRec))
+                return false;
+            t.max = outRec.t;
+            return true;
+        });
+    }
+
+    bool occluded(const Ray& r, double tMax) const override {
+        return occludedFlatBVH(nodes.data(), primIndices.data(), r, tMax, [&](uint32_t prim) {
+            return objects[prim]->occluded(r, tMax);
+        });
+    }
+
+    AABB boundingBox() const override { return bbox; }
+
+    double costRatio() const { return builtCost > 0 ? currentCost / builtCost : 1.0; }
+    int rebuildCount() const { return rebuilds; }
+    int refitCount() const { return refits; }
+
+private:
+    std::vector< shared_ptr<Hittable> > objects;
+    std::vector<FlatBVHNode> nodes;
+    std::vector<uint32_t> primIndices;
+    AABB bbox;
+    double builtCost = 0;
+    double currentCost = 0;
+    int rebuilds = 0;
+    int refits = 0;
+};
+
+#endif
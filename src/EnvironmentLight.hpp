@@ -0,0 +1,173 @@
+#ifndef ENVIRONMENT_LIGHT_H
+#define ENVIRONMENT_LIGHT_H
+
+#include "Utils.hpp"
+#include "Hittable.hpp"
+#include "STBImageLoader.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Piecewise-constant distribution over [0, 1) with one bucket per function value.
+class Distribution1D {
+public:
+    Distribution1D() {}
+
+    explicit Distribution1D(std::vector<double> values) : func(std::move(values)), cdf(func.size() + 1) {
+        size_t n = func.size();
+        cdf[0] = 0;
+        for (size_t i = 0; i < n; i++)
+            cdf[i + 1] = cdf[i] + fabs(func[i]) / n;
+        funcInt = cdf[n];
+
+        // An all-zero function falls back to uniform.
+        for (size_t i = 1; i <= n; i++)
+            cdf[i] = funcInt > 0 ? cdf[i] / funcInt : double(i) / n;
+    }
+
+    size_t count() const { return func.size(); }
+    double integral() const { return funcInt; }
+
+    // Maps u to x in [0, 1) with density pdf(x); `outIndex` is the bucket of x.
+    double sample(double u, double& outPdf, size_t& outIndex) const {
+        size_t i = size_t(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+        outIndex = std::min(func.size() - 1, i == 0 ? 0 : i - 1);
+
+        double width = cdf[outIndex + 1] - cdf[outIndex];
+        double offset = width > 0 ? (u - cdf[outIndex]) / width : 0;
+        outPdf = pdf(outIndex);
+        return std::min((outIndex + offset) / func.size(), 1 - 1e-12);
+    }
+
+    double pdf(size_t index) const {
+        return funcInt > 0 ? fabs(func[index]) / funcInt : 1;
+    }
+
+private:
+    std::vector<double> func;
+    std::vector<double> cdf;
+    double funcInt = 0;
+};
+
+// Piecewise-constant distribution over [0, 1)^2: a marginal over rows and a conditional
+// distribution within each row.
+class Distribution2D {
+public:
+    Distribution2D() {}
+
+    Distribution2D(const std::vector<double>& values, int width, int height) {
+        std::vector<double> rowIntegrals(height);
+        for (int j = 0; j < height; j++) {
+            rows.push_back(Distribution1D(std::vector<double>(values.begin() + size_t(j) * width,
+                                                              values.begin() + size_t(j + 1) * width)));
+            rowIntegrals[j] = rows.back().integral();
+        }
+        marginal = Distribution1D(std::move(rowIntegrals));
+    }
+
+    void sample(double u0, double u1, double& outU, double& outV, double& outPdf) const {
+        double pdfV, pdfU;
+        size_t row, column;
+        outV = marginal.sample(u1, pdfV, row);
+        outU = rows[row].sample(u0, pdfU, column);
+        outPdf = pdfV * pdfU;
+    }
+
+    double pdf(double u, double v) const {
+        size_t row = std::min(rows.size() - 1, size_t(std::max(0.0, v) * rows.size()));
+        size_t column = std::min(rows[row].count() - 1, size_t(std::max(0.0, u) * rows[row].count()));
+        return marginal.pdf(row) * rows[row].pdf(column);
+    }
+
+private:
+    std::vector<Distribution1D> rows;
+    Distribution1D marginal;
+};
+
+// Infinitely distant light from an equirectangular map: u follows the azimuth as in
+// Sphere::getSphereUV and the top row of the image is straight up. Nothing hits it; rays that
+// miss the scene read radiance(), and as a member of the lights list it is importance-sampled
+// by luminance times sin(theta), the Jacobian of the equirectangular mapping.
+class EnvironmentLight : public Hittable {
+public:
+    // Loads a float HDR (or an LDR image, linearized) through rtw_image.
+    EnvironmentLight(const char* filename, double scale = 1) : scale(scale) {
+        rtw_image image(filename);
+        width = std::max(1, image.width());
+        height = std::max(1, image.height());
+        pixels.resize(size_t(width) * height);
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                const float* p = image.float_pixel_data(i, j);
+                pixels[size_t(j) * width + i] = Vector3(p[0], p[1], p[2]);
+            }
+        }
+        buildDistribution();
+    }
+
+    // Row-major linear RGB pixels, top row first.
+    EnvironmentLight(int width, int height, std::vector<Vector3> pixels, double scale = 1)
+            : width(width), height(height), pixels(std::move(pixels)), scale(scale) {
+        buildDistribution();
+    }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const override { return false; }
+
+    AABB boundingBox() const override { return AABB::empty; }
+
+    Vector3 radiance(const Vector3& direction) const {
+        double u, v;
+        directionToUV(unitVector(direction), u, v);
+        int i = std::min(width - 1, int(u * width));
+        int j = std::min(height - 1, int(v * height));
+        return scale * pixels[size_t(j) * width + i];
+    }
+
+    double pdfValue(const Vector3& origin, const Vector3& direction) const override {
+        double u, v;
+        directionToUV(unitVector(direction), u, v);
+        double sinTheta = sin(v * pi);
+        if (sinTheta <= 0)
+            return 0;
+        return distribution.pdf(u, v) / (2 * pi * pi * sinTheta);
+    }
+
+    Vector3 random(const Vector3& origin) const override {
+        double u, v, mapPdf;
+        distribution.sample(randomDouble(), randomDouble(), u, v, mapPdf);
+        return uvToDirection(u, v);
+    }
+
+private:
+    void buildDistribution() {
+        std::vector<double> weights(pixels.size());
+        for (int j = 0; j < height; j++) {
+            double sinTheta = sin(pi * (j + 0.5) / height);
+            for (int i = 0; i < width; i++) {
+                const Vector3& c = pixels[size_t(j) * width + i];
+                weights[size_t(j) * width + i] = (0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z()) * sinTheta;
+            }
+        }
+        distribution = Distribution2D(weights, width, height);
+    }
+
+    static void directionToUV(const Vector3& d, double& u, double& v) {
+        u = (atan2(-d.z(), d.x()) + pi) / (2 * pi);
+        v = acos(std::max(-1.0, std::min(1.0, d.y()))) / pi;
+    }
+
+    static Vector3 uvToDirection(double u, double v) {
+        double phi = 2 * pi * u;
+        double theta = pi * v;
+        double sinTheta = sin(theta);
+        return Vector3(-cos(phi) * sinTheta, cos(theta), sin(phi) * sinTheta);
+    }
+
+    int width = 1;
+    int height = 1;
+    std::vector<Vector3> pixels;
+    double scale;
+    Distribution2D distribution;
+};
+
+#endif
@@ -0,0 +1,424 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "Utils.hpp"
+
+#include "AABB.hpp"
+#include "Hittable.hpp"
+#include "HittableList.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Pointer-free BVH node (64 bytes). Children and primitives are referenced by index, so a
+// node array can be written to disk and used again straight from a memory mapping.
+struct FlatBVHNode {
+    double min[3];
+    double max[3];
+    uint32_t left;   // interior: left child index,  leaf: first slot in the primitive index array
+    uint32_t right;  // interior: right child index, leaf: unused
+    uint32_t count;  // 0 for interior nodes, number of primitives for leaves
+    uint32_t parent; // parent node index, invalidIndex for the root
+
+    static const uint32_t invalidIndex = 0xffffffffu;
+
+    bool isLeaf() const { return count != 0; }
+
+    AABB bounds() const {
+        return AABB(Interval(min[0], max[0]), Interval(min[1], max[1]), Interval(min[2], max[2]));
+    }
+
+    void setBounds(const AABB& box) {
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = box.axisInterval(axis).min;
+            max[axis] = box.axisInterval(axis).max;
+        }
+    }
+
+    // Entry distance of the ray into the node box, or infinity on a miss.
+    double entry(const double origin[3], const double invDir[3], double tMin, double tMax) const {
+        for (int axis = 0; axis < 3; axis++) {
+            double t0 = (min[axis] - origin[axis]) * invDir[axis];
+            double t1 = (max[axis] - origin[axis]) * invDir[axis];
+            if (t0 > t1) std::swap(t0, t1);
+            if (t0 > tMin) tMin = t0;
+            if (t1 < tMax) tMax = t1;
+            if (tMax <= tMin)
+                return infinity;
+        }
+        return tMin;
+    }
+};
+
+// Builders keep every leaf within this many levels of the root.
+static const int maxFlatBVHDepth = 64;
+
+// Node stack for traversal. The fixed part holds what any builder's tree needs; a deeper tree
+// from elsewhere (a cache file, a refit or a wide-code LBVH) spills to the heap.
+template <typename T>
+class TraversalStack {
+public:
+    TraversalStack() : data(fixed), capacity(fixedSize) {}
+    TraversalStack(const TraversalStack&) = delete;
+    TraversalStack& operator=(const TraversalStack&) = delete;
+
+    bool empty() const { return count == 0; }
+
+    void push(const T& value) {
+        if (count == capacity)
+            grow();
+        data[count++] = value;
+    }
+
+    T pop() { return data[--count]; }
+
+private:
+    static const size_t fixedSize = 2 * maxFlatBVHDepth;
+    T fixed[fixedSize];
+    T* data;
+    size_t capacity;
+    size_t count = 0;
+    std::vector<T> spill;
+
+    void grow() {
+        std::vector<T> larger(2 * capacity);
+        std::copy(data, data + count, larger.begin());
+        spill.swap(larger);
+        data = spill.data();
+        capacity = spill.size();
+    }
+};
+
+inline double halfSurfaceArea(const FlatBVHNode& node) {
+    double dx = node.max[0] - node.min[0];
+    double dy = node.max[1] - node.min[1];
+    double dz = node.max[2] - node.min[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+// SAH cost with unit traversal and intersection costs, relative to the root surface area.
+inline double sahCost(const FlatBVHNode* nodes, size_t nodeCount) {
+    if (nodeCount == 0)
+        return 0;
+
+    double rootArea = halfSurfaceArea(nodes[0]);
+    if (rootArea <= 0)
+        return 0;
+
+    double cost = 0;
+    for (size_t i = 0; i < nodeCount; i++) {
+        double area = halfSurfaceArea(nodes[i]) / rootArea;
+        cost += nodes[i].isLeaf() ? area * nodes[i].count : area;
+    }
+    return cost;
+}
+
+// Recomputes all node bounds bottom-up in place, keeping the topology. Works for any child
+// order: each leaf walks towards the root and the second child to arrive finishes its parent.
+// `primBounds(primIndex)` returns the current bounds of a primitive.
+template <typename PrimBounds>
+void refitFlatBVH(FlatBVHNode* nodes, size_t nodeCount, const uint32_t* primIndices,
+                  PrimBounds&& primBounds, unsigned threads = hardwareThreads()) {
+    std::unique_ptr<std::atomic<uint32_t>[]> arrivals(new std::atomic<uint32_t>[nodeCount]);
+    for (size_t i = 0; i < nodeCount; i++)
+        arrivals[i].store(0, std::memory_order_relaxed);
+
+    parallelFor(0, nodeCount, threads, [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; i++) {
+            FlatBVHNode& leaf = nodes[i];
+            if (!leaf.isLeaf())
+                continue;
+
+            AABB box = AABB::empty;
+            for (uint32_t k = 0; k < leaf.count; k++)
+                box = AABB(box, primBounds(primIndices[leaf.left + k]));
+            leaf.setBounds(box);
+
+            uint32_t current = leaf.parent;
+            while (current != FlatBVHNode::invalidIndex) {
+                if (arrivals[current].fetch_add(1, std::memory_order_acq_rel) == 0)
+                    break;
+
+                FlatBVHNode& node = nodes[current];
+                const FlatBVHNode& a = nodes[node.left];
+                const FlatBVHNode& b = nodes[node.right];
+                for (int axis = 0; axis < 3; axis++) {
+                    node.min[axis] = std::min(a.min[axis], b.min[axis]);
+                    node.max[axis] = std::max(a.max[axis], b.max[axis]);
+                }
+                current = node.parent;
+            }
+        }
+    });
+}
+
+// Median-split build over primitive bounds, same split rule as BVHNode.
+class FlatBVHBuilder {
+public:
+    static void build(const std::vector<AABB>& boxes,
+                      std::vector<FlatBVHNode>& outNodes,
+                      std::vector<uint32_t>& outPrimIndices) {
+        outNodes.clear();
+        outPrimIndices.resize(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++)
+            outPrimIndices[i] = uint32_t(i);
+
+        if (boxes.empty())
+            return;
+
+        outNodes.reserve(2 * boxes.size() - 1);
+        outNodes.push_back(FlatBVHNode());
+        buildNode(boxes, outNodes, outPrimIndices, 0, FlatBVHNode::invalidIndex, 0, boxes.size());
+    }
+
+    static std::vector<AABB> primitiveBounds(const std::vector< shared_ptr<Hittable> >& objects) {
+        std::vector<AABB> boxes;
+        boxes.reserve(objects.size());
+        for (const auto& object : objects)
+            boxes.push_back(object->boundingBox());
+        return boxes;
+    }
+
+    static std::vector<AABB> primitiveBounds(const std::vector< shared_ptr<Hittable> >& objects,
+                                             const Interval& time) {
+        std::vector<AABB> boxes;
+        boxes.reserve(objects.size());
+        for (const auto& object : objects)
+            boxes.push_back(object->boundingBoxDuring(time));
+        return boxes;
+    }
+
+private:
+    static void buildNode(const std::vector<AABB>& boxes, std::vector<FlatBVHNode>& nodes,
+                          std::vector<uint32_t>& prims, uint32_t nodeIndex, uint32_t parent,
+                          size_t start, size_t end) {
+        AABB bbox = AABB::empty;
+        for (size_t index = start; index < end; index++)
+            bbox = AABB(bbox, boxes[prims[index]]);
+
+        nodes[nodeIndex].parent = parent;
+        nodes[nodeIndex].setBounds(bbox);
+
+        if (end - start == 1) {
+            nodes[nodeIndex].left = uint32_t(start);
+            nodes[nodeIndex].right = 0;
+            nodes[nodeIndex].count = 1;
+            return;
+        }
+
+        int axis = bbox.longestAxis();
+        std::sort(prims.begin() + start, prims.begin() + end, [&](uint32_t a, uint32_t b) {
+            return boxes[a].axisInterval(axis).min < boxes[b].axisInterval(axis).min;
+        });
+
+        auto mid = start + (end - start) / 2;
+        auto leftIndex = uint32_t(nodes.size());
+        auto rightIndex = leftIndex + 1;
+        nodes.push_back(FlatBVHNode());
+        nodes.push_back(FlatBVHNode());
+
+        nodes[nodeIndex].left = leftIndex;
+        nodes[nodeIndex].right = rightIndex;
+        nodes[nodeIndex].count = 0;
+
+        buildNode(boxes, nodes, prims, leftIndex, nodeIndex, start, mid);
+        buildNode(boxes, nodes, prims, rightIndex, nodeIndex, mid, end);
+    }
+};
+
+// Stack-based traversal shared by everything that stores its hierarchy as FlatBVHNodes.
+// `leafTest(leaf, ray_t)` tests all primitives of a leaf node and returns true on a hit
+// closer than ray_t.max, after narrowing ray_t.max to it.
+template <typename LeafTest>
+bool traverseFlatBVHLeaves(const FlatBVHNode* nodes, const Ray& r, Interval ray_t, LeafTest&& leafTest) {
+    if (nodes == nullptr)
+        return false;
+
+    const Vector3 orig = r.origin();
+    const Vector3 dir = r.direction();
+    const double origin[3] = { orig[0], orig[1], orig[2] };
+    const double invDir[3] = { 1.0 / dir[0], 1.0 / dir[1], 1.0 / dir[2] };
+
+    if (nodes[0].entry(origin, invDir, ray_t.min, ray_t.max) == infinity)
+        return false;
+
+    TraversalStack<uint32_t> stack;
+    uint32_t current = 0;
+    bool hitAnything = false;
+
+    while (true) {
+        const FlatBVHNode& node = nodes[current];
+
+        if (node.isLeaf()) {
+            if (leafTest(node, ray_t))
+                hitAnything = true;
+        } else {
+            double tLeft = nodes[node.left].entry(origin, invDir, ray_t.min, ray_t.max);
+            double tRight = nodes[node.right].entry(origin, invDir, ray_t.min, ray_t.max);
+
+            if (tLeft != infinity && tRight != infinity) {
+                bool leftFirst = tLeft <= tRight;
+                stack.push(leftFirst ? node.right : node.left);
+                current = leftFirst ? node.left : node.right;
+                continue;
+            }
+            if (tLeft != infinity) { current = node.left; continue; }
+            if (tRight != infinity) { current = node.right; continue; }
+        }
+
+        // Pop, skipping subtrees that now lie beyond the closest hit.
+        bool found = false;
+        while (!stack.empty()) {
+            current = stack.pop();
+            if (nodes[current].entry(origin, invDir, ray_t.min, ray_t.max) != infinity) {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            break;
+    }
+
+    return hitAnything;
+}
+
+// Per-primitive form: `leafTest(primIndex, ray_t)` returns true on a hit closer than
+// ray_t.max. A null `primIndices` means leaves address primitives by slot directly.
+template <typename LeafTest>
+bool traverseFlatBVH(const FlatBVHNode* nodes, const uint32_t* primIndices,
+                     const Ray& r, Interval ray_t, LeafTest&& leafTest) {
+    return traverseFlatBVHLeaves(nodes, r, ray_t, [&](const FlatBVHNode& leaf, Interval& t) {
+        bool hitAnything = false;
+        for (uint32_t i = 0; i < leaf.count; i++) {
+            uint32_t slot = leaf.left + i;
+            if (leafTest(primIndices ? primIndices[slot] : slot, t))
+                hitAnything = true;
+        }
+        return hitAnything;
+    });
+}
+
+// Any-hit traversal: returns as soon as `leafTest(leaf)` reports a blocker in a leaf node.
+template <typename LeafTest>
+bool occludedFlatBVHLeaves(const FlatBVHNode* nodes, const Ray& r, double tMax, LeafTest&& leafTest) {
+    if (nodes == nullptr)
+        return false;
+
+    const Vector3 orig = r.origin();
+    const Vector3 dir = r.direction();
+    const double origin[3] = { orig[0], orig[1], orig[2] };
+    const double invDir[3] = { 1.0 / dir[0], 1.0 / dir[1], 1.0 / dir[2] };
+
+    if (nodes[0].entry(origin, invDir, rayEpsilon, tMax) == infinity)
+        return false;
+
+    // Blockers tend to sit near the ray origin, so nearer children are still visited first.
+    TraversalStack<uint32_t> stack;
+    stack.push(0);
+
+    while (!stack.empty()) {
+        const FlatBVHNode& node = nodes[stack.pop()];
+
+        if (node.isLeaf()) {
+            if (leafTest(node))
+                return true;
+            continue;
+        }
+
+        double tLeft = nodes[node.left].entry(origin, invDir, rayEpsilon, tMax);
+        double tRight = nodes[node.right].entry(origin, invDir, rayEpsilon, tMax);
+        bool leftFirst = tLeft <= tRight;
+        uint32_t nearChild = leftFirst ? node.left : node.right;
+        uint32_t farChild = leftFirst ? node.right : node.left;
+        if ((leftFirst ? tRight : tLeft) != infinity)
+            stack.push(farChild);
+        if ((leftFirst ? tLeft : tRight) != infinity)
+            stack.push(nearChild);
+    }
+    return false;
+}
+
+// Per-primitive form: returns as soon as `leafTest(primIndex)` reports a blocker.
+template <typename LeafTest>
+bool occludedFlatBVH(const FlatBVHNode* nodes, const uint32_t* primIndices,
+                     const Ray& r, double tMax, LeafTest&& leafTest) {
+    return occludedFlatBVHLeaves(nodes, r, tMax, [&](const FlatBVHNode& leaf) {
+        for (uint32_t i = 0; i < leaf.count; i++) {
+            uint32_t slot = leaf.left + i;
+            if (leafTest(primIndices ? primIndices[slot] : slot))
+                return true;
+        }
+        return false;
+    });
+}
+
+class FlatBVH : public Hittable {
+public:
+    FlatBVH(HittableList list) : objects(list.objects) {
+        FlatBVHBuilder::build(FlatBVHBuilder::primitiveBounds(objects), ownedNodes, ownedPrimIndices);
+        adoptOwnedStorage();
+    }
+
+    FlatBVH(const std::vector< shared_ptr<Hittable> >& objects,
+            std::vector<FlatBVHNode> nodes, std::vector<uint32_t> primIndices)
+            : objects(objects), ownedNodes(std::move(nodes)), ownedPrimIndices(std::move(primIndices)) {
+        adoptOwnedStorage();
+    }
+
+    // Uses node and index arrays that live elsewhere (e.g. a memory-mapped cache file).
+    // `storage` keeps that memory alive for the lifetime of this BVH.
+    FlatBVH(const std::vector< shared_ptr<Hittable> >& objects, shared_ptr<const void> storage,
+            const FlatBVHNode* nodes, size_t nodeCount, const uint32_t* primIndices)
+            : objects(objects), storage(storage), nodes(nodes), nodeCount(nodeCount), primIndices(primIndices) {
+        bbox = nodeCount > 0 ? nodes[0].bounds() : AABB::empty;
+    }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const override {
+        return traverseFlatBVH(nodes, primIndices, r, ray_t, [&](uint32_t prim, Interval& t) {
+            if (!objects[prim]->hit(r, t, outRec))
+                return false;
+            t.max = outRec.t;
+            return true;
+        });
+    }
+
+    bool occluded(const Ray& r, double tMax) const override {
+        return occludedFlatBVH(nodes, primIndices, r, tMax, [&](uint32_t prim) {
+            return objects[prim]->occluded(r, tMax);
+        });
+    }
+
+    AABB boundingBox() const override { return bbox; }
+
+    double sahCost() const { return ::sahCost(nodes, nodeCount); }
+
+    const FlatBVHNode* nodeData() const { return nodes; }
+    size_t size() const { return nodeCount; }
+    const uint32_t* primitiveIndices() const { return primIndices; }
+    size_t primitiveCount() const { return objects.size(); }
+
+private:
+    void adoptOwnedStorage() {
+        nodes = ownedNodes.empty() ? nullptr : ownedNodes.data();
+        nodeCount = ownedNodes.size();
+        primIndices = ownedPrimIndices.data();
+        bbox = nodeCount > 0 ? nodes[0].bounds() : AABB::empty;
+    }
+
+    std::vector< shared_ptr<Hittable> > objects;
+
+    std::vector<FlatBVHNode> ownedNodes;
+    std::vector<uint32_t> ownedPrimIndices;
+    shared_ptr<const void> storage;
+
+    const FlatBVHNode* nodes = nullptr;
+    size_t nodeCount = 0;
+    const uint32_t* primIndices = nullptr;
+    AABB bbox;
+};
+
+#endif
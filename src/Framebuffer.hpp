@@ -0,0 +1,219 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Named per-pixel float channels, written together as one multi-channel OpenEXR file.
+// A channel has one component (stored under its own name) or several (stored as
+// "name.R", "name.G", ... for suffixes "RGB"; an empty name gives plain "R", "G", "B").
+// The pixels may be a window of a larger image, such as a crop, placed with setDisplayWindow.
+class Framebuffer {
+public:
+    struct Channel {
+        std::string name;
+        std::string suffixes;
+        std::vector<float> data; // interleaved components, row-major, top row first
+    };
+
+    Framebuffer() {}
+    Framebuffer(int width, int height) { resize(width, height); }
+
+    // Sets the size and drops all channels. The pixels become the whole image.
+    void resize(int w, int h) {
+        imgWidth = w;
+        imgHeight = h;
+        setDisplayWindow(w, h, 0, 0);
+        channelList.clear();
+    }
+
+    // Places the pixels at (x, y) inside a full image of fullWidth x fullHeight.
+    void setDisplayWindow(int fullWidth, int fullHeight, int x, int y) {
+        displayWidth = fullWidth;
+        displayHeight = fullHeight;
+        originX = x;
+        originY = y;
+    }
+
+    int width() const { return imgWidth; }
+    int height() const { return imgHeight; }
+
+    // Adds a zero-filled channel and returns its index. `suffixes` names the components,
+    // one letter each; empty means a single unnamed component.
+    size_t addChannel(const std::string& name, const std::string& suffixes = "") {
+        Channel channel;
+        channel.name = name;
+        channel.suffixes = suffixes;
+        channel.data.assign(size_t(imgWidth) * imgHeight * components(channel), 0.0f);
+        channelList.push_back(channel);
+        return channelList.size() - 1;
+    }
+
+    // Index of the channel called `name`, or -1.
+    int find(const std::string& name) const {
+        for (size_t i = 0; i < channelList.size(); i++)
+            if (channelList[i].name == name)
+                return int(i);
+        return -1;
+    }
+
+    const std::vector<Channel>& channels() const { return channelList; }
+
+    void set(size_t channel, size_t pixel, double value) {
+        channelList[channel].data[pixel] = float(value);
+    }
+
+    void set(size_t channel, size_t pixel, const Vector3& value) {
+        float* out = &channelList[channel].data[pixel * components(channelList[channel])];
+        for (size_t k = 0; k < components(channelList[channel]); k++)
+            out[k] = float(value[int(k)]);
+    }
+
+    Vector3 get(size_t channel, size_t pixel) const {
+        const Channel& c = channelList[channel];
+        size_t n = components(c);
+        const float* in = &c.data[pixel * n];
+        return n == 1 ? Vector3(in[0], in[0], in[0]) : Vector3(in[0], in[1], n > 2 ? in[2] : 0);
+    }
+
+    // Writes every channel as 32-bit float into an uncompressed scanline OpenEXR file.
+    bool writeEXR(const std::string& path) const {
+        struct Plane {
+            std::string name;
+            const Channel* channel;
+            size_t component;
+        };
+        std::vector<Plane> planes;
+        for (const auto& channel : channelList) {
+            if (channel.suffixes.empty()) {
+                planes.push_back(Plane{ channel.name, &channel, 0 });
+                continue;
+            }
+            for (size_t k = 0; k < channel.suffixes.size(); k++) {
+                std::string name = channel.name.empty() ? "" : channel.name + ".";
+                planes.push_back(Plane{ name + channel.suffixes[k], &channel, k });
+            }
+        }
+        // EXR wants channels sorted by name.
+        std::sort(planes.begin(), planes.end(), [](const Plane& a, const Plane& b) { return a.name < b.name; });
+
+        // Version 2, with the long-names flag if a channel name needs more than 31 bytes.
+        bool longNames = false;
+        for (const auto& plane : planes)
+            longNames = longNames || plane.name.size() > 31;
+        std::string header;
+        putBytes(header, "\x76\x2f\x31\x01", 4);
+        putInt(header, longNames ? 2 | 0x400 : 2);
+
+        std::string channelAttribute;
+        for (const auto& plane : planes) {
+            channelAttribute += plane.name;
+            channelAttribute += '\0';
+            putInt(channelAttribute, 2); // FLOAT
+            putInt(channelAttribute, 0); // pLinear and reserved bytes
+            putInt(channelAttribute, 1); // x sampling
+            putInt(channelAttribute, 1); // y sampling
+        }
+        channelAttribute += '\0';
+        putAttribute(header, "channels", "chlist", channelAttribute);
+        putAttribute(header, "compression", "compression", std::string(1, '\0'));
+
+        std::string dataWindow, displayWindow;
+        putInt(dataWindow, originX);
+        putInt(dataWindow, originY);
+        putInt(dataWindow, originX + imgWidth - 1);
+        putInt(dataWindow, originY + imgHeight - 1);
+        putInt(displayWindow, 0);
+        putInt(displayWindow, 0);
+        putInt(displayWindow, displayWidth - 1);
+        putInt(displayWindow, displayHeight - 1);
+        putAttribute(header, "dataWindow", "box2i", dataWindow);
+        putAttribute(header, "displayWindow", "box2i", displayWindow);
+        putAttribute(header, "lineOrder", "lineOrder", std::string(1, '\0'));
+        std::string one;
+        putFloat(one, 1.0f);
+        putAttribute(header, "pixelAspectRatio", "float", one);
+        std::string center;
+        putFloat(center, 0.0f);
+        putFloat(center, 0.0f);
+        putAttribute(header, "screenWindowCenter", "v2f", center);
+        putAttribute(header, "screenWindowWidth", "float", one);
+        header += '\0';
+
+        // One scanline per block: its y in the full image, byte count, then each channel's row in
+        // name order.
+        uint64_t blockSize = 8 + uint64_t(planes.size()) * imgWidth * 4;
+        uint64_t offset = header.size() + uint64_t(imgHeight) * 8;
+        for (int y = 0; y < imgHeight; y++)
+            putUint64(header, offset + uint64_t(y) * blockSize);
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(header.data(), std::streamsize(header.size()));
+        std::string block;
+        for (int y = 0; y < imgHeight; y++) {
+            block.clear();
+            putInt(block, originY + y);
+            putInt(block, int32_t(blockSize - 8));
+            for (const auto& plane : planes) {
+                size_t n = components(*plane.channel);
+                for (int x = 0; x < imgWidth; x++)
+                    putFloat(block, plane.channel->data[(size_t(y) * imgWidth + x) * n + plane.component]);
+            }
+            out.write(block.data(), std::streamsize(block.size()));
+        }
+        out.close();
+        return bool(out);
+    }
+
+private:
+    static size_t components(const Channel& channel) {
+        return channel.suffixes.empty() ? 1 : channel.suffixes.size();
+    }
+
+    // EXR is little-endian.
+    static void putBytes(std::string& out, const char* bytes, size_t count) {
+        out.append(bytes, count);
+    }
+
+    static void putUint64(std::string& out, uint64_t value) {
+        for (int i = 0; i < 8; i++)
+            out += char((value >> (8 * i)) & 0xff);
+    }
+
+    static void putInt(std::string& out, int32_t value) {
+        uint32_t bits = uint32_t(value);
+        for (int i = 0; i < 4; i++)
+            out += char((bits >> (8 * i)) & 0xff);
+    }
+
+    static void putFloat(std::string& out, float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        putInt(out, int32_t(bits));
+    }
+
+    static void putAttribute(std::string& out, const char* name, const char* type, const std::string& value) {
+        out += name;
+        out += '\0';
+        out += type;
+        out += '\0';
+        putInt(out, int32_t(value.size()));
+        out += value;
+    }
+
+    int imgWidth = 0;
+    int imgHeight = 0;
+    int displayWidth = 0;
+    int displayHeight = 0;
+    int originX = 0;
+    int originY = 0;
+    std::vector<Channel> channelList;
+};
+
+#endif
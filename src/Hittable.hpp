@@ -5,10 +5,15 @@
 #include "Utils.hpp"
 #include "AABB.hpp"
 
+#include <cstdint>
 #include <memory>
 
 class Material;
 
+class Hittable;
+
+// hit() only fills t and the primitive that was hit; p, normal, u, v and mat are filled by
+// finalize() once the closest hit is known.
 class HitRecord {
 public:
     Vector3 p;
@@ -18,19 +23,40 @@ public:
     double u;
     double v;
     bool isFrontFace;
+    const Hittable* object = nullptr;
+    uint64_t primIndex = 0; // primitive within `object`, for objects that hold many
 
     void setFaceNormal(const Ray& r, const Vector3& outwardNormal) {
         isFrontFace = dot(r.direction(), outwardNormal) < 0;
         normal = isFrontFace ? outwardNormal : -outwardNormal;
     }
+
+    inline void finalize(const Ray& r);
 };
 
+// Offset used for the start of secondary rays to avoid self-intersection.
+const double rayEpsilon = 0.001;
+
 class Hittable {
 public:
     virtual bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const = 0;
 
+    // Any-hit query: is there a surface in (rayEpsilon, tMax)? Stops at the first blocker.
+    virtual bool occluded(const Ray& r, double tMax) const {
+        HitRecord rec;
+        return hit(r, Interval(rayEpsilon, tMax), rec);
+    }
+
     virtual AABB boundingBox() const = 0;
 
+    // Computes the surface data of a hit that this primitive reported from hit().
+    virtual void finalize(const Ray& r, HitRecord& rec) const {}
+
+    // Bounds of the object over a shutter interval. Static objects return boundingBox().
+    virtual AABB boundingBoxDuring(const Interval& time) const {
+        return boundingBox();
+    }
+
     virtual double pdfValue(const Vector3& origin, const Vector3& direction) const {
         return 0.0;
     }
@@ -40,6 +66,14 @@ public:
     }
 };
 
+inline void HitRecord::finalize(const Ray& r) {
+    if (object == nullptr)
+        return;
+    const Hittable* hitObject = object;
+    object = nullptr;
+    hitObject->finalize(r, *this);
+}
+
 
 class Translate : public Hittable {
 public:
@@ -55,13 +89,26 @@ public:
         if (!object->hit(offset_r, ray_t, outRec))
             return false;
 
+        // Surface data has to be computed in object space before moving it back.
+        outRec.finalize(offset_r);
         outRec.p += offset;
 
         return true;
     }
 
+    bool occluded(const Ray& r, double tMax) const override {
+        return object->occluded(Ray(r.origin() - offset, r.direction(), r.time()), tMax);
+    }
+
     AABB boundingBox() const override { return bbox; }
 
+    AABB boundingBoxDuring(const Interval& time) const override {
+        return object->boundingBoxDuring(time) + offset;
+    }
+
+    shared_ptr<Hittable> child() const { return object; }
+    Vector3 translation() const { return offset; }
+
 private:
     shared_ptr<Hittable> object;
     Vector3 offset;
@@ -75,49 +122,17 @@ public:
         auto radians = degrees2radians(angle);
         sinTheta = sin(radians);
         cosTheta = cos(radians);
-        bbox = object->boundingBox();
-
-        Vector3 min(infinity, infinity, infinity);
-        Vector3 max(-infinity, -infinity, -infinity);
-
-        for (int i = 0; i < 2; i++) {
-            for (int j = 0; j < 2; j++) {
-                for (int k = 0; k < 2; k++) {
-                    auto x = i * bbox.x.max + (1 - i) * bbox.x.min;
-                    auto y = j * bbox.y.max + (1 - j) * bbox.y.min;
-                    auto z = k * bbox.z.max + (1 - k) * bbox.z.min;
-
-                    auto newx = cosTheta * x + sinTheta * z;
-                    auto newz = -sinTheta * x + cosTheta * z;
-
-                    Vector3 tester(newx, y, newz);
-
-                    for (int c = 0; c < 3; c++) {
-                        min[c] = fmin(min[c], tester[c]);
-                        max[c] = fmax(max[c], tester[c]);
-                    }
-                }
-            }
-        }
-
-        bbox = AABB(min, max);
+        bbox = rotatedBounds(object->boundingBox());
     }
 
     bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const override {
-        auto origin = r.origin();
-        auto direction = r.direction();
-
-        origin[0] = cosTheta * r.origin()[0] - sinTheta * r.origin()[2];
-        origin[2] = sinTheta * r.origin()[0] + cosTheta * r.origin()[2];
-
-        direction[0] = cosTheta * r.direction()[0] - sinTheta * r.direction()[2];
-        direction[2] = sinTheta * r.direction()[0] + cosTheta * r.direction()[2];
-
-        Ray rotated_r(origin, direction, r.time());
+        Ray rotated_r = toObjectSpace(r);
 
         if (!object->hit(rotated_r, ray_t, outRec))
             return false;
 
+        outRec.finalize(rotated_r);
+
         // Change the intersection point from object space to world space
         auto p = outRec.p;
         p[0] = cosTheta * outRec.p[0] + sinTheta * outRec.p[2];
@@ -136,7 +151,59 @@ public:
 
     AABB boundingBox() const override { return bbox; }
 
+    bool occluded(const Ray& r, double tMax) const override {
+        return object->occluded(toObjectSpace(r), tMax);
+    }
+
+    AABB boundingBoxDuring(const Interval& time) const override {
+        return rotatedBounds(object->boundingBoxDuring(time));
+    }
+
+    shared_ptr<Hittable> child() const { return object; }
+    double sinAngle() const { return sinTheta; }
+    double cosAngle() const { return cosTheta; }
+
 private:
+    Ray toObjectSpace(const Ray& r) const {
+        auto origin = r.origin();
+        auto direction = r.direction();
+
+        origin[0] = cosTheta * r.origin()[0] - sinTheta * r.origin()[2];
+        origin[2] = sinTheta * r.origin()[0] + cosTheta * r.origin()[2];
+
+        direction[0] = cosTheta * r.direction()[0] - sinTheta * r.direction()[2];
+        direction[2] = sinTheta * r.direction()[0] + cosTheta * r.direction()[2];
+
+        return Ray(origin, direction, r.time());
+    }
+
+    AABB rotatedBounds(const AABB& bbox) const {
+        Vector3 min(infinity, infinity, infinity);
+        Vector3 max(-infinity, -infinity, -infinity);
+
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                for (int k = 0; k < 2; k++) {
+                    auto x = i * bbox.x.max + (1 - i) * bbox.x.min;
+                    auto y = j * bbox.y.max + (1 - j) * bbox.y.min;
+                    auto z = k * bbox.z.max + (1 - k) * bbox.z.min;
+
+                    auto newx = cosTheta * x + sinTheta * z;
+                    auto newz = -sinTheta * x + cosTheta * z;
+
+                    Vector3 tester(newx, y, newz);
+
+                    for (int c = 0; c < 3; c++) {
+                        min[c] = fmin(min[c], tester[c]);
+                        max[c] = fmax(max[c], tester[c]);
+                    }
+                }
+            }
+        }
+
+        return AABB(min, max);
+    }
+
     shared_ptr<Hittable> object;
     double sinTheta;
     double cosTheta;
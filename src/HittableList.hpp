@@ -36,8 +36,23 @@ public:
         return hitAnything;
     }
 
+    bool occluded(const Ray& r, double tMax) const override {
+        for (const auto& object : objects) {
+            if (object->occluded(r, tMax))
+                return true;
+        }
+        return false;
+    }
+
     AABB boundingBox() const override { return bbox; }
 
+    AABB boundingBoxDuring(const Interval& time) const override {
+        AABB box = AABB::empty;
+        for (const auto& object : objects)
+            box = AABB(box, object->boundingBoxDuring(time));
+        return box;
+    }
+
     double pdfValue(const Vector3& origin, const Vector3& direction) const override {
         auto weight = 1.0 / objects.size();
         auto sum = 0.0;
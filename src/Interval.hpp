@@ -34,7 +34,7 @@ public:
     }
 
     double size() const {
-        return max - min + 1;
+        return max - min;
     }
 
 };
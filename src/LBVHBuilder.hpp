@@ -0,0 +1,398 @@
+#ifndef LBVH_BUILDER_H
+#define LBVH_BUILDER_H
+
+#include "Utils.hpp"
+#include "FlatBVH.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Linear BVH: primitives are ordered along a Morton curve through their centroids and the
+// hierarchy is emitted in one parallel pass over the sorted codes (Karras 2012). Internal nodes
+// occupy indices [0, n-1), leaves [n-1, 2n-1). An optional bottom-up pass rebuilds small
+// treelets with their SAH-optimal topology (Karras & Aila 2013) to recover quality.
+class LBVHBuilder {
+public:
+    bool wideCodes = false;        // 63-bit codes (21 bits per axis) instead of 30-bit
+    bool optimizeTreelets = false; // treelet restructuring after the build
+    unsigned threads;
+
+    LBVHBuilder(unsigned threads = hardwareThreads()) : threads(threads == 0 ? 1 : threads) {}
+
+    void build(const std::vector<AABB>& boxes,
+               std::vector<FlatBVHNode>& outNodes,
+               std::vector<uint32_t>& outPrimIndices) {
+        size_t n = boxes.size();
+        outNodes.clear();
+        outPrimIndices.resize(n);
+        if (n == 0)
+            return;
+
+        computeMortonCodes(boxes);
+        radixSort();
+
+        for (size_t i = 0; i < n; i++)
+            outPrimIndices[i] = values[i];
+
+        outNodes.resize(2 * n - 1);
+        nodes = outNodes.data();
+        leafCount = n;
+
+        if (n == 1) {
+            nodes[0].setBounds(boxes[values[0]]);
+            nodes[0].left = 0;
+            nodes[0].right = 0;
+            nodes[0].count = 1;
+            nodes[0].parent = FlatBVHNode::invalidIndex;
+            return;
+        }
+
+        nodes[0].parent = FlatBVHNode::invalidIndex;
+        parallelFor(0, n - 1, threads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++)
+                emitInternalNode(int64_t(i));
+        });
+
+        fitBoundsBottomUp(boxes);
+
+        keys.clear();
+        values.clear();
+    }
+
+    static shared_ptr<FlatBVH> build(const HittableList& list, bool optimizeTreelets = false,
+                                     unsigned threads = hardwareThreads()) {
+        std::vector<FlatBVHNode> nodes;
+        std::vector<uint32_t> primIndices;
+        LBVHBuilder builder(threads);
+        builder.optimizeTreelets = optimizeTreelets;
+        builder.build(FlatBVHBuilder::primitiveBounds(list.objects), nodes, primIndices);
+        return make_shared<FlatBVH>(list.objects, std::move(nodes), std::move(primIndices));
+    }
+
+    static uint64_t expandBits10(uint64_t v) {
+        // 10 bits -> every third bit of 30.
+        v &= 0x3ff;
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    static uint64_t expandBits21(uint64_t v) {
+        // 21 bits -> every third bit of 63.
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffull;
+        v = (v | v << 16) & 0x1f0000ff0000ffull;
+        v = (v | v << 8) & 0x100f00f00f00f00full;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+        v = (v | v << 2) & 0x1249249249249249ull;
+        return v;
+    }
+
+private:
+    static const int treeletSize = 5;
+
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> values;
+    FlatBVHNode* nodes = nullptr;
+    size_t leafCount = 0;
+
+    // Per-node SAH cost (absolute area units) and leaf count, used by the treelet pass.
+    std::unique_ptr<double[]> subtreeCost;
+    std::unique_ptr<uint32_t[]> subtreeLeaves;
+
+    void computeMortonCodes(const std::vector<AABB>& boxes) {
+        size_t n = boxes.size();
+        double lo[3] = { infinity, infinity, infinity };
+        double hi[3] = { -infinity, -infinity, -infinity };
+        for (const auto& b : boxes) {
+            for (int a = 0; a < 3; a++) {
+                double c = 0.5 * (b.axisInterval(a).min + b.axisInterval(a).max);
+                lo[a] = std::min(lo[a], c);
+                hi[a] = std::max(hi[a], c);
+            }
+        }
+
+        double cells = wideCodes ? double(1 << 21) : double(1 << 10);
+        double scale[3];
+        for (int a = 0; a < 3; a++)
+            scale[a] = hi[a] > lo[a] ? cells / (hi[a] - lo[a]) : 0;
+
+        keys.resize(n);
+        values.resize(n);
+        parallelFor(0, n, threads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++) {
+                uint64_t q[3];
+                for (int a = 0; a < 3; a++) {
+                    double c = 0.5 * (boxes[i].axisInterval(a).min + boxes[i].axisInterval(a).max);
+                    q[a] = uint64_t(std::min(cells - 1, std::max(0.0, (c - lo[a]) * scale[a])));
+                }
+                keys[i] = wideCodes
+                        ? (expandBits21(q[0]) << 2) | (expandBits21(q[1]) << 1) | expandBits21(q[2])
+                        : (expandBits10(q[0]) << 2) | (expandBits10(q[1]) << 1) | expandBits10(q[2]);
+                values[i] = uint32_t(i);
+            }
+        });
+    }
+
+    // LSD radix sort of (code, primitive) pairs, 8 bits per pass, per-thread histograms.
+    void radixSort() {
+        size_t n = keys.size();
+        int passes = wideCodes ? 8 : 4;
+        std::vector<uint64_t> keysTmp(n);
+        std::vector<uint32_t> valuesTmp(n);
+        unsigned t = unsigned(std::max<size_t>(1, std::min<size_t>(threads, n / 4096)));
+        size_t chunk = (n + t - 1) / t;
+        std::vector<size_t> histogram(size_t(t) * 256);
+
+        for (int pass = 0; pass < passes; pass++) {
+            int shift = pass * 8;
+            std::fill(histogram.begin(), histogram.end(), 0);
+
+            parallelFor(0, t, t, [&](size_t first, size_t last, unsigned) {
+                for (size_t w = first; w < last; w++) {
+                    size_t* h = &histogram[w * 256];
+                    for (size_t i = w * chunk; i < std::min(n, (w + 1) * chunk); i++)
+                        h[(keys[i] >> shift) & 0xff]++;
+                }
+            });
+
+            // Exclusive prefix over (digit, worker) so equal digits keep their input order.
+            size_t sum = 0;
+            for (int digit = 0; digit < 256; digit++) {
+                for (unsigned w = 0; w < t; w++) {
+                    size_t count = histogram[w * 256 + digit];
+                    histogram[w * 256 + digit] = sum;
+                    sum += count;
+                }
+            }
+
+            parallelFor(0, t, t, [&](size_t first, size_t last, unsigned) {
+                for (size_t w = first; w < last; w++) {
+                    size_t* offset = &histogram[w * 256];
+                    for (size_t i = w * chunk; i < std::min(n, (w + 1) * chunk); i++) {
+                        size_t dst = offset[(keys[i] >> shift) & 0xff]++;
+                        keysTmp[dst] = keys[i];
+                        valuesTmp[dst] = values[i];
+                    }
+                }
+            });
+
+            keys.swap(keysTmp);
+            values.swap(valuesTmp);
+        }
+    }
+
+    // Length of the common key prefix of sorted entries i and j; duplicates fall back to the index.
+    int delta(int64_t i, int64_t j) const {
+        if (j < 0 || j >= int64_t(leafCount))
+            return -1;
+        uint64_t diff = keys[size_t(i)] ^ keys[size_t(j)];
+        if (diff != 0)
+            return __builtin_clzll(diff);
+        return 64 + __builtin_clzll(uint64_t(i ^ j));
+    }
+
+    void emitInternalNode(int64_t i) {
+        int d = delta(i, i + 1) - delta(i, i - 1) >= 0 ? 1 : -1;
+
+        // Find the other end of the key range covered by this node.
+        int deltaMin = delta(i, i - d);
+        int64_t lengthMax = 2;
+        while (delta(i, i + lengthMax * d) > deltaMin)
+            lengthMax *= 2;
+
+        int64_t length = 0;
+        for (int64_t step = lengthMax / 2; step >= 1; step /= 2) {
+            if (delta(i, i + (length + step) * d) > deltaMin)
+                length += step;
+        }
+        int64_t j = i + length * d;
+
+        // Binary search for the split position inside the range.
+        int deltaNode = delta(i, j);
+        int64_t split = 0;
+        for (int64_t div = 2; ; div *= 2) {
+            int64_t step = (length + div - 1) / div;
+            if (delta(i, i + (split + step) * d) > deltaNode)
+                split += step;
+            if (step <= 1)
+                break;
+        }
+        int64_t gamma = i + split * d + std::min(d, 0);
+
+        auto internal = uint32_t(i);
+        uint32_t leafBase = uint32_t(leafCount - 1);
+        uint32_t left = std::min(i, j) == gamma ? leafBase + uint32_t(gamma) : uint32_t(gamma);
+        uint32_t right = std::max(i, j) == gamma + 1 ? leafBase + uint32_t(gamma + 1) : uint32_t(gamma + 1);
+
+        nodes[internal].left = left;
+        nodes[internal].right = right;
+        nodes[internal].count = 0;
+        nodes[left].parent = internal;
+        nodes[right].parent = internal;
+    }
+
+    static void unionBounds(FlatBVHNode& dst, const FlatBVHNode& a, const FlatBVHNode& b) {
+        for (int axis = 0; axis < 3; axis++) {
+            dst.min[axis] = std::min(a.min[axis], b.min[axis]);
+            dst.max[axis] = std::max(a.max[axis], b.max[axis]);
+        }
+    }
+
+    // Leaves walk up towards the root; the second child to arrive at a node finishes it.
+    void fitBoundsBottomUp(const std::vector<AABB>& boxes) {
+        size_t n = leafCount;
+        std::unique_ptr<std::atomic<uint32_t>[]> arrivals(new std::atomic<uint32_t>[n - 1]);
+        for (size_t i = 0; i < n - 1; i++)
+            arrivals[i].store(0, std::memory_order_relaxed);
+
+        if (optimizeTreelets) {
+            subtreeCost.reset(new double[2 * n - 1]);
+            subtreeLeaves.reset(new uint32_t[2 * n - 1]);
+        }
+
+        parallelFor(0, n, threads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t j = begin; j < end; j++) {
+                uint32_t leaf = uint32_t(n - 1 + j);
+                nodes[leaf].setBounds(boxes[values[j]]);
+                nodes[leaf].left = uint32_t(j);
+                nodes[leaf].right = 0;
+                nodes[leaf].count = 1;
+                if (optimizeTreelets) {
+                    subtreeCost[leaf] = halfSurfaceArea(nodes[leaf]);
+                    subtreeLeaves[leaf] = 1;
+                }
+
+                uint32_t current = nodes[leaf].parent;
+                while (current != FlatBVHNode::invalidIndex) {
+                    if (arrivals[current].fetch_add(1, std::memory_order_acq_rel) == 0)
+                        break;
+
+                    FlatBVHNode& node = nodes[current];
+                    unionBounds(node, nodes[node.left], nodes[node.right]);
+                    if (optimizeTreelets) {
+                        subtreeLeaves[current] = subtreeLeaves[node.left] + subtreeLeaves[node.right];
+                        subtreeCost[current] = halfSurfaceArea(node) + subtreeCost[node.left] + subtreeCost[node.right];
+                        if (subtreeLeaves[current] >= uint32_t(treeletSize))
+                            restructureTreelet(current);
+                    }
+                    current = node.parent;
+                }
+            }
+        });
+
+        subtreeCost.reset();
+        subtreeLeaves.reset();
+    }
+
+    // Replaces the topology below `root` (down to treeletSize subtrees) with the SAH-optimal one.
+    void restructureTreelet(uint32_t root) {
+        uint32_t leaves[treeletSize];
+        uint32_t internals[treeletSize - 1];
+        int leafTotal = 2;
+        int internalTotal = 1;
+        leaves[0] = nodes[root].left;
+        leaves[1] = nodes[root].right;
+        internals[0] = root;
+
+        // Grow the treelet by opening the treelet leaf with the largest surface area.
+        while (leafTotal < treeletSize) {
+            int best = -1;
+            double bestArea = -1;
+            for (int k = 0; k < leafTotal; k++) {
+                if (nodes[leaves[k]].isLeaf())
+                    continue;
+                double area = halfSurfaceArea(nodes[leaves[k]]);
+                if (area > bestArea) {
+                    bestArea = area;
+                    best = k;
+                }
+            }
+            if (best < 0)
+                break;
+
+            uint32_t opened = leaves[best];
+            internals[internalTotal++] = opened;
+            leaves[best] = nodes[opened].left;
+            leaves[leafTotal++] = nodes[opened].right;
+        }
+
+        if (leafTotal < 3)
+            return;
+
+        // Dynamic programming over all subsets of treelet leaves.
+        const int subsetCount = 1 << leafTotal;
+        FlatBVHNode box[1 << treeletSize];
+        double cost[1 << treeletSize];
+        int bestPartition[1 << treeletSize];
+
+        for (int s = 1; s < subsetCount; s++) {
+            int lowest = __builtin_ctz(unsigned(s));
+            if ((s & (s - 1)) == 0) {
+                box[s] = nodes[leaves[lowest]];
+                cost[s] = subtreeCost[leaves[lowest]];
+                continue;
+            }
+            unionBounds(box[s], box[s & (s - 1)], box[1 << lowest]);
+
+            // Enumerate partitions with the lowest leaf always on the left to avoid duplicates.
+            double best = infinity;
+            int rest = s & ~(1 << lowest);
+            for (int part = rest; ; part = (part - 1) & rest) {
+                int left = part | (1 << lowest);
+                if (left != s) {
+                    double c = cost[left] + cost[s ^ left];
+                    if (c < best) {
+                        best = c;
+                        bestPartition[s] = left;
+                    }
+                }
+                if (part == 0)
+                    break;
+            }
+            cost[s] = halfSurfaceArea(box[s]) + best;
+        }
+
+        int all = subsetCount - 1;
+        if (cost[all] >= subtreeCost[root] * (1.0 - 1e-9))
+            return;
+
+        int nextInternal = 0;
+        uint32_t parent = nodes[root].parent;
+        emitTreelet(all, parent, leaves, internals, nextInternal, box, bestPartition, cost);
+    }
+
+    uint32_t emitTreelet(int subset, uint32_t parent, const uint32_t* leaves, const uint32_t* internals,
+                         int& nextInternal, const FlatBVHNode* box, const int* bestPartition, const double* cost) {
+        if ((subset & (subset - 1)) == 0) {
+            uint32_t leaf = leaves[__builtin_ctz(unsigned(subset))];
+            nodes[leaf].parent = parent;
+            return leaf;
+        }
+
+        uint32_t index = internals[nextInternal++];
+        FlatBVHNode& node = nodes[index];
+        node.parent = parent;
+        for (int axis = 0; axis < 3; axis++) {
+            node.min[axis] = box[subset].min[axis];
+            node.max[axis] = box[subset].max[axis];
+        }
+        node.count = 0;
+
+        int left = bestPartition[subset];
+        node.left = emitTreelet(left, index, leaves, internals, nextInternal, box, bestPartition, cost);
+        node.right = emitTreelet(subset ^ left, index, leaves, internals, nextInternal, box, bestPartition, cost);
+
+        subtreeCost[index] = cost[subset];
+        subtreeLeaves[index] = subtreeLeaves[node.left] + subtreeLeaves[node.right];
+        return index;
+    }
+};
+
+#endif
@@ -30,6 +30,11 @@ public:
     virtual double scatteringPDF(const Ray& ray, const HitRecord& rec, const Ray& scattered) const {
         return 0;
     }
+
+    // Surface color at a hit for the denoiser's albedo buffer.
+    virtual Vector3 albedoAt(const HitRecord& rec) const {
+        return Vector3(1, 1, 1);
+    }
 };
 
 
@@ -50,6 +55,10 @@ public:
         return cosTheta < 0 ? 0 : cosTheta / pi;
     }
 
+    Vector3 albedoAt(const HitRecord& rec) const override {
+        return tex->value(rec.u, rec.v, rec.p);
+    }
+
 private:
     std::shared_ptr<Texture> tex;
 };
@@ -69,6 +78,10 @@ public:
         return true;
     }
 
+    Vector3 albedoAt(const HitRecord& rec) const override {
+        return albedo;
+    }
+
 private:
     Vector3 albedo;
     double fuzz;
@@ -131,6 +144,10 @@ public:
         return 1 / (4 * pi);
     }
 
+    Vector3 albedoAt(const HitRecord& rec) const override {
+        return tex->value(rec.u, rec.v, rec.p);
+    }
+
 private:
     shared_ptr<Texture> tex;
 };
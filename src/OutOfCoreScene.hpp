@@ -0,0 +1,593 @@
+#ifndef OUT_OF_CORE_SCENE_H
+#define OUT_OF_CORE_SCENE_H
+
+#include "Utils.hpp"
+#include "CompiledScene.hpp"
+#include "FlatBVH.hpp"
+#include "LBVHBuilder.hpp"
+#include "MappedFile.hpp"
+#include "ParallelBVHBuilder.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+// Out-of-core scenes: spheres and quads are cut into spatially coherent chunks along a Morton
+// curve, and every chunk file holds its own bottom-level BVH next to its primitives, laid out
+// like CompiledScene. Only the chunk bounds, the top-level BVH over them and the materials
+// stay in memory; OutOfCoreScene maps a chunk when a ray first reaches it and, when the mapped
+// bytes go over its residency budget, unmaps the least recently used ones down to 7/8 of it.
+//
+// The budget has to hold the chunks that consecutive rays cross. Rays of one tile visit their
+// chunks in about the same order, so with fewer resident LRU unmaps each one just before the
+// next ray needs it and every ray pages in again. bench-ooc 200000 100000 with 52 chunks of
+// 0.8 MiB, about 10 per ray: an 8 MiB budget pages in 7 chunks per ray and runs ~20x slower than
+// in memory; 16 MiB pages in 0.03 per ray.
+namespace OutOfCore {
+    const uint64_t alignment = 64;
+
+    inline uint64_t alignUp(uint64_t offset) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    struct IndexHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t chunkCount;
+        uint64_t primCount;
+    };
+
+    struct ChunkInfo {
+        double min[3];
+        double max[3];
+        uint64_t firstPrim; // global index of the chunk's first slot
+        uint64_t primCount;
+        uint64_t fileSize;
+    };
+
+    struct ChunkHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t nodeCount;
+        uint32_t sphereCount;
+        uint32_t quadCount;
+        uint64_t refOffset;
+        uint64_t nodeOffset;
+        uint64_t sphereOffset;
+        uint64_t quadOffset;
+        uint64_t fileSize;
+    };
+
+    inline std::string indexPath(const std::string& dir) {
+        return dir + "/scene.idx";
+    }
+
+    inline std::string chunkPath(const std::string& dir, uint32_t chunk) {
+        char name[32];
+        snprintf(name, sizeof(name), "chunk-%06u.bin", chunk);
+        return dir + "/" + name;
+    }
+
+    inline ChunkHeader makeChunkHeader(uint32_t nodeCount, uint32_t sphereCount, uint32_t quadCount) {
+        ChunkHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "RTOOCC01", sizeof(header.magic));
+        header.version = 1;
+        header.nodeCount = nodeCount;
+        header.sphereCount = sphereCount;
+        header.quadCount = quadCount;
+        uint64_t primCount = uint64_t(sphereCount) + quadCount;
+        header.refOffset = alignUp(sizeof(ChunkHeader));
+        header.nodeOffset = alignUp(header.refOffset + primCount * sizeof(CompiledScene::PrimitiveRef));
+        header.sphereOffset = alignUp(header.nodeOffset + nodeCount * sizeof(FlatBVHNode));
+        header.quadOffset = alignUp(header.sphereOffset + sphereCount * sizeof(CompiledScene::SphereData));
+        header.fileSize = header.quadOffset + quadCount * sizeof(CompiledScene::QuadData);
+        return header;
+    }
+}
+
+// Streams primitives to a spool file, then sorts them along a Morton curve and writes the
+// chunk files and the scene index. Only 16 bytes per primitive are held in memory.
+class OutOfCoreWriter {
+public:
+    OutOfCoreWriter(const std::string& dir, uint32_t primitivesPerChunk = 1 << 12)
+            : dir(dir), primitivesPerChunk(primitivesPerChunk == 0 ? 1 : primitivesPerChunk) {
+        mkdir(dir.c_str(), 0755);
+        spool.open(spoolPath(), std::ios::binary | std::ios::trunc);
+    }
+
+    void addSphere(const Vector3& center, double radius, shared_ptr<Material> mat) {
+        Record record = { uint32_t(CompiledScene::PrimitiveType::Sphere), materialId(mat),
+                          { center.x(), center.y(), center.z(), radius, 0, 0, 0, 0, 0 } };
+        write(record);
+    }
+
+    void addQuad(const Vector3& Q, const Vector3& u, const Vector3& v, shared_ptr<Material> mat) {
+        Record record = { uint32_t(CompiledScene::PrimitiveType::Quad), materialId(mat),
+                          { Q.x(), Q.y(), Q.z(), u.x(), u.y(), u.z(), v.x(), v.y(), v.z() } };
+        write(record);
+    }
+
+    // Writes the chunks and the index and removes the spool. Returns false on an I/O error.
+    bool finish(unsigned threads = hardwareThreads()) {
+        spool.close();
+        if (!spool)
+            return false;
+
+        bool ok = writeChunks(threads);
+        std::remove(spoolPath().c_str());
+        return ok;
+    }
+
+    // Materials by id; OutOfCoreScene takes the same table.
+    const std::vector< shared_ptr<Material> >& materials() const { return materialTable; }
+
+    size_t size() const { return count; }
+
+private:
+    // Spheres keep center and radius in p[0..3]; quads keep Q, u and v.
+    struct Record {
+        uint32_t type;
+        uint32_t material;
+        double p[9];
+    };
+
+    struct SortKey {
+        uint64_t code;
+        uint64_t index;
+    };
+
+    std::string spoolPath() const { return dir + "/spool.bin"; }
+
+    void write(const Record& record) {
+        spool.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        count++;
+    }
+
+    static Vector3 centroid(const Record& record) {
+        Vector3 first(record.p[0], record.p[1], record.p[2]);
+        if (record.type == uint32_t(CompiledScene::PrimitiveType::Sphere))
+            return first;
+        return first + 0.5 * (Vector3(record.p[3], record.p[4], record.p[5]) + Vector3(record.p[6], record.p[7], record.p[8]));
+    }
+
+    static AABB bounds(const Record& record) {
+        Vector3 first(record.p[0], record.p[1], record.p[2]);
+        if (record.type == uint32_t(CompiledScene::PrimitiveType::Sphere)) {
+            auto rvec = Vector3(record.p[3], record.p[3], record.p[3]);
+            return AABB(first - rvec, first + rvec);
+        }
+        return ParallelogramShape::bounds(first, Vector3(record.p[3], record.p[4], record.p[5]),
+                                          Vector3(record.p[6], record.p[7], record.p[8]));
+    }
+
+    bool writeChunks(unsigned threads) {
+        MappedFile file;
+        if (count > 0 && (!file.open(spoolPath()) || file.size() != count * sizeof(Record)))
+            return false;
+        const Record* records = reinterpret_cast<const Record*>(file.data());
+
+        // Morton order of the centroids, so consecutive primitives are close in space.
+        double lo[3] = { infinity, infinity, infinity };
+        double hi[3] = { -infinity, -infinity, -infinity };
+        for (size_t i = 0; i < count; i++) {
+            Vector3 c = centroid(records[i]);
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::min(lo[a], c[a]);
+                hi[a] = std::max(hi[a], c[a]);
+            }
+        }
+        // One scale for all axes keeps chunks close to cubes in flat scenes, so a ray crosses
+        // fewer of them.
+        const double cells = double(1 << 21);
+        double extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+        double scale = extent > 0 ? cells / extent : 0;
+        std::vector<SortKey> keys(count);
+        for (size_t i = 0; i < count; i++) {
+            Vector3 c = centroid(records[i]);
+            uint64_t code = 0;
+            for (int a = 0; a < 3; a++) {
+                uint64_t q = uint64_t(std::min(cells - 1, std::max(0.0, (c[a] - lo[a]) * scale)));
+                code |= LBVHBuilder::expandBits21(q) << (2 - a);
+            }
+            keys[i] = SortKey{ code, uint64_t(i) };
+        }
+        std::sort(keys.begin(), keys.end(), [](const SortKey& a, const SortKey& b) {
+            return a.code < b.code || (a.code == b.code && a.index < b.index);
+        });
+
+        std::vector<OutOfCore::ChunkInfo> chunks;
+        for (size_t first = 0; first < count; first += primitivesPerChunk) {
+            size_t last = std::min(count, first + size_t(primitivesPerChunk));
+            OutOfCore::ChunkInfo info;
+            if (!writeChunk(records, keys, first, last, uint32_t(chunks.size()), threads, info))
+                return false;
+            chunks.push_back(info);
+        }
+
+        OutOfCore::IndexHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "RTOOCI01", sizeof(header.magic));
+        header.version = 1;
+        header.chunkCount = uint32_t(chunks.size());
+        header.primCount = count;
+
+        std::ofstream out(OutOfCore::indexPath(dir), std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!chunks.empty())
+            out.write(reinterpret_cast<const char*>(chunks.data()), std::streamsize(chunks.size() * sizeof(chunks[0])));
+        out.close();
+        return bool(out);
+    }
+
+    bool writeChunk(const Record* records, const std::vector<SortKey>& keys, size_t first, size_t last,
+                    uint32_t chunk, unsigned threads, OutOfCore::ChunkInfo& info) {
+        std::vector<AABB> boxes;
+        boxes.reserve(last - first);
+        for (size_t i = first; i < last; i++)
+            boxes.push_back(bounds(records[keys[i].index]));
+
+        std::vector<FlatBVHNode> nodes;
+        std::vector<uint32_t> primIndices;
+        ParallelBVHBuilder(threads).build(boxes, nodes, primIndices);
+
+        // Leaf order, so leaves address their slots directly.
+        std::vector<CompiledScene::PrimitiveRef> refs;
+        std::vector<CompiledScene::SphereData> spheres;
+        std::vector<CompiledScene::QuadData> quads;
+        for (uint32_t prim : primIndices) {
+            const Record& record = records[keys[first + prim].index];
+            Vector3 first3(record.p[0], record.p[1], record.p[2]);
+            if (record.type == uint32_t(CompiledScene::PrimitiveType::Sphere)) {
+                refs.push_back({ CompiledScene::PrimitiveType::Sphere, uint32_t(spheres.size()) });
+                spheres.push_back({ first3, Vector3(0, 0, 0), record.p[3], record.material });
+            } else {
+                Vector3 u(record.p[3], record.p[4], record.p[5]);
+                Vector3 v(record.p[6], record.p[7], record.p[8]);
+                auto n = cross(u, v);
+                auto w = n / dot(n, n);
+                auto normal = unitVector(n);
+                refs.push_back({ CompiledScene::PrimitiveType::Quad, uint32_t(quads.size()) });
+                quads.push_back({ first3, cross(v, w), cross(w, u), normal, dot(normal, first3), record.material });
+            }
+        }
+
+        OutOfCore::ChunkHeader header = OutOfCore::makeChunkHeader(uint32_t(nodes.size()), uint32_t(spheres.size()),
+                                                                   uint32_t(quads.size()));
+        std::ofstream out(OutOfCore::chunkPath(dir, chunk), std::ios::binary | std::ios::trunc);
+        std::vector<char> padding(OutOfCore::alignment, 0);
+        uint64_t offset = 0;
+        auto section = [&](uint64_t at, const void* data, size_t bytes) {
+            out.write(padding.data(), std::streamsize(at - offset));
+            out.write(static_cast<const char*>(data), std::streamsize(bytes));
+            offset = at + bytes;
+        };
+        section(0, &header, sizeof(header));
+        section(header.refOffset, refs.data(), refs.size() * sizeof(refs[0]));
+        section(header.nodeOffset, nodes.data(), nodes.size() * sizeof(nodes[0]));
+        section(header.sphereOffset, spheres.data(), spheres.size() * sizeof(CompiledScene::SphereData));
+        section(header.quadOffset, quads.data(), quads.size() * sizeof(CompiledScene::QuadData));
+        out.close();
+        if (!out)
+            return false;
+
+        for (int a = 0; a < 3; a++) {
+            info.min[a] = nodes[0].min[a];
+            info.max[a] = nodes[0].max[a];
+        }
+        info.firstPrim = first;
+        info.primCount = last - first;
+        info.fileSize = header.fileSize;
+        return true;
+    }
+
+    uint32_t materialId(const shared_ptr<Material>& mat) {
+        auto found = materialIds.find(mat.get());
+        if (found != materialIds.end())
+            return found->second;
+        materialTable.push_back(mat);
+        uint32_t id = uint32_t(materialTable.size() - 1);
+        materialIds[mat.get()] = id;
+        return id;
+    }
+
+    std::string dir;
+    uint32_t primitivesPerChunk;
+    std::ofstream spool;
+    size_t count = 0;
+    std::vector< shared_ptr<Material> > materialTable;
+    std::unordered_map<const Material*, uint32_t> materialIds;
+};
+
+class OutOfCoreScene : public Hittable {
+public:
+    struct Stats {
+        size_t chunkCount;
+        size_t totalBytes;        // all chunk files
+        size_t residentChunks;
+        size_t residentBytes;     // mapped chunk files
+        size_t peakResidentBytes;
+        size_t pageIns;
+        size_t evictions;
+        size_t loadFailures;
+    };
+
+    // Opens a scene written by OutOfCoreWriter. `materials` is the writer's material table.
+    OutOfCoreScene(const std::string& dir, std::vector< shared_ptr<Material> > materials,
+                   size_t residencyBudget, unsigned threads = hardwareThreads())
+            : dir(dir), materials(std::move(materials)), budget(residencyBudget) {
+        std::ifstream in(OutOfCore::indexPath(dir), std::ios::binary);
+        OutOfCore::IndexHeader header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || std::memcmp(header.magic, "RTOOCI01", sizeof(header.magic)) != 0 || header.version != 1)
+            return;
+
+        std::vector<OutOfCore::ChunkInfo> infos(header.chunkCount);
+        if (header.chunkCount > 0
+            && !in.read(reinterpret_cast<char*>(infos.data()), std::streamsize(infos.size() * sizeof(infos[0]))))
+            return;
+
+        std::vector<AABB> boxes;
+        for (const auto& info : infos) {
+            std::unique_ptr<Chunk> chunk(new Chunk());
+            chunk->info = info;
+            chunks.push_back(std::move(chunk));
+            firstPrims.push_back(info.firstPrim);
+            totalBytes += info.fileSize;
+
+            AABB box(Vector3(info.min[0], info.min[1], info.min[2]), Vector3(info.max[0], info.max[1], info.max[2]));
+            boxes.push_back(box);
+            bbox = AABB(bbox, box);
+        }
+        if (!boxes.empty())
+            ParallelBVHBuilder(threads).build(boxes, topNodes, topPrims);
+        open = true;
+    }
+
+    bool isOpen() const { return open; }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const override {
+        return traverseFlatBVH(topNodes.empty() ? nullptr : topNodes.data(), topPrims.data(), r, ray_t,
+                               [&](uint32_t chunk, Interval& t) {
+            auto data = acquire(chunk);
+            if (!data)
+                return false;
+            uint64_t firstPrim = chunks[chunk]->info.firstPrim;
+            bool found = traverseFlatBVH(data->nodes, nullptr, r, t, [&](uint32_t slot, Interval& ct) {
+                const CompiledScene::PrimitiveRef& ref = data->refs[slot];
+                bool hitPrim = ref.type == CompiledScene::PrimitiveType::Sphere
+                         ? CompiledScene::hitSphere(data->spheres[ref.index], r, ct, outRec)
+                         : CompiledScene::hitQuad(data->quads[ref.index], r, ct, outRec);
+                if (!hitPrim)
+                    return false;
+                outRec.object = this;
+                outRec.primIndex = firstPrim + slot;
+                ct.max = outRec.t;
+                return true;
+            });
+            if (found) {
+                t.max = outRec.t;
+                PinnedChunk& pin = pinnedChunk();
+                pin.scene = this;
+                pin.index = chunk;
+                pin.data = data;
+            }
+            return found;
+        });
+    }
+
+    bool occluded(const Ray& r, double tMax) const override {
+        return occludedFlatBVH(topNodes.empty() ? nullptr : topNodes.data(), topPrims.data(), r, tMax,
+                               [&](uint32_t chunk) {
+            auto data = acquire(chunk);
+            if (!data)
+                return false;
+            return occludedFlatBVH(data->nodes, nullptr, r, tMax, [&](uint32_t slot) {
+                const CompiledScene::PrimitiveRef& ref = data->refs[slot];
+                if (ref.type == CompiledScene::PrimitiveType::Sphere)
+                    return CompiledScene::occludesSphere(data->spheres[ref.index], r, tMax);
+                HitRecord rec;
+                return CompiledScene::hitQuad(data->quads[ref.index], r, Interval(rayEpsilon, tMax), rec);
+            });
+        });
+    }
+
+    void finalize(const Ray& r, HitRecord& rec) const override {
+        // hit() pinned the chunk of its closest hit on this thread, so it is still mapped even if
+        // evicted since. Without the pin, acquire() maps it again.
+        uint32_t chunk = uint32_t(std::upper_bound(firstPrims.begin(), firstPrims.end(), rec.primIndex)
+                                  - firstPrims.begin() - 1);
+        PinnedChunk& pin = pinnedChunk();
+        shared_ptr<const ChunkData> data;
+        if (pin.scene == this && pin.index == chunk)
+            data.swap(pin.data);
+        else
+            data = acquire(chunk);
+        rec.p = r.at(rec.t);
+        if (!data) {
+            // The chunk failed to map again; the hit still needs a normal and a material.
+            rec.setFaceNormal(r, -unitVector(r.direction()));
+            rec.mat = missingMaterial();
+            return;
+        }
+        const CompiledScene::PrimitiveRef& ref = data->refs[rec.primIndex - chunks[chunk]->info.firstPrim];
+
+        if (ref.type == CompiledScene::PrimitiveType::Sphere) {
+            const CompiledScene::SphereData& s = data->spheres[ref.index];
+            Vector3 outwardNormal = (rec.p - s.center) / s.radius;
+            rec.setFaceNormal(r, outwardNormal);
+            Sphere::getSphereUV(outwardNormal, rec.u, rec.v);
+            rec.mat = materials[s.material];
+        } else {
+            const CompiledScene::QuadData& q = data->quads[ref.index];
+            rec.mat = materials[q.material];
+            rec.setFaceNormal(r, q.normal);
+        }
+    }
+
+    AABB boundingBox() const override { return bbox; }
+
+    Stats stats() const {
+        Stats s;
+        s.chunkCount = chunks.size();
+        s.totalBytes = totalBytes;
+        s.residentChunks = 0;
+        for (const auto& chunk : chunks)
+            s.residentChunks += chunk->resident.load() ? 1 : 0;
+        s.residentBytes = residentBytes.load();
+        s.peakResidentBytes = peakResidentBytes.load();
+        s.pageIns = pageIns.load();
+        s.evictions = evictions.load();
+        s.loadFailures = loadFailures.load();
+        return s;
+    }
+
+private:
+    // A mapped chunk. Traversals hold a shared_ptr, so an evicted chunk stays mapped until
+    // the last ray inside it is done.
+    struct ChunkData {
+        MappedFile file;
+        const CompiledScene::PrimitiveRef* refs;
+        const FlatBVHNode* nodes;
+        const CompiledScene::SphereData* spheres;
+        const CompiledScene::QuadData* quads;
+    };
+
+    struct Chunk {
+        OutOfCore::ChunkInfo info;
+        std::mutex mutex;
+        shared_ptr<const ChunkData> data;
+        std::atomic<bool> resident{ false };
+        std::atomic<uint64_t> lastUse{ 0 };
+    };
+
+    // The chunk of a thread's last closest hit, held from hit() until finalize().
+    struct PinnedChunk {
+        const OutOfCoreScene* scene = nullptr;
+        uint32_t index = 0;
+        shared_ptr<const ChunkData> data;
+    };
+
+    static PinnedChunk& pinnedChunk() {
+        static thread_local PinnedChunk pin;
+        return pin;
+    }
+
+    static shared_ptr<Material> missingMaterial() {
+        static shared_ptr<Material> material = make_shared<Lambertian>(Vector3(0.5, 0.5, 0.5));
+        return material;
+    }
+
+    shared_ptr<const ChunkData> acquire(uint32_t index) const {
+        Chunk& chunk = *chunks[index];
+        // The clock only ticks when the most recently used chunk changes, so a run of rays in
+        // one chunk does not keep writing shared counters.
+        if (chunk.lastUse.load(std::memory_order_relaxed) != useClock.load(std::memory_order_relaxed))
+            chunk.lastUse.store(++useClock, std::memory_order_relaxed);
+
+        shared_ptr<const ChunkData> data;
+        {
+            std::lock_guard<std::mutex> lock(chunk.mutex);
+            if (!chunk.data) {
+                chunk.data = load(index);
+                if (!chunk.data) {
+                    loadFailures++;
+                    return nullptr;
+                }
+                chunk.resident = true;
+                pageIns++;
+                size_t resident = residentBytes += chunk.info.fileSize;
+                size_t peak = peakResidentBytes.load();
+                while (resident > peak && !peakResidentBytes.compare_exchange_weak(peak, resident)) {}
+            }
+            data = chunk.data;
+        }
+
+        if (residentBytes.load() > budget)
+            evict(index);
+        return data;
+    }
+
+    shared_ptr<const ChunkData> load(uint32_t index) const {
+        auto data = make_shared<ChunkData>();
+        const OutOfCore::ChunkInfo& info = chunks[index]->info;
+        if (!data->file.open(OutOfCore::chunkPath(dir, index)) || data->file.size() != info.fileSize)
+            return nullptr;
+
+        OutOfCore::ChunkHeader header;
+        std::memcpy(&header, data->file.data(), sizeof(header));
+        OutOfCore::ChunkHeader expected = OutOfCore::makeChunkHeader(header.nodeCount, header.sphereCount,
+                                                                     header.quadCount);
+        if (std::memcmp(&header, &expected, sizeof(header)) != 0
+            || uint64_t(header.sphereCount) + header.quadCount != info.primCount || header.nodeCount == 0)
+            return nullptr;
+
+        const unsigned char* base = data->file.data();
+        data->refs = reinterpret_cast<const CompiledScene::PrimitiveRef*>(base + header.refOffset);
+        data->nodes = reinterpret_cast<const FlatBVHNode*>(base + header.nodeOffset);
+        data->spheres = reinterpret_cast<const CompiledScene::SphereData*>(base + header.sphereOffset);
+        data->quads = reinterpret_cast<const CompiledScene::QuadData*>(base + header.quadOffset);
+        return data;
+    }
+
+    // Unmaps least recently used chunks, other than `keep`, down to 7/8 of the budget, so one
+    // scan pays for several page-ins. Threads that waited here return if that already happened.
+    void evict(uint32_t keep) const {
+        std::lock_guard<std::mutex> evictLock(evictMutex);
+        if (residentBytes.load() <= budget)
+            return;
+
+        std::vector< std::pair<uint64_t, uint32_t> > victims;
+        for (uint32_t i = 0; i < chunks.size(); i++)
+            if (i != keep && chunks[i]->resident.load())
+                victims.push_back(std::make_pair(chunks[i]->lastUse.load(std::memory_order_relaxed), i));
+        std::sort(victims.begin(), victims.end());
+
+        const size_t lowWater = budget - budget / 8;
+        for (const auto& victim : victims) {
+            if (residentBytes.load() <= lowWater)
+                break;
+            Chunk& chunk = *chunks[victim.second];
+            std::lock_guard<std::mutex> lock(chunk.mutex);
+            if (!chunk.data)
+                continue;
+            chunk.data.reset();
+            chunk.resident = false;
+            residentBytes -= chunk.info.fileSize;
+            evictions++;
+        }
+    }
+
+    std::string dir;
+    std::vector< shared_ptr<Material> > materials;
+    size_t budget;
+    bool open = false;
+
+    std::vector< std::unique_ptr<Chunk> > chunks;
+    std::vector<uint64_t> firstPrims;
+    std::vector<FlatBVHNode> topNodes;
+    std::vector<uint32_t> topPrims;
+    size_t totalBytes = 0;
+    AABB bbox;
+
+    mutable std::mutex evictMutex;
+    mutable std::atomic<uint64_t> useClock{ 1 }; // ahead of every chunk's initial lastUse
+    mutable std::atomic<size_t> residentBytes{ 0 };
+    mutable std::atomic<size_t> peakResidentBytes{ 0 };
+    mutable std::atomic<size_t> pageIns{ 0 };
+    mutable std::atomic<size_t> evictions{ 0 };
+    mutable std::atomic<size_t> loadFailures{ 0 };
+};
+
+#endif
@@ -65,19 +65,20 @@ private:
 
 
 
+// Picks p0 with probability `weight`, p1 otherwise.
 class MixturePDF : public PDF {
 public:
-    MixturePDF(shared_ptr<PDF> p0, shared_ptr<PDF> p1) {
+    MixturePDF(shared_ptr<PDF> p0, shared_ptr<PDF> p1, double weight = 0.5) : weight(weight) {
         p[0] = p0;
         p[1] = p1;
     }
 
     double pdfValue(const Vector3& direction) const override {
-        return 0.5 * p[0]->pdfValue(direction) + 0.5 *p[1]->pdfValue(direction);
+        return weight * p[0]->pdfValue(direction) + (1 - weight) * p[1]->pdfValue(direction);
     }
 
     Vector3 generateRandomVector() const override {
-        if (randomDouble() < 0.5)
+        if (randomDouble() < weight)
             return p[0]->generateRandomVector();
         else
             return p[1]->generateRandomVector();
@@ -85,6 +86,7 @@ public:
 
 private:
     shared_ptr<PDF> p[2];
+    double weight;
 };
 
 #endif //RAY_TRACING_ADVANCED_PDF_H
@@ -0,0 +1,43 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+inline unsigned hardwareThreads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+// Splits [begin, end) into one contiguous chunk per thread and runs
+// `body(chunkBegin, chunkEnd, threadIndex)` on each. The calling thread takes the first chunk.
+template <typename Body>
+void parallelFor(size_t begin, size_t end, unsigned threads, Body&& body) {
+    size_t count = end > begin ? end - begin : 0;
+    threads = unsigned(std::max<size_t>(1, std::min<size_t>(threads, count)));
+
+    if (threads <= 1) {
+        body(begin, end, 0u);
+        return;
+    }
+
+    size_t chunk = (count + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned t = 1; t < threads; t++) {
+        size_t chunkBegin = begin + t * chunk;
+        size_t chunkEnd = std::min(end, chunkBegin + chunk);
+        if (chunkBegin >= chunkEnd)
+            break;
+        workers.emplace_back([&body, chunkBegin, chunkEnd, t]() { body(chunkBegin, chunkEnd, t); });
+    }
+
+    body(begin, std::min(end, begin + chunk), 0u);
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef PARALLEL_BVH_BUILDER_H
+#define PARALLEL_BVH_BUILDER_H
+
+#include "Utils.hpp"
+#include "FlatBVH.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Binned-SAH builder producing FlatBVHNodes. Every level partitions the primitive references in
+// place (O(N) per level, no sorting), nodes are taken from a pre-sized array with an atomic
+// counter, large subtrees are built on their own threads and the top levels bin in parallel.
+class ParallelBVHBuilder {
+public:
+    static const int binCount = 16;
+    static const uint32_t maxLeafSize = 4;
+
+    // Ranges of at most this many primitives always become one leaf. For leaves that are
+    // intersected as a SIMD batch, where testing 4 primitives costs about as much as testing 1.
+    uint32_t batchLeafSize = 1;
+
+    ParallelBVHBuilder(unsigned threads = hardwareThreads()) : threads(threads == 0 ? 1 : threads) {}
+
+    void build(const std::vector<AABB>& primBoxes,
+               std::vector<FlatBVHNode>& outNodes,
+               std::vector<uint32_t>& outPrimIndices) {
+        size_t n = primBoxes.size();
+        outPrimIndices.resize(n);
+        outNodes.clear();
+        if (n == 0)
+            return;
+
+        // Primitive references are partitioned by value, so every pass streams through memory.
+        refs.resize(n);
+        parallelFor(0, n, threads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++) {
+                const AABB& b = primBoxes[i];
+                PrimRef& ref = refs[i];
+                for (int a = 0; a < 3; a++) {
+                    ref.min[a] = b.axisInterval(a).min;
+                    ref.max[a] = b.axisInterval(a).max;
+                    ref.centroid[a] = 0.5 * (ref.min[a] + ref.max[a]);
+                }
+                ref.index = uint32_t(i);
+            }
+        });
+
+        outNodes.resize(2 * n - 1);
+        nodes = outNodes.data();
+        nextNode = 1;
+        activeThreads = 1;
+
+        buildNode(0, FlatBVHNode::invalidIndex, 0, n, 0);
+
+        outNodes.resize(nextNode.load());
+        parallelFor(0, n, threads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++)
+                outPrimIndices[i] = refs[i].index;
+        });
+        refs.clear();
+        refs.shrink_to_fit();
+    }
+
+    static shared_ptr<FlatBVH> build(const HittableList& list, unsigned threads = hardwareThreads()) {
+        std::vector<FlatBVHNode> nodes;
+        std::vector<uint32_t> primIndices;
+        ParallelBVHBuilder(threads).build(FlatBVHBuilder::primitiveBounds(list.objects), nodes, primIndices);
+        return make_shared<FlatBVH>(list.objects, std::move(nodes), std::move(primIndices));
+    }
+
+private:
+    struct Bounds {
+        double min[3] = { infinity, infinity, infinity };
+        double max[3] = { -infinity, -infinity, -infinity };
+
+        void grow(const double lo[3], const double hi[3]) {
+            for (int a = 0; a < 3; a++) {
+                min[a] = std::min(min[a], lo[a]);
+                max[a] = std::max(max[a], hi[a]);
+            }
+        }
+
+        void grow(const double p[3]) {
+            grow(p, p);
+        }
+
+        void grow(const Bounds& b) {
+            grow(b.min, b.max);
+        }
+
+        double halfArea() const {
+            double dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+            if (dx < 0 || dy < 0 || dz < 0)
+                return 0;
+            return dx * dy + dy * dz + dz * dx;
+        }
+    };
+
+    struct PrimRef {
+        double min[3];
+        double max[3];
+        double centroid[3];
+        uint32_t index;
+    };
+
+    struct Bin {
+        Bounds bounds;
+        uint32_t count = 0;
+    };
+
+    struct BinSet {
+        Bin bins[3][binCount];
+    };
+
+    // Subtrees and bin passes below these sizes stay on the current thread.
+    static const size_t parallelSubtreeSize = 4096;
+    static const size_t parallelBinningSize = 1 << 16;
+    static const size_t smallRangeSize = 16;
+
+    unsigned threads;
+    std::vector<PrimRef> refs;
+    FlatBVHNode* nodes = nullptr;
+    std::atomic<uint32_t> nextNode { 0 };
+    std::atomic<unsigned> activeThreads { 0 };
+
+    void rangeBounds(size_t start, size_t end, Bounds& bounds, Bounds& centroidBounds) const {
+        auto body = [&](size_t begin, size_t finish, Bounds& b, Bounds& c) {
+            for (size_t i = begin; i < finish; i++) {
+                b.grow(refs[i].min, refs[i].max);
+                c.grow(refs[i].centroid);
+            }
+        };
+
+        if (end - start < parallelBinningSize) {
+            body(start, end, bounds, centroidBounds);
+            return;
+        }
+
+        std::vector<Bounds> partial(threads), partialCentroids(threads);
+        parallelFor(start, end, threads, [&](size_t begin, size_t finish, unsigned t) {
+            body(begin, finish, partial[t], partialCentroids[t]);
+        });
+        for (unsigned t = 0; t < threads; t++) {
+            bounds.grow(partial[t]);
+            centroidBounds.grow(partialCentroids[t]);
+        }
+    }
+
+    void binRange(size_t start, size_t end, const Bounds& centroidBounds, BinSet& out) const {
+        double scale[3];
+        for (int a = 0; a < 3; a++) {
+            double extent = centroidBounds.max[a] - centroidBounds.min[a];
+            scale[a] = extent > 0 ? binCount / extent : 0;
+        }
+
+        auto body = [&](size_t begin, size_t finish, BinSet& set) {
+            for (size_t i = begin; i < finish; i++) {
+                const PrimRef& ref = refs[i];
+                for (int a = 0; a < 3; a++) {
+                    int b = std::min(binCount - 1, int((ref.centroid[a] - centroidBounds.min[a]) * scale[a]));
+                    set.bins[a][b].count++;
+                    set.bins[a][b].bounds.grow(ref.min, ref.max);
+                }
+            }
+        };
+
+        if (end - start < parallelBinningSize) {
+            body(start, end, out);
+            return;
+        }
+
+        std::vector<BinSet> partial(threads);
+        parallelFor(start, end, threads, [&](size_t begin, size_t finish, unsigned t) {
+            body(begin, finish, partial[t]);
+        });
+        for (unsigned t = 0; t < threads; t++) {
+            for (int a = 0; a < 3; a++) {
+                for (int b = 0; b < binCount; b++) {
+                    out.bins[a][b].count += partial[t].bins[a][b].count;
+                    out.bins[a][b].bounds.grow(partial[t].bins[a][b].bounds);
+                }
+            }
+        }
+    }
+
+    void makeLeaf(FlatBVHNode& node, size_t start, size_t end) {
+        node.left = uint32_t(start);
+        node.right = 0;
+        node.count = uint32_t(end - start);
+    }
+
+    // Returns the split position, or `end` when a leaf is cheaper than any split.
+    size_t splitBinned(const Bounds& bounds, const Bounds& centroidBounds, size_t start, size_t end) {
+        size_t count = end - start;
+        BinSet binSet;
+        binRange(start, end, centroidBounds, binSet);
+
+        // Pick the cheapest bin boundary over all three axes.
+        double bestCost = infinity;
+        int bestAxis = -1;
+        int bestSplit = 0;
+        for (int a = 0; a < 3; a++) {
+            if (centroidBounds.max[a] <= centroidBounds.min[a])
+                continue;
+
+            double rightArea[binCount];
+            uint32_t rightCount[binCount];
+            Bounds acc;
+            uint32_t accCount = 0;
+            for (int b = binCount - 1; b > 0; b--) {
+                acc.grow(binSet.bins[a][b].bounds);
+                accCount += binSet.bins[a][b].count;
+                rightArea[b] = acc.halfArea();
+                rightCount[b] = accCount;
+            }
+
+            Bounds left;
+            uint32_t leftCount = 0;
+            for (int b = 1; b < binCount; b++) {
+                left.grow(binSet.bins[a][b - 1].bounds);
+                leftCount += binSet.bins[a][b - 1].count;
+                if (leftCount == 0 || rightCount[b] == 0)
+                    continue;
+                double cost = leftCount * left.halfArea() + rightCount[b] * rightArea[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = a;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        if (count <= maxLeafSize && (bestAxis < 0 || !cheaperThanLeaf(bestCost, bounds, count)))
+            return end;
+
+        size_t mid = start + count / 2;
+        if (bestAxis >= 0) {
+            double binScale = binCount / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+            double axisMin = centroidBounds.min[bestAxis];
+            auto split = std::partition(refs.begin() + start, refs.begin() + end, [&](const PrimRef& ref) {
+                int b = std::min(binCount - 1, int((ref.centroid[bestAxis] - axisMin) * binScale));
+                return b < bestSplit;
+            });
+            mid = size_t(split - refs.begin());
+        }
+        // All centroids coincide: any split is as good as another.
+        if (mid == start || mid == end)
+            mid = start + count / 2;
+        return mid;
+    }
+
+    // Exact SAH sweep over the sorted centroids; cheaper than binning for a handful of primitives.
+    size_t splitSmallRange(const Bounds& bounds, size_t start, size_t end) {
+        size_t count = end - start;
+        PrimRef sorted[3][smallRangeSize];
+        double rightArea[smallRangeSize];
+
+        double bestCost = infinity;
+        int bestAxis = 0;
+        size_t bestSplit = count / 2;
+        for (int a = 0; a < 3; a++) {
+            std::copy(refs.begin() + start, refs.begin() + end, sorted[a]);
+            std::sort(sorted[a], sorted[a] + count, [a](const PrimRef& p, const PrimRef& q) {
+                return p.centroid[a] < q.centroid[a];
+            });
+
+            Bounds acc;
+            for (size_t i = count - 1; i > 0; i--) {
+                acc.grow(sorted[a][i].min, sorted[a][i].max);
+                rightArea[i] = acc.halfArea();
+            }
+
+            Bounds left;
+            for (size_t i = 1; i < count; i++) {
+                left.grow(sorted[a][i - 1].min, sorted[a][i - 1].max);
+                double cost = i * left.halfArea() + (count - i) * rightArea[i];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = a;
+                    bestSplit = i;
+                }
+            }
+        }
+
+        if (count <= maxLeafSize && !cheaperThanLeaf(bestCost, bounds, count))
+            return end;
+
+        std::copy(sorted[bestAxis], sorted[bestAxis] + count, refs.begin() + start);
+        return start + bestSplit;
+    }
+
+    // Object median along the widest centroid axis. Each level halves the range, so below
+    // medianSplitDepth a subtree is at most 32 levels deep whatever the SAH would have done.
+    size_t splitMedian(const Bounds& centroidBounds, size_t start, size_t end) {
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (centroidBounds.max[a] - centroidBounds.min[a] > centroidBounds.max[axis] - centroidBounds.min[axis])
+                axis = a;
+        size_t mid = start + (end - start) / 2;
+        std::nth_element(refs.begin() + start, refs.begin() + mid, refs.begin() + end,
+                         [axis](const PrimRef& p, const PrimRef& q) { return p.centroid[axis] < q.centroid[axis]; });
+        return mid;
+    }
+
+    static bool cheaperThanLeaf(double splitCost, const Bounds& bounds, size_t count) {
+        double parentArea = bounds.halfArea();
+        return parentArea > 0 && 1.0 + splitCost / parentArea < double(count);
+    }
+
+    // SAH splits can peel off one primitive per level; past this depth ranges are halved.
+    static const int medianSplitDepth = maxFlatBVHDepth - 32;
+
+    void buildNode(uint32_t nodeIndex, uint32_t parent, size_t start, size_t end, int depth) {
+        FlatBVHNode& node = nodes[nodeIndex];
+        size_t count = end - start;
+
+        Bounds bounds, centroidBounds;
+        rangeBounds(start, end, bounds, centroidBounds);
+        node.parent = parent;
+        for (int a = 0; a < 3; a++) {
+            node.min[a] = bounds.min[a];
+            node.max[a] = bounds.max[a];
+        }
+
+        if (count <= batchLeafSize || depth >= maxFlatBVHDepth) {
+            makeLeaf(node, start, end);
+            return;
+        }
+
+        size_t mid = depth >= medianSplitDepth ? splitMedian(centroidBounds, start, end)
+                     : count <= smallRangeSize ? splitSmallRange(bounds, start, end)
+                                               : splitBinned(bounds, centroidBounds, start, end);
+        if (mid == end) {
+            makeLeaf(node, start, end);
+            return;
+        }
+
+        uint32_t leftIndex = nextNode.fetch_add(2);
+        uint32_t rightIndex = leftIndex + 1;
+        node.left = leftIndex;
+        node.right = rightIndex;
+        node.count = 0;
+
+        if (count >= parallelSubtreeSize && tryAcquireThread()) {
+            std::thread worker([this, leftIndex, nodeIndex, start, mid, depth]() {
+                buildNode(leftIndex, nodeIndex, start, mid, depth + 1);
+            });
+            buildNode(rightIndex, nodeIndex, mid, end, depth + 1);
+            worker.join();
+            activeThreads--;
+        } else {
+            buildNode(leftIndex, nodeIndex, start, mid, depth + 1);
+            buildNode(rightIndex, nodeIndex, mid, end, depth + 1);
+        }
+    }
+
+    bool tryAcquireThread() {
+        unsigned current = activeThreads.load();
+        while (current < threads) {
+            if (activeThreads.compare_exchange_weak(current, current + 1))
+                return true;
+        }
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,352 @@
+#ifndef PATH_GUIDE_H
+#define PATH_GUIDE_H
+
+#include "Utils.hpp"
+#include "AABB.hpp"
+#include "PDF.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// A distribution over directions as a quadtree on the square [0, 1)^2, which maps to the unit
+// sphere by (u, v) -> (z = 2u - 1, phi = 2 pi v). The map preserves area, so a density on the
+// square is 4 pi times the density on the sphere. Every node holds the energy of its four
+// quadrants; a quadrant without a child node is a leaf with its energy spread evenly.
+class DirectionalTree {
+public:
+    struct Node {
+        uint32_t children[4] = { 0, 0, 0, 0 }; // 0: the quadrant is a leaf
+        double sums[4] = { 0, 0, 0, 0 };
+    };
+
+    DirectionalTree() : nodes(1) {}
+
+    double total() const {
+        const Node& root = nodes[0];
+        return root.sums[0] + root.sums[1] + root.sums[2] + root.sums[3];
+    }
+
+    size_t nodeCount() const { return nodes.size(); }
+
+    // Adds `value` to every quadrant on the way down to the leaf holding `dir`.
+    void add(const Vector3& dir, double value) {
+        double u, v;
+        toSquare(dir, u, v);
+        uint32_t node = 0;
+        while (true) {
+            int q = quadrant(u, v);
+            nodes[node].sums[q] += value;
+            if (nodes[node].children[q] == 0)
+                return;
+            node = nodes[node].children[q];
+        }
+    }
+
+    Vector3 sample() const {
+        double x = 0, y = 0, size = 1;
+        double r = randomDouble();
+        uint32_t node = 0;
+        while (true) {
+            const Node& n = nodes[node];
+            double sum = n.sums[0] + n.sums[1] + n.sums[2] + n.sums[3];
+            if (sum <= 0)
+                return fromSquare(x + size * randomDouble(), y + size * randomDouble());
+
+            int q = 0;
+            r *= sum;
+            while (q < 3 && (n.sums[q] <= 0 || r >= n.sums[q])) {
+                r -= n.sums[q];
+                q++;
+            }
+            r = n.sums[q] > 0 ? std::min(std::max(r / n.sums[q], 0.0), 1 - 1e-12) : randomDouble();
+            size *= 0.5;
+            x += size * (q & 1);
+            y += size * (q >> 1);
+            if (n.children[q] == 0)
+                return fromSquare(x + size * randomDouble(), y + size * randomDouble());
+            node = n.children[q];
+        }
+    }
+
+    // Density over the sphere.
+    double pdf(const Vector3& dir) const {
+        double u, v;
+        toSquare(dir, u, v);
+        double density = 1;
+        uint32_t node = 0;
+        while (true) {
+            const Node& n = nodes[node];
+            double sum = n.sums[0] + n.sums[1] + n.sums[2] + n.sums[3];
+            if (sum <= 0)
+                break;
+            int q = quadrant(u, v);
+            density *= 4 * n.sums[q] / sum;
+            if (n.children[q] == 0 || density == 0)
+                break;
+            node = n.children[q];
+        }
+        return density / (4 * pi);
+    }
+
+    // An empty tree whose leaves each held at most `threshold` of the energy here, splitting
+    // leaves above it (their energy taken as even) down to `maxDepth` levels.
+    DirectionalTree refined(double threshold, int maxDepth) const {
+        struct Item {
+            int64_t from; // node of this tree, or -1 for part of a leaf
+            double energy;
+            uint32_t to;
+            int depth;
+        };
+
+        DirectionalTree out;
+        double limit = threshold * total();
+        if (limit <= 0)
+            return out;
+
+        std::vector<Item> stack(1, Item{ 0, total(), 0, 1 });
+        while (!stack.empty()) {
+            Item item = stack.back();
+            stack.pop_back();
+            for (int q = 0; q < 4; q++) {
+                double energy = item.from >= 0 ? nodes[item.from].sums[q] : item.energy / 4;
+                if (energy <= limit || item.depth >= maxDepth)
+                    continue;
+                int64_t child = item.from >= 0 && nodes[item.from].children[q] ? int64_t(nodes[item.from].children[q]) : -1;
+                uint32_t index = uint32_t(out.nodes.size());
+                out.nodes.push_back(Node());
+                out.nodes[item.to].children[q] = index;
+                stack.push_back(Item{ child, energy, index, item.depth + 1 });
+            }
+        }
+        return out;
+    }
+
+    void clear() {
+        for (Node& n : nodes)
+            std::fill(n.sums, n.sums + 4, 0.0);
+    }
+
+private:
+    std::vector<Node> nodes;
+
+    // Quadrant of (u, v) in the unit square, which is rescaled to the quadrant's square.
+    static int quadrant(double& u, double& v) {
+        int qx = u >= 0.5, qy = v >= 0.5;
+        u = std::min(2 * u - qx, 1 - 1e-12);
+        v = std::min(2 * v - qy, 1 - 1e-12);
+        return qx + 2 * qy;
+    }
+
+    static void toSquare(const Vector3& dir, double& u, double& v) {
+        Vector3 d = unitVector(dir);
+        u = std::min(std::max(0.5 * (d.z() + 1), 0.0), 1 - 1e-12);
+        double phi = atan2(d.y(), d.x());
+        if (phi < 0)
+            phi += 2 * pi;
+        v = std::min(std::max(phi / (2 * pi), 0.0), 1 - 1e-12);
+    }
+
+    static Vector3 fromSquare(double u, double v) {
+        double z = 2 * u - 1;
+        double r = sqrt(std::max(0.0, 1 - z * z));
+        double phi = 2 * pi * v;
+        return Vector3(r * cos(phi), r * sin(phi), z);
+    }
+};
+
+// Path guiding after Mueller et al., "Practical Path Guiding": a binary tree over the scene
+// bounds, splitting space at midpoints along x, y, z in turn, whose leaves each learn the
+// incident radiance as a DirectionalTree. Training runs in iterations: paths traced during one
+// record into the `building` trees, and refine() turns those into the `sampling` trees of the
+// next, subdividing directional leaves that caught more than energyThreshold of a region's
+// energy and splitting regions that recorded more than spatialThreshold * sqrt(2^iteration)
+// samples. Doubling the samples per iteration keeps the trees about as noisy each time.
+//
+// Each region also learns how often to sample the guide rather than the unguided mixture
+// (after Mueller, "Practical Path Guiding in Production"): the fraction is a sigmoid of a
+// parameter stepped by Adam down the gradient of the KL divergence between the product of
+// BSDF and incident radiance and the combined density.
+class PathGuide {
+public:
+    class Region {
+    public:
+        DirectionalTree sampling, building;
+
+        bool trained() const { return sampling.total() > 0; }
+
+        // Probability of sampling the guide.
+        double guideFraction() const { return fraction.load(std::memory_order_relaxed); }
+
+        // A path left this region in `dir`, picked with density `pdf`, and brought back
+        // `radiance` (luminance). `product` is the luminance of BSDF * cosine * radiance, and
+        // guidePdf and otherPdf the densities of the two strategies mixed.
+        void record(const Vector3& dir, double radiance, double pdf, double product, double guidePdf,
+                    double otherPdf, bool learnFraction) {
+            if (!(pdf > 0) || !std::isfinite(radiance))
+                return;
+            std::lock_guard<std::mutex> lock(mutex);
+            building.add(dir, radiance / pdf);
+            samples++;
+            if (learnFraction && std::isfinite(product))
+                stepFraction(product, pdf, guidePdf, otherPdf);
+        }
+
+    private:
+        friend class PathGuide;
+
+        std::mutex mutex;
+        size_t samples = 0;
+        std::atomic<double> fraction{ 0.5 };
+        double theta = 0, m = 0, v = 0;
+        int steps = 0;
+
+        void stepFraction(double product, double pdf, double guidePdf, double otherPdf) {
+            const double learningRate = 0.01, beta1 = 0.9, beta2 = 0.999, regularization = 0.01;
+            // Either strategy is always picked at least this often, so neither starves.
+            const double minFraction = 0.1;
+            double alpha = fraction.load(std::memory_order_relaxed);
+            double gradient = -product / pdf * (guidePdf - otherPdf) / pdf * alpha * (1 - alpha) +
+                              regularization * theta;
+            steps++;
+            m = beta1 * m + (1 - beta1) * gradient;
+            v = beta2 * v + (1 - beta2) * gradient * gradient;
+            double mHat = m / (1 - pow(beta1, steps)), vHat = v / (1 - pow(beta2, steps));
+            theta = std::min(std::max(theta - learningRate * mHat / (sqrt(vHat) + 1e-8), -20.0), 20.0);
+            fraction.store(std::min(std::max(1 / (1 + exp(-theta)), minFraction), 1 - minFraction),
+                           std::memory_order_relaxed);
+        }
+
+        void copyFrom(const Region& other) {
+            sampling = other.sampling;
+            building = other.building;
+            samples = other.samples;
+            fraction.store(other.fraction.load());
+            theta = other.theta;
+            m = other.m;
+            v = other.v;
+            steps = other.steps;
+        }
+    };
+
+    double energyThreshold = 0.01;
+    int maxDirectionalDepth = 20;
+    double spatialThreshold = 500;
+    int maxSpatialDepth = 24;
+    // While set, rendering records into the building trees and learns the fractions.
+    bool learning = true;
+
+    explicit PathGuide(const AABB& bounds) : bounds(bounds), nodes(1) {
+        regions.push_back(std::unique_ptr<Region>(new Region()));
+    }
+
+    // The leaf region holding `p`. Regions stay put until the next refine().
+    Region* region(const Vector3& p) const {
+        uint32_t node = 0;
+        double lo[3] = { bounds.x.min, bounds.y.min, bounds.z.min };
+        double hi[3] = { bounds.x.max, bounds.y.max, bounds.z.max };
+        while (!nodes[node].leaf) {
+            int axis = nodes[node].axis;
+            double mid = 0.5 * (lo[axis] + hi[axis]);
+            if (p[axis] < mid) {
+                hi[axis] = mid;
+                node = nodes[node].children[0];
+            } else {
+                lo[axis] = mid;
+                node = nodes[node].children[1];
+            }
+        }
+        return regions[nodes[node].region].get();
+    }
+
+    // Ends a training iteration. Not safe while rendering.
+    void refine() {
+        double splitAt = spatialThreshold * sqrt(pow(2.0, iteration));
+        std::vector<std::pair<uint32_t, double>> split;
+        for (size_t n = 0; n < nodes.size(); n++) {
+            if (!nodes[n].leaf)
+                continue;
+            Region& r = *regions[nodes[n].region];
+            if (r.building.total() > 0)
+                r.sampling = r.building;
+            r.building = r.sampling.refined(energyThreshold, maxDirectionalDepth);
+            split.push_back(std::make_pair(uint32_t(n), double(r.samples)));
+            r.samples = 0;
+        }
+        // Halves are taken to have half the samples each, and split again while above.
+        while (!split.empty()) {
+            uint32_t n = split.back().first;
+            double samples = split.back().second;
+            split.pop_back();
+            if (samples <= splitAt || nodes[n].depth >= maxSpatialDepth)
+                continue;
+            uint32_t first = divide(n);
+            split.push_back(std::make_pair(first, samples / 2));
+            split.push_back(std::make_pair(first + 1, samples / 2));
+        }
+        iteration++;
+    }
+
+    int iterations() const { return iteration; }
+    size_t regionCount() const { return regions.size(); }
+
+private:
+    struct Node {
+        bool leaf = true;
+        int axis = 0;
+        int depth = 0;
+        uint32_t children[2] = { 0, 0 };
+        uint32_t region = 0;
+    };
+
+    AABB bounds;
+    std::vector<Node> nodes;
+    std::vector<std::unique_ptr<Region>> regions;
+    int iteration = 0;
+
+    // Both halves start from the region's trees and fraction. Returns the first half's node.
+    uint32_t divide(uint32_t n) {
+        uint32_t first = uint32_t(nodes.size());
+        uint32_t region = nodes[n].region;
+        for (int c = 0; c < 2; c++) {
+            Node child;
+            child.axis = (nodes[n].axis + 1) % 3;
+            child.depth = nodes[n].depth + 1;
+            if (c == 0) {
+                child.region = region;
+            } else {
+                child.region = uint32_t(regions.size());
+                regions.push_back(std::unique_ptr<Region>(new Region()));
+                regions.back()->copyFrom(*regions[region]);
+            }
+            nodes.push_back(child);
+        }
+        nodes[n].leaf = false;
+        nodes[n].children[0] = first;
+        nodes[n].children[1] = first + 1;
+        return first;
+    }
+};
+
+// Samples a region's learned incident radiance.
+class GuidePDF : public PDF {
+public:
+    explicit GuidePDF(const DirectionalTree& tree) : tree(tree) {}
+
+    double pdfValue(const Vector3& dir) const override {
+        return tree.pdf(dir);
+    }
+
+    Vector3 generateRandomVector() const override {
+        return tree.sample();
+    }
+
+private:
+    const DirectionalTree& tree;
+};
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include "Utils.hpp"
+#include "Denoiser.hpp"
+#include "Hittable.hpp"
+#include "HittableList.hpp"
+#include "Material.hpp"
+#include "ONB.hpp"
+#include "Parallel.hpp"
+#include "Quad.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Caustic photons: light that reached a diffuse surface through one or more specular bounces
+// (Dielectric, Metal), which path tracing finds only when a diffuse bounce happens to refract
+// its way onto a light. Photons leave the Quad, Triangle and Disk emitters of a lights list,
+// cosine-distributed from the front face, and are stored where they first land on a diffuse
+// surface after a specular bounce; all others are dropped, as path tracing handles them well.
+//
+// Each tracePass() replaces the photons with a new set and shrinks the lookup radius as in
+// progressive photon mapping (Knaus and Zwicker, "Progressive Photon Mapping: A Probabilistic
+// Approach"): r_{i+1}^2 = r_i^2 (i + alpha) / (i + 1). Averaging the estimates of successive
+// passes converges to the unbiased result. Photons are sorted by cell of a hashed grid with
+// cells twice the radius, so a lookup reads the eight cells around the point.
+class PhotonMap {
+public:
+    size_t photonsPerPass = 20000;  // emitted
+    double initialRadius = 0;       // 0: 1/200 of the scene's bounding-box diagonal
+    double alpha = 2.0 / 3.0;
+    int maxBounces = 16;
+    unsigned threads = hardwareThreads();
+
+    void tracePass(const Hittable& world, const Hittable& lights, uint64_t seed = 0) {
+        if (pass == 0) {
+            AABB box = world.boundingBox();
+            Vector3 diagonal(box.x.size(), box.y.size(), box.z.size());
+            currentRadius = initialRadius > 0 ? initialRadius : diagonal.length() / 200;
+        } else {
+            currentRadius *= sqrt((pass + alpha) / (pass + 1));
+        }
+        pass++;
+
+        emitters.clear();
+        materials.clear();
+        findEmitters(world, lights);
+        double totalPower = 0;
+        for (const Emitter& e : emitters)
+            totalPower += e.power;
+
+        const size_t chunkSize = 1024;
+        size_t chunkCount = totalPower > 0 ? (photonsPerPass + chunkSize - 1) / chunkSize : 0;
+        std::vector<std::vector<Photon>> chunks(chunkCount);
+        parallelFor(0, chunkCount, threads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t c = begin; c < end; c++) {
+                seedRandom(mixBits(seed ^ mixBits(uint64_t(pass) << 32 | c)));
+                size_t count = std::min(chunkSize, photonsPerPass - c * chunkSize);
+                for (size_t i = 0; i < count; i++)
+                    tracePhoton(world, totalPower, chunks[c]);
+            }
+        });
+
+        std::vector<Photon> traced;
+        for (const auto& chunk : chunks)
+            traced.insert(traced.end(), chunk.begin(), chunk.end());
+        build(traced);
+    }
+
+    // Irradiance from caustic photons arriving at `p` on the side `normal` faces. If
+    // `perLight` is given, it gets the part from each of lightMaterials(), in order.
+    Vector3 irradiance(const Vector3& p, const Vector3& normal, std::vector<Vector3>* perLight = nullptr) const {
+        if (perLight)
+            perLight->assign(materials.size(), Vector3(0, 0, 0));
+        if (photons.empty())
+            return Vector3(0, 0, 0);
+
+        double r2 = currentRadius * currentRadius;
+        int64_t lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = cellOf(p[a] - currentRadius);
+            hi[a] = cellOf(p[a] + currentRadius);
+        }
+
+        double sum[3] = { 0, 0, 0 };
+        uint32_t visited[27];
+        int visitedCount = 0;
+        for (int64_t x = lo[0]; x <= hi[0]; x++)
+            for (int64_t y = lo[1]; y <= hi[1]; y++)
+                for (int64_t z = lo[2]; z <= hi[2]; z++) {
+                    uint32_t h = hash(x, y, z);
+                    // Distinct cells can share a bucket; read each bucket once.
+                    if (std::find(visited, visited + visitedCount, h) != visited + visitedCount)
+                        continue;
+                    visited[visitedCount++] = h;
+                    for (uint32_t i = cellStart[h]; i < cellStart[h + 1]; i++) {
+                        const Photon& photon = photons[i];
+                        double dx = photon.position[0] - p[0], dy = photon.position[1] - p[1],
+                               dz = photon.position[2] - p[2];
+                        if (dx * dx + dy * dy + dz * dz > r2)
+                            continue;
+                        if (photon.direction[0] * normal[0] + photon.direction[1] * normal[1] +
+                            photon.direction[2] * normal[2] >= 0)
+                            continue;
+                        for (int k = 0; k < 3; k++)
+                            sum[k] += photon.power[k];
+                        if (perLight)
+                            (*perLight)[photon.material] += Vector3(photon.power[0], photon.power[1], photon.power[2]);
+                    }
+                }
+        double area = pi * r2;
+        if (perLight)
+            for (Vector3& part : *perLight)
+                part = part / area;
+        return Vector3(sum[0] / area, sum[1] / area, sum[2] / area);
+    }
+
+    // The emitting materials of the lights found by the last pass.
+    const std::vector<const Material*>& lightMaterials() const { return materials; }
+
+    double radius() const { return currentRadius; }
+    size_t storedPhotons() const { return photons.size(); }
+    int passes() const { return pass; }
+
+private:
+    struct Photon {
+        float position[3];
+        float direction[3]; // of travel, arriving
+        float power[3];
+        uint32_t material; // index into materials
+    };
+
+    struct Emitter {
+        Vector3 Q, u, v, normal;
+        double area;
+        double power; // luminance of the flux, for picking emitters
+        void (*sample)(double r1, double r2, double& a, double& b);
+        uint32_t material;
+    };
+
+    int pass = 0;
+    double currentRadius = 0;
+    std::vector<Emitter> emitters;
+    std::vector<const Material*> materials;
+    std::vector<Photon> photons;      // sorted by bucket
+    std::vector<uint32_t> cellStart;  // photons of bucket h are [cellStart[h], cellStart[h + 1])
+    uint32_t mask = 0;
+
+    int64_t cellOf(double coordinate) const {
+        return int64_t(floor(coordinate / (2 * currentRadius)));
+    }
+
+    uint32_t hash(int64_t x, int64_t y, int64_t z) const {
+        uint64_t h = uint64_t(x) * 73856093u ^ uint64_t(y) * 19349663u ^ uint64_t(z) * 83492791u;
+        return uint32_t(mixBits(h)) & mask;
+    }
+
+    void build(const std::vector<Photon>& traced) {
+        uint32_t buckets = 1;
+        while (buckets < traced.size())
+            buckets <<= 1;
+        mask = buckets - 1;
+
+        std::vector<uint32_t> bucket(traced.size());
+        cellStart.assign(size_t(buckets) + 1, 0);
+        for (size_t i = 0; i < traced.size(); i++) {
+            const Photon& photon = traced[i];
+            bucket[i] = hash(cellOf(photon.position[0]), cellOf(photon.position[1]), cellOf(photon.position[2]));
+            cellStart[bucket[i] + 1]++;
+        }
+        for (uint32_t h = 0; h < buckets; h++)
+            cellStart[h + 1] += cellStart[h];
+
+        photons.resize(traced.size());
+        std::vector<uint32_t> next(cellStart.begin(), cellStart.end() - 1);
+        for (size_t i = 0; i < traced.size(); i++)
+            photons[next[bucket[i]]++] = traced[i];
+    }
+
+    void findEmitters(const Hittable& world, const Hittable& object) {
+        if (auto list = dynamic_cast<const HittableList*>(&object)) {
+            for (const auto& child : list->objects)
+                findEmitters(world, *child);
+            return;
+        }
+        addEmitter<ParallelogramShape>(world, object) || addEmitter<TriangleShape>(world, object) ||
+            addEmitter<DiskShape>(world, object);
+    }
+
+    template <typename Shape>
+    bool addEmitter(const Hittable& world, const Hittable& object) {
+        auto shape = dynamic_cast<const PlanarShape<Shape>*>(&object);
+        if (!shape)
+            return false;
+        Emitter e;
+        e.Q = shape->corner();
+        e.u = shape->edgeU();
+        e.v = shape->edgeV();
+        e.normal = unitVector(cross(e.u, e.v));
+        e.area = cross(e.u, e.v).length() * Shape::areaFactor();
+        e.sample = &Shape::sample;
+        double a, b;
+        Shape::sample(0.5, 0.5, a, b);
+        const Material* material = nullptr;
+        e.power = luminance(emission(world, e.Q + a * e.u + b * e.v, e.normal, &material)) * pi * e.area;
+        if (e.power <= 0)
+            return true;
+        e.material = uint32_t(std::find(materials.begin(), materials.end(), material) - materials.begin());
+        if (e.material == materials.size())
+            materials.push_back(material);
+        emitters.push_back(e);
+        return true;
+    }
+
+    // What the world emits from `p` towards `normal`, and from which material. The lights list
+    // only has the shapes; the emitting material is on the matching object of the world.
+    static Vector3 emission(const Hittable& world, const Vector3& p, const Vector3& normal,
+                            const Material** material = nullptr) {
+        Ray probe(p + 1e-4 * normal, -normal);
+        HitRecord rec;
+        if (!world.hit(probe, Interval(0, 1e-3), rec))
+            return Vector3(0, 0, 0);
+        rec.finalize(probe);
+        if (material)
+            *material = rec.mat.get();
+        return rec.mat->emitted(probe, rec, rec.u, rec.v, rec.p);
+    }
+
+    void tracePhoton(const Hittable& world, double totalPower, std::vector<Photon>& out) const {
+        double pick = randomDouble() * totalPower;
+        size_t k = 0;
+        while (k + 1 < emitters.size() && pick >= emitters[k].power) {
+            pick -= emitters[k].power;
+            k++;
+        }
+        const Emitter& e = emitters[k];
+
+        double a, b;
+        e.sample(randomDouble(), randomDouble(), a, b);
+        Vector3 origin = e.Q + a * e.u + b * e.v;
+        Vector3 radiance = emission(world, origin, e.normal);
+        if (radiance.x() <= 0 && radiance.y() <= 0 && radiance.z() <= 0)
+            return;
+
+        // Cosine-distributed directions from a uniform point carry radiance * pi * area, over the
+        // chance of picking this emitter and the photon count.
+        Vector3 power = radiance * (pi * e.area * totalPower / (e.power * photonsPerPass));
+        ONB uvw;
+        uvw.buildFromW(e.normal);
+        Ray ray(origin, uvw.local(randomCosineDirection()));
+
+        bool specular = false;
+        for (int bounce = 0; bounce < maxBounces; bounce++) {
+            HitRecord rec;
+            if (!world.hit(ray, Interval(0.001, infinity), rec))
+                return;
+            rec.finalize(ray);
+
+            ScatterRecord srec;
+            if (!rec.mat->scatter(ray, rec, srec))
+                return;
+            if (!srec.isSkipPDF) {
+                if (specular) {
+                    Vector3 dir = unitVector(ray.direction());
+                    Photon photon;
+                    for (int i = 0; i < 3; i++) {
+                        photon.position[i] = float(rec.p[i]);
+                        photon.direction[i] = float(dir[i]);
+                        photon.power[i] = float(power[i]);
+                    }
+                    photon.material = e.material;
+                    out.push_back(photon);
+                }
+                return;
+            }
+            specular = true;
+            power = power * srec.attenuation;
+            if (power.x() <= 0 && power.y() <= 0 && power.z() <= 0)
+                return;
+            ray = srec.skipPDFRay;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef PROGRESSIVE_RENDERER_H
+#define PROGRESSIVE_RENDERER_H
+
+#include "Accumulation.hpp"
+#include "Camera.hpp"
+#include "Denoiser.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Renders in passes over the image, or the camera's crop window, until a wall-clock budget
+// runs out or the image is clean enough. The first pass takes one sample per pixel and always
+// completes, so every pixel has a value; later passes take samplesPerPass. Tiles go in
+// tileOrder: shuffled by default, so that a pass cut short by the deadline spreads its samples
+// over the image, or center-out or by an importance map to refine the region of interest
+// first. Tiles that have started finish, so the budget is overrun by at most one tile per
+// thread.
+//
+// Noise is estimated from two half images, one from the even passes and one from the odd:
+// with n and m samples in a pixel's halves a and b, the variance of the combined mean is
+// (a - b)^2 nm / (n + m)^2.
+class ProgressiveRenderer {
+public:
+    double timeBudget = 10;   // seconds
+    double noiseTarget = 0;   // relative RMS noise to stop at; 0 uses the whole budget
+    int samplesPerPass = 4;
+    int maxSamples = 1 << 16; // per pixel
+    int tileSize = 16;
+    unsigned threads = hardwareThreads();
+    uint64_t seed = 0;
+    TileOrder tileOrder = TileOrder::Shuffled;
+    std::vector<double> importance; // per image pixel, for TileOrder::Importance
+
+    struct Result {
+        AccumulationBuffer image;
+        int passes = 0;         // passes started; the last may have been cut short
+        uint32_t minSamples = 0;
+        uint32_t maxSamples = 0;
+        double meanSamples = 0;
+        double noise = infinity; // relative RMS noise estimate, infinite before the second pass
+        double seconds = 0;
+        bool reachedNoiseTarget = false;
+    };
+
+    Result render(const Camera& camera, const Hittable& world, const Hittable& lights) const {
+        typedef std::chrono::steady_clock Clock;
+        auto start = Clock::now();
+        auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timeBudget));
+
+        Camera cam(camera);
+        PixelRect region = cam.cropRect();
+        AccumulationBuffer halves[2] = { AccumulationBuffer(region.x0, region.y0, region.width, region.height),
+                                         AccumulationBuffer(region.x0, region.y0, region.width, region.height) };
+
+        Result result;
+        int samples = 0;
+        while (samples < maxSamples) {
+            int count = result.passes == 0 ? 1 : std::min(samplesPerPass, maxSamples - samples);
+            auto jobs = makeRenderJobs(cam.imgWidth, region, tileSize, samples + count, count, seed, samples);
+            prioritizeJobs(jobs, tileOrder, region, importance, seed + result.passes);
+
+            size_t rendered = cam.render(world, lights, jobs, halves[result.passes % 2], threads,
+                                         result.passes == 0 ? Clock::time_point::max() : deadline);
+            result.passes++;
+            samples += count;
+            if (rendered < jobs.size())
+                break;
+
+            if (result.passes >= 2) {
+                result.noise = noise(halves[0], halves[1]);
+                if (noiseTarget > 0 && result.noise <= noiseTarget) {
+                    result.reachedNoiseTarget = true;
+                    break;
+                }
+            }
+            if (Clock::now() >= deadline)
+                break;
+        }
+        if (result.passes >= 2)
+            result.noise = noise(halves[0], halves[1]);
+
+        result.image = halves[0];
+        result.image.merge(halves[1]);
+        if (!result.image.samples.empty()) {
+            result.minSamples = *std::min_element(result.image.samples.begin(), result.image.samples.end());
+            result.maxSamples = *std::max_element(result.image.samples.begin(), result.image.samples.end());
+            double total = 0;
+            for (uint32_t n : result.image.samples)
+                total += n;
+            result.meanSamples = total / result.image.samples.size();
+        }
+        result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return result;
+    }
+
+private:
+    // RMS over pixels of the standard error of the mean luminance, relative to the mean
+    // luminance of the image.
+    static double noise(const AccumulationBuffer& a, const AccumulationBuffer& b) {
+        double errors = 0, sum = 0;
+        size_t pixels = 0;
+        for (size_t p = 0; p < a.sum.size(); p++) {
+            double n = a.samples[p], m = b.samples[p];
+            if (n == 0 || m == 0)
+                continue;
+            double d = luminance(a.sum[p]) / n - luminance(b.sum[p]) / m;
+            errors += d * d * n * m / ((n + m) * (n + m));
+            sum += luminance(a.sum[p] + b.sum[p]) / (n + m);
+            pixels++;
+        }
+        if (pixels == 0 || sum <= 0)
+            return infinity;
+        return sqrt(errors / pixels) / (sum / pixels);
+    }
+};
+
+#endif
@@ -5,9 +5,142 @@
 
 #include "Hittable.hpp"
 
-class Quad : public Hittable {
+// Shapes spanned by a corner Q and edges u, v. Each one says which plane coordinates
+// (alpha along u, beta along v) are inside it, its bounds, its area relative to the
+// parallelogram |u x v|, and how to pick a uniform point on it. Chosen at compile time.
+struct ParallelogramShape {
+    static bool isInterior(double a, double b) {
+        return a >= 0 && a <= 1 && b >= 0 && b <= 1;
+    }
+
+    static AABB bounds(const Vector3& Q, const Vector3& u, const Vector3& v) {
+        return AABB(AABB(Q, Q + u + v), AABB(Q + u, Q + v));
+    }
+
+    static double areaFactor() { return 1; }
+
+    static void sample(double r1, double r2, double& a, double& b) {
+        a = r1;
+        b = r2;
+    }
+
+    // Rectangles (orthogonal u and v) are sampled by solid angle, see SphericalRectangle.
+    static const bool solidAngleSampling = true;
+};
+
+// Triangle with vertices Q, Q + u and Q + v.
+struct TriangleShape {
+    static bool isInterior(double a, double b) {
+        return a >= 0 && b >= 0 && a + b <= 1;
+    }
+
+    static AABB bounds(const Vector3& Q, const Vector3& u, const Vector3& v) {
+        return AABB(AABB(Q, Q + u), AABB(Q, Q + v));
+    }
+
+    static double areaFactor() { return 0.5; }
+
+    static const bool solidAngleSampling = false;
+
+    static void sample(double r1, double r2, double& a, double& b) {
+        if (r1 + r2 > 1) {
+            r1 = 1 - r1;
+            r2 = 1 - r2;
+        }
+        a = r1;
+        b = r2;
+    }
+};
+
+// Ellipse centered at Q with semi-axes u and v (a disk when they are orthogonal and equal).
+struct DiskShape {
+    static bool isInterior(double a, double b) {
+        return a * a + b * b <= 1;
+    }
+
+    static AABB bounds(const Vector3& Q, const Vector3& u, const Vector3& v) {
+        return AABB(AABB(Q - u - v, Q + u + v), AABB(Q - u + v, Q + u - v));
+    }
+
+    static double areaFactor() { return pi; }
+
+    static const bool solidAngleSampling = false;
+
+    static void sample(double r1, double r2, double& a, double& b) {
+        double radius = sqrt(r1);
+        a = radius * cos(2 * pi * r2);
+        b = radius * sin(2 * pi * r2);
+    }
+};
+
+// The solid angle a rectangle (corner Q, orthogonal edges u and v) subtends from `origin`,
+// and a uniform sampler over it (Urena et al., "An Area-Preserving Parametrization for
+// Spherical Rectangles"). Works in a frame with x along u, y along v and the rectangle at
+// z = z0 < 0.
+struct SphericalRectangle {
+    SphericalRectangle(const Vector3& Q, const Vector3& u, const Vector3& v, const Vector3& origin)
+            : origin(origin) {
+        double uLength = u.length();
+        double vLength = v.length();
+        x = u / uLength;
+        y = v / vLength;
+        z = cross(x, y);
+
+        Vector3 d = Q - origin;
+        z0 = dot(d, z);
+        if (z0 > 0) {
+            z = -z;
+            z0 = -z0;
+        }
+        x0 = dot(d, x);
+        y0 = dot(d, y);
+        x1 = x0 + uLength;
+        y1 = y0 + vLength;
+
+        // Normals of the planes through the origin and each edge have one zero component
+        // besides z, so neighbouring normals dot to the product of their z components.
+        double n0z = -y0 / sqrt(z0 * z0 + y0 * y0);
+        double n1z = x1 / sqrt(z0 * z0 + x1 * x1);
+        double n2z = y1 / sqrt(z0 * z0 + y1 * y1);
+        double n3z = -x0 / sqrt(z0 * z0 + x0 * x0);
+        double g0 = acos(fmax(-1, fmin(1, -n0z * n1z)));
+        double g1 = acos(fmax(-1, fmin(1, -n1z * n2z)));
+        double g2 = acos(fmax(-1, fmin(1, -n2z * n3z)));
+        double g3 = acos(fmax(-1, fmin(1, -n3z * n0z)));
+        b0 = n0z;
+        b1 = n2z;
+        k = 2 * pi - g2 - g3;
+        solidAngle = g0 + g1 - k;
+    }
+
+    // Point on the rectangle for uniform (s, t) in [0, 1)^2.
+    Vector3 sample(double s, double t) const {
+        double au = s * solidAngle + k;
+        double fu = (cos(au) * b0 - b1) / sin(au);
+        double cu = (fu > 0 ? 1 : -1) / sqrt(fu * fu + b0 * b0);
+        cu = fmax(-1, fmin(1, cu));
+        double xu = -(cu * z0) / fmax(1e-12, sqrt(1 - cu * cu));
+        xu = fmax(x0, fmin(x1, xu));
+
+        double d = sqrt(xu * xu + z0 * z0);
+        double h0 = y0 / sqrt(d * d + y0 * y0);
+        double h1 = y1 / sqrt(d * d + y1 * y1);
+        double hv = h0 + t * (h1 - h0);
+        double yv = hv * hv < 1 - 1e-12 ? hv * d / sqrt(1 - hv * hv) : y1;
+        return origin + xu * x + yv * y + z0 * z;
+    }
+
+    Vector3 origin;
+    Vector3 x, y, z;
+    double x0, x1, y0, y1, z0;
+    double b0, b1, k;
+    double solidAngle;
+};
+
+template <typename Shape>
+class PlanarShape : public Hittable {
 public:
-    Quad(const Vector3& Q, const Vector3& u, const Vector3& v, shared_ptr<Material> mat)
+    PlanarShape(const Vector3& Q, const Vector3& u, const Vector3& v, shared_ptr<Material> mat)
             : Q(Q), u(u), v(v), mat(mat)
     {
         auto n = cross(u, v);
@@ -15,30 +148,49 @@ public:
         D = dot(normal, Q);
         w = n / dot(n,n);
 
-        area = n.length();
+        // Plane coordinates of P are dot(P - Q, edgeA) and dot(P - Q, edgeB).
+        edgeA = cross(v, w);
+        edgeB = cross(w, u);
 
-        setBoundingBox();
-    }
+        area = n.length() * Shape::areaFactor();
+        rectangle = Shape::solidAngleSampling && fabs(dot(u, v)) <= 1e-9 * u.length() * v.length();
 
-    virtual void setBoundingBox() {
-        auto bbox_diagonal1 = AABB(Q, Q + u + v);
-        auto bbox_diagonal2 = AABB(Q + u, Q + v);
-        bbox = AABB(bbox_diagonal1, bbox_diagonal2);
+        bbox = Shape::bounds(Q, u, v);
     }
 
     double pdfValue(const Vector3& origin, const Vector3& direction) const override {
-        HitRecord rec;
-        if (!this->hit(Ray(origin, direction), Interval(0.001, infinity), rec))
+        // Plane test only: the pdf needs the distance and whether the direction hits the shape.
+        auto denom = dot(normal, direction);
+        if (fabs(denom) < 1e-8)
+            return 0;
+        auto t = (D - dot(normal, origin)) / denom;
+        if (t <= rayEpsilon)
+            return 0;
+        Vector3 planar = origin + t * direction - Q;
+        if (!Shape::isInterior(dot(planar, edgeA), dot(planar, edgeB)))
             return 0;
 
-        auto distanceSquared = rec.t * rec.t * direction.lengthSquared();
-        auto cosine = fabs(dot(direction, rec.normal) / direction.length());
+        double solidAngle;
+        if (useSolidAngle(origin, solidAngle))
+            return 1 / solidAngle;
 
+        auto distanceSquared = t * t * direction.lengthSquared();
+        auto cosine = fabs(denom / direction.length());
         return distanceSquared / (cosine * area);
     }
 
     Vector3 random(const Vector3& origin) const override {
-        auto p = Q + (randomDouble() * u) + (randomDouble() * v);
+        // The v coordinate is drawn first, matching the sample sequence of earlier renders.
+        double r2 = randomDouble();
+        double r1 = randomDouble();
+
+        double solidAngle;
+        if (useSolidAngle(origin, solidAngle))
+            return SphericalRectangle(Q, u, v, origin).sample(r1, r2) - origin;
+
+        double a, b;
+        Shape::sample(r1, r2, a, b);
+        auto p = Q + (a * u) + (b * v);
         return p - origin;
     }
 
@@ -54,43 +206,63 @@ public:
         if (!ray_t.contains(t))
             return false;
 
-        auto intersection = r.at(t);
-        Vector3 planar_hitpt_vector = intersection - Q;
-        auto alpha = dot(w, cross(planar_hitpt_vector, v));
-        auto beta = dot(w, cross(u, planar_hitpt_vector));
+        Vector3 planar_hitpt_vector = r.at(t) - Q;
+        auto alpha = dot(planar_hitpt_vector, edgeA);
+        auto beta = dot(planar_hitpt_vector, edgeB);
 
-        if (!isInterior(alpha, beta, outRec))
+        if (!Shape::isInterior(alpha, beta))
             return false;
 
         outRec.t = t;
-        outRec.p = intersection;
-        outRec.mat = mat;
-        outRec.setFaceNormal(r, normal);
+        outRec.u = alpha;
+        outRec.v = beta;
+        outRec.object = this;
 
         return true;
     }
 
-    virtual bool isInterior(double a, double b, HitRecord& outRec) const {
-        Interval unit_interval = Interval(0, 1);
-
-        if (!unit_interval.contains(a) || !unit_interval.contains(b))
-            return false;
+    bool occluded(const Ray& r, double tMax) const override {
+        // hit() already stops at t and the plane coordinates, which the interior test needs.
+        HitRecord rec;
+        return hit(r, Interval(rayEpsilon, tMax), rec);
+    }
 
-        outRec.u = a;
-        outRec.v = b;
-        return true;
+    void finalize(const Ray& r, HitRecord& rec) const override {
+        rec.p = r.at(rec.t);
+        rec.mat = mat;
+        rec.setFaceNormal(r, normal);
     }
 
+    Vector3 corner() const { return Q; }
+    Vector3 edgeU() const { return u; }
+    Vector3 edgeV() const { return v; }
+    shared_ptr<Material> material() const { return mat; }
 
 private:
+    // Rectangles use solid-angle sampling unless they are nearly edge-on or so small from
+    // `origin` that the spherical construction loses precision; both random() and pdfValue()
+    // make the same choice.
+    bool useSolidAngle(const Vector3& origin, double& outSolidAngle) const {
+        if (!rectangle)
+            return false;
+        outSolidAngle = SphericalRectangle(Q, u, v, origin).solidAngle;
+        return outSolidAngle > 1e-6;
+    }
+
     Vector3 Q;
     Vector3 u, v;
     Vector3 w;
+    Vector3 edgeA, edgeB;
     shared_ptr<Material> mat;
     AABB bbox;
     Vector3 normal;
     double D;
     double area;
+    bool rectangle;
 };
 
-#endif
\ No newline at end of file
+typedef PlanarShape<ParallelogramShape> Quad;
+typedef PlanarShape<TriangleShape> Triangle;
+typedef PlanarShape<DiskShape> Disk;
+
+#endif
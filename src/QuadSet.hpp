@@ -0,0 +1,267 @@
+#ifndef QUAD_SET_H
+#define QUAD_SET_H
+
+#include "Utils.hpp"
+#include "FlatBVH.hpp"
+#include "ParallelBVHBuilder.hpp"
+#include "Quad.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+#ifdef __AVX__
+// Lane-wise interior tests matching Shape::isInterior.
+template <typename Shape> struct PlanarInterior;
+
+template <> struct PlanarInterior<ParallelogramShape> {
+    static __m256d test(__m256d a, __m256d b) {
+        __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1);
+        return _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(a, zero, _CMP_GE_OQ), _mm256_cmp_pd(a, one, _CMP_LE_OQ)),
+                             _mm256_and_pd(_mm256_cmp_pd(b, zero, _CMP_GE_OQ), _mm256_cmp_pd(b, one, _CMP_LE_OQ)));
+    }
+};
+
+template <> struct PlanarInterior<TriangleShape> {
+    static __m256d test(__m256d a, __m256d b) {
+        __m256d zero = _mm256_setzero_pd();
+        return _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(a, zero, _CMP_GE_OQ), _mm256_cmp_pd(b, zero, _CMP_GE_OQ)),
+                             _mm256_cmp_pd(_mm256_add_pd(a, b), _mm256_set1_pd(1), _CMP_LE_OQ));
+    }
+};
+
+template <> struct PlanarInterior<DiskShape> {
+    static __m256d test(__m256d a, __m256d b) {
+        __m256d r2 = _mm256_add_pd(_mm256_mul_pd(a, a), _mm256_mul_pd(b, b));
+        return _mm256_cmp_pd(r2, _mm256_set1_pd(1), _CMP_LE_OQ);
+    }
+};
+#endif
+
+// Many planar shapes of one kind in one primitive, packed in batches of 4 with the plane
+// and edge data precomputed (see PlanarShape). Every BVH leaf owns one batch, which is
+// intersected by one AVX kernel when compiled with AVX and by a scalar loop otherwise.
+template <typename Shape>
+class PlanarSet : public Hittable {
+public:
+    static const uint32_t batchSize = 4;
+
+    struct Batch {
+        double nx[batchSize], ny[batchSize], nz[batchSize], d[batchSize];
+        double qx[batchSize], qy[batchSize], qz[batchSize];
+        double ax[batchSize], ay[batchSize], az[batchSize];
+        double bx[batchSize], by[batchSize], bz[batchSize];
+        uint32_t material[batchSize];
+    };
+
+    void add(const Vector3& Q, const Vector3& u, const Vector3& v, shared_ptr<Material> mat) {
+        auto n = cross(u, v);
+        auto w = n / dot(n, n);
+
+        Source s;
+        s.Q = Q;
+        s.normal = unitVector(n);
+        s.D = dot(s.normal, Q);
+        s.edgeA = cross(v, w);
+        s.edgeB = cross(w, u);
+        s.material = materialId(mat);
+        s.bounds = Shape::bounds(Q, u, v);
+        sources.push_back(s);
+        bbox = AABB(bbox, s.bounds);
+    }
+
+    void add(const PlanarShape<Shape>& shape) {
+        add(shape.corner(), shape.edgeU(), shape.edgeV(), shape.material());
+    }
+
+    // Builds the BVH and packs the shapes leaf by leaf. Call after the last add().
+    void build(unsigned threads = hardwareThreads()) {
+        std::vector<AABB> boxes;
+        boxes.reserve(sources.size());
+        for (const auto& s : sources)
+            boxes.push_back(s.bounds);
+
+        std::vector<uint32_t> primIndices;
+        ParallelBVHBuilder builder(threads);
+        builder.batchLeafSize = batchSize;
+        builder.build(boxes, nodes, primIndices);
+
+        // Unused lanes hold NaN planes, which fail every comparison in the kernels.
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        Batch empty;
+        for (uint32_t i = 0; i < batchSize; i++) {
+            empty.nx[i] = empty.ny[i] = empty.nz[i] = empty.d[i] = nan;
+            empty.qx[i] = empty.qy[i] = empty.qz[i] = nan;
+            empty.ax[i] = empty.ay[i] = empty.az[i] = nan;
+            empty.bx[i] = empty.by[i] = empty.bz[i] = nan;
+            empty.material[i] = 0;
+        }
+
+        batches.clear();
+        for (auto& node : nodes) {
+            if (!node.isLeaf())
+                continue;
+            Batch batch = empty;
+            for (uint32_t i = 0; i < node.count; i++) {
+                const Source& s = sources[primIndices[node.left + i]];
+                batch.nx[i] = s.normal.x(); batch.ny[i] = s.normal.y(); batch.nz[i] = s.normal.z();
+                batch.d[i] = s.D;
+                batch.qx[i] = s.Q.x(); batch.qy[i] = s.Q.y(); batch.qz[i] = s.Q.z();
+                batch.ax[i] = s.edgeA.x(); batch.ay[i] = s.edgeA.y(); batch.az[i] = s.edgeA.z();
+                batch.bx[i] = s.edgeB.x(); batch.by[i] = s.edgeB.y(); batch.bz[i] = s.edgeB.z();
+                batch.material[i] = s.material;
+            }
+            node.left = uint32_t(batches.size());
+            batches.push_back(batch);
+        }
+    }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const override {
+        return traverseFlatBVHLeaves(nodes.empty() ? nullptr : nodes.data(), r, ray_t,
+                                     [&](const FlatBVHNode& leaf, Interval& t) {
+            double root, alpha, beta;
+            int lane = hitBatch(batches[leaf.left], r, t, root, alpha, beta);
+            if (lane < 0)
+                return false;
+            t.max = root;
+            outRec.t = root;
+            outRec.u = alpha;
+            outRec.v = beta;
+            outRec.object = this;
+            outRec.primIndex = leaf.left * batchSize + uint32_t(lane);
+            return true;
+        });
+    }
+
+    bool occluded(const Ray& r, double tMax) const override {
+        Interval ray_t(rayEpsilon, tMax);
+        return occludedFlatBVHLeaves(nodes.empty() ? nullptr : nodes.data(), r, tMax, [&](const FlatBVHNode& leaf) {
+            double root, alpha, beta;
+            return hitBatch(batches[leaf.left], r, ray_t, root, alpha, beta) >= 0;
+        });
+    }
+
+    void finalize(const Ray& r, HitRecord& rec) const override {
+        const Batch& batch = batches[rec.primIndex / batchSize];
+        uint32_t lane = rec.primIndex % batchSize;
+        rec.p = r.at(rec.t);
+        rec.mat = materials[batch.material[lane]];
+        rec.setFaceNormal(r, Vector3(batch.nx[lane], batch.ny[lane], batch.nz[lane]));
+    }
+
+    AABB boundingBox() const override { return bbox; }
+
+    size_t size() const { return sources.size(); }
+
+private:
+    struct Source {
+        Vector3 Q, normal, edgeA, edgeB;
+        double D;
+        uint32_t material;
+        AABB bounds;
+    };
+
+    // Closest hit in ray_t over one batch. Returns its lane, or -1.
+    static int hitBatch(const Batch& b, const Ray& r, const Interval& ray_t,
+                        double& outT, double& outAlpha, double& outBeta) {
+        Vector3 o = r.origin();
+        Vector3 dir = r.direction();
+
+#ifdef __AVX__
+        __m256d nx = _mm256_loadu_pd(b.nx), ny = _mm256_loadu_pd(b.ny), nz = _mm256_loadu_pd(b.nz);
+        __m256d ox = _mm256_set1_pd(o.x()), oy = _mm256_set1_pd(o.y()), oz = _mm256_set1_pd(o.z());
+        __m256d dx = _mm256_set1_pd(dir.x()), dy = _mm256_set1_pd(dir.y()), dz = _mm256_set1_pd(dir.z());
+
+        __m256d denom = _mm256_add_pd(_mm256_mul_pd(nx, dx), _mm256_add_pd(_mm256_mul_pd(ny, dy), _mm256_mul_pd(nz, dz)));
+        __m256d nDotO = _mm256_add_pd(_mm256_mul_pd(nx, ox), _mm256_add_pd(_mm256_mul_pd(ny, oy), _mm256_mul_pd(nz, oz)));
+        __m256d t = _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(b.d), nDotO), denom);
+
+        __m256d absDenom = _mm256_andnot_pd(_mm256_set1_pd(-0.0), denom);
+        __m256d ok = _mm256_and_pd(_mm256_cmp_pd(absDenom, _mm256_set1_pd(1e-8), _CMP_GE_OQ),
+                     _mm256_and_pd(_mm256_cmp_pd(t, _mm256_set1_pd(ray_t.min), _CMP_GE_OQ),
+                                   _mm256_cmp_pd(t, _mm256_set1_pd(ray_t.max), _CMP_LE_OQ)));
+        if (_mm256_movemask_pd(ok) == 0)
+            return -1;
+
+        __m256d px = _mm256_sub_pd(_mm256_add_pd(ox, _mm256_mul_pd(t, dx)), _mm256_loadu_pd(b.qx));
+        __m256d py = _mm256_sub_pd(_mm256_add_pd(oy, _mm256_mul_pd(t, dy)), _mm256_loadu_pd(b.qy));
+        __m256d pz = _mm256_sub_pd(_mm256_add_pd(oz, _mm256_mul_pd(t, dz)), _mm256_loadu_pd(b.qz));
+        __m256d alpha = _mm256_add_pd(_mm256_mul_pd(px, _mm256_loadu_pd(b.ax)),
+                        _mm256_add_pd(_mm256_mul_pd(py, _mm256_loadu_pd(b.ay)), _mm256_mul_pd(pz, _mm256_loadu_pd(b.az))));
+        __m256d beta = _mm256_add_pd(_mm256_mul_pd(px, _mm256_loadu_pd(b.bx)),
+                       _mm256_add_pd(_mm256_mul_pd(py, _mm256_loadu_pd(b.by)), _mm256_mul_pd(pz, _mm256_loadu_pd(b.bz))));
+        ok = _mm256_and_pd(ok, PlanarInterior<Shape>::test(alpha, beta));
+        int okMask = _mm256_movemask_pd(ok);
+        if (okMask == 0)
+            return -1;
+
+        alignas(32) double ts[batchSize], alphas[batchSize], betas[batchSize];
+        _mm256_store_pd(ts, t);
+        _mm256_store_pd(alphas, alpha);
+        _mm256_store_pd(betas, beta);
+        int best = -1;
+        for (int lane = 0; lane < int(batchSize); lane++) {
+            if ((okMask & (1 << lane)) && (best < 0 || ts[lane] < ts[best]))
+                best = lane;
+        }
+        outT = ts[best];
+        outAlpha = alphas[best];
+        outBeta = betas[best];
+        return best;
+#else
+        int best = -1;
+        double closest = ray_t.max;
+        for (int lane = 0; lane < int(batchSize); lane++) {
+            Vector3 normal(b.nx[lane], b.ny[lane], b.nz[lane]);
+            auto denom = dot(normal, dir);
+            if (!(fabs(denom) >= 1e-8))
+                continue;
+
+            auto t = (b.d[lane] - dot(normal, o)) / denom;
+            if (!ray_t.contains(t) || t >= closest)
+                continue;
+
+            Vector3 planar_hitpt_vector = r.at(t) - Vector3(b.qx[lane], b.qy[lane], b.qz[lane]);
+            auto alpha = dot(planar_hitpt_vector, Vector3(b.ax[lane], b.ay[lane], b.az[lane]));
+            auto beta = dot(planar_hitpt_vector, Vector3(b.bx[lane], b.by[lane], b.bz[lane]));
+            if (!Shape::isInterior(alpha, beta))
+                continue;
+
+            best = lane;
+            closest = t;
+            outAlpha = alpha;
+            outBeta = beta;
+        }
+        outT = closest;
+        return best;
+#endif
+    }
+
+    uint32_t materialId(const shared_ptr<Material>& mat) {
+        auto found = materialIds.find(mat.get());
+        if (found != materialIds.end())
+            return found->second;
+        materials.push_back(mat);
+        uint32_t id = uint32_t(materials.size() - 1);
+        materialIds[mat.get()] = id;
+        return id;
+    }
+
+    std::vector<Source> sources;
+    std::vector<FlatBVHNode> nodes;
+    std::vector<Batch> batches;
+    std::vector< shared_ptr<Material> > materials;
+    std::unordered_map<const Material*, uint32_t> materialIds;
+    AABB bbox;
+};
+
+typedef PlanarSet<ParallelogramShape> QuadSet;
+typedef PlanarSet<TriangleShape> TriangleSet;
+typedef PlanarSet<DiskShape> DiskSet;
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef RADIANCE_CACHE_H
+#define RADIANCE_CACHE_H
+
+#include "Utils.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+// Outgoing radiance of diffuse surfaces averaged over cells of a hashed world-space grid, for
+// ending long paths early (after Binder et al., "Massively Parallel Path Space Filtering", and
+// Mueller et al., "Real-time Neural Radiance Caching for Path Tracing"). A cell is keyed on its
+// level, its position at that level's size and the surface normal rounded to a 5x5x5 lattice.
+// Levels are powers of two chosen from the footprint of a pixel at the point, so cells stay
+// about cellScale pixels wide on screen wherever they are.
+//
+// The table has a fixed number of entries, found by linear probing from the key's hash over
+// at most maxProbes slots; a record that finds none free is dropped, so memory stays bounded.
+// Entries are claimed and updated with atomics, without locks.
+class RadianceCache {
+public:
+    double cellScale = 2;  // cell size in pixel footprints
+    int maxProbes = 8;
+    uint32_t minSamples = 4; // before an entry is used
+
+    explicit RadianceCache(size_t entryCount = size_t(1) << 20) {
+        size_t size = 1;
+        while (size < entryCount)
+            size <<= 1;
+        capacity = size;
+        entries.reset(new Entry[size]);
+    }
+
+    // Adds an estimate of the radiance leaving `p` on the side `normal` faces; `footprint` is
+    // the width of a pixel at `p`.
+    void record(const Vector3& p, const Vector3& normal, double footprint, const Vector3& radiance) {
+        if (!std::isfinite(radiance.x()) || !std::isfinite(radiance.y()) || !std::isfinite(radiance.z()))
+            return;
+        Entry* entry = find(key(p, normal, footprint), true);
+        if (!entry)
+            return;
+        for (int k = 0; k < 3; k++)
+            add(entry->sum[k], float(radiance[k]));
+        entry->count.fetch_add(1, std::memory_order_release);
+    }
+
+    // The mean of the estimates recorded in the cell of `p`, if it has at least minSamples.
+    bool lookup(const Vector3& p, const Vector3& normal, double footprint, Vector3& radiance) const {
+        Entry* entry = const_cast<RadianceCache*>(this)->find(key(p, normal, footprint), false);
+        if (!entry)
+            return false;
+        uint32_t count = entry->count.load(std::memory_order_acquire);
+        if (count < minSamples)
+            return false;
+        radiance = Vector3(entry->sum[0].load(std::memory_order_relaxed), entry->sum[1].load(std::memory_order_relaxed),
+                           entry->sum[2].load(std::memory_order_relaxed)) / count;
+        return true;
+    }
+
+    // Not safe while rendering.
+    void clear() {
+        for (size_t i = 0; i < capacity; i++) {
+            entries[i].key.store(0);
+            entries[i].count.store(0);
+            for (int k = 0; k < 3; k++)
+                entries[i].sum[k].store(0);
+        }
+    }
+
+    size_t usedEntries() const {
+        size_t used = 0;
+        for (size_t i = 0; i < capacity; i++)
+            used += entries[i].key.load(std::memory_order_relaxed) != 0;
+        return used;
+    }
+
+    size_t entryCount() const { return capacity; }
+    size_t bytes() const { return capacity * sizeof(Entry); }
+
+private:
+    struct Entry {
+        std::atomic<uint64_t> key{ 0 }; // 0: free
+        std::atomic<uint32_t> count{ 0 };
+        std::atomic<float> sum[3];
+
+        Entry() {
+            for (int k = 0; k < 3; k++)
+                sum[k].store(0, std::memory_order_relaxed);
+        }
+    };
+
+    std::unique_ptr<Entry[]> entries;
+    size_t capacity;
+
+    static void add(std::atomic<float>& target, float value) {
+        float current = target.load(std::memory_order_relaxed);
+        while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t key(const Vector3& p, const Vector3& normal, double footprint) const {
+        int level = int(floor(log2(std::max(cellScale * footprint, 1e-12))));
+        double cell = ldexp(1.0, level);
+        uint64_t h = mixBits(uint64_t(int64_t(level)));
+        for (int a = 0; a < 3; a++) {
+            h = mixBits(h ^ uint64_t(int64_t(floor(p[a] / cell))));
+            h = mixBits(h ^ uint64_t(int64_t(lround(normal[a] * 2))));
+        }
+        return h | 1;
+    }
+
+    // The entry holding `k`, claiming a free one on the way if `claim` is set.
+    Entry* find(uint64_t k, bool claim) {
+        size_t slot = size_t(k >> 1) & (capacity - 1);
+        for (int probe = 0; probe < maxProbes; probe++, slot = (slot + 1) & (capacity - 1)) {
+            Entry& entry = entries[slot];
+            uint64_t current = entry.key.load(std::memory_order_acquire);
+            if (current == k)
+                return &entry;
+            if (current != 0)
+                continue;
+            if (!claim)
+                return nullptr;
+            uint64_t expected = 0;
+            if (entry.key.compare_exchange_strong(expected, k, std::memory_order_acq_rel) || expected == k)
+                return &entry;
+        }
+        return nullptr;
+    }
+};
+
+#endif
@@ -0,0 +1,439 @@
+#ifndef RENDER_DAEMON_H
+#define RENDER_DAEMON_H
+
+#include "Camera.hpp"
+#include "DistributedRender.hpp"
+#include "HittableList.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// A scene as the daemon keeps it between jobs: its objects (with their textures), lights, the
+// acceleration structure rays are traced against, and the camera that requests start from.
+struct ResidentScene {
+    HittableList world;
+    HittableList lights;
+    shared_ptr<Hittable> accelerated;
+    Camera camera;
+};
+
+// Scenes by name, loaded on first use. Each job holds a reference for as long as it renders;
+// past `capacity` resident scenes, the least recently used ones that no job holds are dropped
+// and load again when next asked for.
+class SceneCache {
+public:
+    typedef std::function<shared_ptr<ResidentScene>()> Loader;
+
+    struct Stats {
+        size_t hits = 0;
+        size_t loads = 0;
+        size_t evictions = 0;
+        size_t resident = 0;
+    };
+
+    explicit SceneCache(size_t capacity = 4) : capacity(capacity) {}
+
+    void registerScene(const std::string& name, Loader loader) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto entry = make_shared<Entry>();
+        entry->loader = loader;
+        entries[name] = entry;
+    }
+
+    // The scene called `name`, loading it if it is not resident; null if it is unknown.
+    // Concurrent requests for a scene that is loading wait for the one load.
+    shared_ptr<ResidentScene> acquire(const std::string& name) {
+        shared_ptr<Entry> entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = entries.find(name);
+            if (found == entries.end())
+                return nullptr;
+            entry = found->second;
+            entry->lastUse = ++useClock;
+        }
+
+        shared_ptr<ResidentScene> scene;
+        bool loaded = false;
+        {
+            std::lock_guard<std::mutex> loadLock(entry->loadMutex);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                scene = entry->scene;
+            }
+            if (!scene) {
+                scene = entry->loader();
+                loaded = true;
+                std::lock_guard<std::mutex> lock(mutex);
+                entry->scene = scene;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (loaded)
+            counters.loads++;
+        else
+            counters.hits++;
+        evict();
+        return scene;
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats s = counters;
+        for (const auto& entry : entries)
+            if (entry.second->scene)
+                s.resident++;
+        return s;
+    }
+
+private:
+    struct Entry {
+        Loader loader;
+        std::mutex loadMutex;
+        shared_ptr<ResidentScene> scene; // guarded by SceneCache::mutex
+        uint64_t lastUse = 0;
+    };
+
+    // Called with `mutex` held.
+    void evict() {
+        for (;;) {
+            size_t resident = 0;
+            shared_ptr<Entry> victim;
+            for (const auto& entry : entries) {
+                if (!entry.second->scene)
+                    continue;
+                resident++;
+                // Only the cache holds it: no job is rendering it.
+                if (entry.second->scene.use_count() == 1 && (!victim || entry.second->lastUse < victim->lastUse))
+                    victim = entry.second;
+            }
+            if (resident <= capacity || !victim)
+                return;
+            victim->scene.reset();
+            counters.evictions++;
+        }
+    }
+
+    size_t capacity;
+    mutable std::mutex mutex;
+    std::map<std::string, shared_ptr<Entry>> entries;
+    uint64_t useClock = 0;
+    Stats counters;
+};
+
+namespace Daemon {
+
+enum MessageType : uint32_t {
+    RequestMessage = 16, // client -> daemon, "key=value" words
+    ImageMessage = 17,   // daemon -> client, the image
+    ErrorMessage = 18,   // daemon -> client, what went wrong
+};
+
+// Parses "x,y,z".
+inline bool parseVector(const std::string& text, Vector3& out) {
+    double x, y, z;
+    if (std::sscanf(text.c_str(), "%lf,%lf,%lf", &x, &y, &z) != 3)
+        return false;
+    out = Vector3(x, y, z);
+    return true;
+}
+
+} // namespace Daemon
+
+// Long-running render service on a Unix domain socket. A request is one message of
+// whitespace-separated key=value words:
+//   scene=<name>  width=<pixels>  spp=<samples>  depth=<bounces>  fov=<degrees>  seed=<n>
+//   from=x,y,z  at=x,y,z  up=x,y,z  crop=x,y,width,height  format=ppm|float
+// and the reply is the image, or just its crop window, as PPM text or as width and height
+// (int32) followed by linear float RGB, or an error message. A connection can carry any
+// number of requests. Renders run one at a time on all threads; the request "shutdown" stops
+// the daemon.
+class RenderDaemon {
+public:
+    struct Stats {
+        size_t requests = 0;
+        size_t errors = 0;
+        double traceSeconds = 0;    // of the last request
+        double requestSeconds = 0;  // of the last request, scene lookup and encoding included
+    };
+
+    unsigned threads = hardwareThreads();
+    int tileSize = 16;
+
+    explicit RenderDaemon(SceneCache& scenes) : scenes(scenes) {}
+
+    ~RenderDaemon() {
+        stop();
+        if (listenFd >= 0) {
+            ::close(listenFd);
+            ::unlink(socketPath.c_str());
+        }
+    }
+
+    RenderDaemon(const RenderDaemon&) = delete;
+    RenderDaemon& operator=(const RenderDaemon&) = delete;
+
+    // Binds to `path`, replacing a stale socket file left by an earlier daemon.
+    bool listen(const std::string& path) {
+        sockaddr_un address;
+        if (path.size() >= sizeof(address.sun_path))
+            return false;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size());
+
+        ::unlink(path.c_str());
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0)
+            return false;
+        if (::bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listenFd, 64) != 0) {
+            ::close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+        socketPath = path;
+        return true;
+    }
+
+    // Accepts connections, one thread each, until stop() or a "shutdown" request.
+    void serve() {
+        running = true;
+        while (running) {
+            pollfd fd;
+            fd.fd = listenFd;
+            fd.events = POLLIN;
+            if (::poll(&fd, 1, 100) <= 0)
+                continue;
+            int client = ::accept(listenFd, nullptr, nullptr);
+            if (client < 0)
+                continue;
+            std::lock_guard<std::mutex> lock(connectionMutex);
+            joinClosedConnections();
+            clients.push_back(client);
+            connections.push_back(std::thread([this, client]() { handle(client); }));
+        }
+
+        std::vector<std::thread> finished;
+        {
+            std::lock_guard<std::mutex> lock(connectionMutex);
+            for (int client : clients)
+                ::shutdown(client, SHUT_RDWR);
+            finished.swap(connections);
+        }
+        for (auto& connection : finished)
+            connection.join();
+    }
+
+    void stop() { running = false; }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(renderMutex);
+        return counters;
+    }
+
+private:
+    void handle(int client) {
+        uint32_t type;
+        std::string request;
+        while (running && Distributed::receiveMessage(client, type, request) && type == Daemon::RequestMessage) {
+            if (request == "shutdown") {
+                stop();
+                break;
+            }
+            std::string reply, error;
+            bool ok = render(request, reply, error);
+            if (!Distributed::sendMessage(client, ok ? Daemon::ImageMessage : Daemon::ErrorMessage, ok ? reply : error))
+                break;
+        }
+
+        std::lock_guard<std::mutex> lock(connectionMutex);
+        clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+        ::close(client);
+        closed.push_back(std::this_thread::get_id());
+    }
+
+    // Called with `connectionMutex` held.
+    void joinClosedConnections() {
+        for (size_t i = 0; i < connections.size();) {
+            if (std::find(closed.begin(), closed.end(), connections[i].get_id()) != closed.end()) {
+                closed.erase(std::find(closed.begin(), closed.end(), connections[i].get_id()));
+                connections[i].join();
+                connections.erase(connections.begin() + std::ptrdiff_t(i));
+            } else {
+                i++;
+            }
+        }
+    }
+
+    bool render(const std::string& request, std::string& reply, std::string& error) {
+        auto start = std::chrono::steady_clock::now();
+        std::string sceneName, format = "ppm";
+        std::map<std::string, std::string> options;
+        std::istringstream words(request);
+        std::string word;
+        while (words >> word) {
+            size_t equals = word.find('=');
+            if (equals == std::string::npos) {
+                error = "expected key=value, got '" + word + "'";
+                return fail();
+            }
+            options[word.substr(0, equals)] = word.substr(equals + 1);
+        }
+
+        shared_ptr<ResidentScene> scene = scenes.acquire(options["scene"]);
+        if (!scene) {
+            error = "unknown scene '" + options["scene"] + "'";
+            return fail();
+        }
+
+        Camera cam = scene->camera;
+        uint64_t seed = 0;
+        try {
+            for (const auto& option : options) {
+                const std::string& key = option.first;
+                const std::string& value = option.second;
+                bool valid = true;
+                if (key == "scene")
+                    continue;
+                else if (key == "width")
+                    cam.imgWidth = std::stoi(value);
+                else if (key == "spp")
+                    cam.samplePerPixel = std::stoi(value);
+                else if (key == "depth")
+                    cam.maxDepth = std::stoi(value);
+                else if (key == "fov")
+                    cam.fovy = std::stod(value);
+                else if (key == "seed")
+                    seed = std::stoull(value);
+                else if (key == "from")
+                    valid = Daemon::parseVector(value, cam.camPos);
+                else if (key == "at")
+                    valid = Daemon::parseVector(value, cam.lookAt);
+                else if (key == "up")
+                    valid = Daemon::parseVector(value, cam.up);
+                else if (key == "crop")
+                    valid = std::sscanf(value.c_str(), "%d,%d,%d,%d", &cam.cropX, &cam.cropY, &cam.cropWidth,
+                                        &cam.cropHeight) == 4;
+                else if (key == "format")
+                    format = value;
+                else
+                    valid = false;
+                if (!valid) {
+                    error = "bad option '" + key + "=" + value + "'";
+                    return fail();
+                }
+            }
+        } catch (const std::exception&) {
+            error = "bad number in '" + request + "'";
+            return fail();
+        }
+        if (cam.imgWidth <= 0 || cam.imgWidth > 16384 || cam.samplePerPixel <= 0 || (format != "ppm" && format != "float")) {
+            error = "unsupported image size, sample count or format";
+            return fail();
+        }
+
+        std::lock_guard<std::mutex> lock(renderMutex);
+        auto traceStart = std::chrono::steady_clock::now();
+        PixelRect region = cam.cropRect();
+        int width = region.width, height = region.height;
+        AccumulationBuffer image(region.x0, region.y0, width, height);
+        cam.render(*scene->accelerated, scene->lights,
+                   makeRenderJobs(cam.imgWidth, region, tileSize, cam.samplePerPixel, cam.samplePerPixel, seed),
+                   image, threads);
+        counters.traceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - traceStart).count();
+
+        std::vector<Vector3> pixels = image.resolve();
+        if (format == "ppm") {
+            std::ostringstream out;
+            writePPM(out, width, height, pixels);
+            reply = out.str();
+        } else {
+            reply.clear();
+            Distributed::put(reply, int32_t(width));
+            Distributed::put(reply, int32_t(height));
+            for (const auto& p : pixels)
+                for (int k = 0; k < 3; k++)
+                    Distributed::put(reply, float(p[k]));
+        }
+        counters.requests++;
+        counters.requestSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return true;
+    }
+
+    bool fail() {
+        std::lock_guard<std::mutex> lock(renderMutex);
+        counters.errors++;
+        return false;
+    }
+
+    SceneCache& scenes;
+    int listenFd = -1;
+    std::string socketPath;
+    std::atomic<bool> running{ false };
+
+    std::mutex connectionMutex;
+    std::vector<int> clients;
+    std::vector<std::thread> connections;
+    std::vector<std::thread::id> closed;
+
+    mutable std::mutex renderMutex;
+    Stats counters;
+};
+
+// One connection to a RenderDaemon.
+class RenderClient {
+public:
+    ~RenderClient() { close(); }
+
+    bool connect(const std::string& path) {
+        close();
+        sockaddr_un address;
+        if (path.size() >= sizeof(address.sun_path))
+            return false;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size());
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+            return true;
+        close();
+        return false;
+    }
+
+    void close() {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+
+    // Sends `request` and waits for the reply; false with the daemon's message in `reply` if it
+    // refused the request, or an empty reply if the connection failed.
+    bool request(const std::string& request, std::string& reply) {
+        uint32_t type = 0;
+        reply.clear();
+        if (fd < 0 || !Distributed::sendMessage(fd, Daemon::RequestMessage, request))
+            return false;
+        if (request == "shutdown")
+            return true;
+        return Distributed::receiveMessage(fd, type, reply) && type == Daemon::ImageMessage;
+    }
+
+private:
+    int fd = -1;
+};
+
+#endif
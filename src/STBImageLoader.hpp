@@ -72,6 +72,18 @@ public:
         return bdata + y * bytesPerScanline + x * bytesPerPixel;
     }
 
+    const float* float_pixel_data(int x, int y) const {
+        // Return the address of the three linear RGB floats of the pixel at x,y, unclamped, so
+        // HDR values above 1 are kept. If there is no image data, returns magenta.
+        static float magenta[] = { 1, 0, 1 };
+        if (fdata == nullptr) return magenta;
+
+        x = clamp(x, 0, imgW);
+        y = clamp(y, 0, imgH);
+
+        return fdata + y * bytesPerScanline + x * bytesPerPixel;
+    }
+
 private:
     const int      bytesPerPixel = 3;
     float         *fdata = nullptr;         // Linear floating point pixel data
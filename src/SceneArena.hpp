@@ -0,0 +1,105 @@
+#ifndef SCENE_ARENA_H
+#define SCENE_ARENA_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Monotonic allocator that owns the primitives, materials, textures and nodes of one scene.
+// Objects are bump-allocated from large blocks and all destroyed with the arena. make()
+// returns non-owning handles: shared_ptrs without a control block, so the existing
+// interfaces take them as they are, copying them costs no atomic reference counting, and
+// nothing is allocated per object. The arena must outlive every handle. Without NDEBUG,
+// handles share a lifetime token instead, and the destructor asserts that none outside the
+// arena are left. Not thread-safe.
+class SceneArena {
+public:
+    explicit SceneArena(size_t blockSize = 1 << 20) : blockSize(blockSize) {}
+
+    SceneArena(const SceneArena&) = delete;
+    SceneArena& operator=(const SceneArena&) = delete;
+
+    ~SceneArena() {
+        for (auto it = destructors.rbegin(); it != destructors.rend(); ++it)
+            it->destroy(it->object);
+#ifndef NDEBUG
+        assert(lifetime.use_count() == 1 && "SceneArena destroyed while handles to its objects are alive");
+#endif
+        for (char* block : blocks)
+            ::operator delete(block);
+    }
+
+    template <typename T, typename... Args>
+    std::shared_ptr<T> make(Args&&... args) {
+        void* memory = allocate(sizeof(T), alignof(T));
+        T* object = new (memory) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+            destructors.push_back(Destructor{ &destroy<T>, object });
+        objects++;
+#ifndef NDEBUG
+        return std::shared_ptr<T>(lifetime, object);
+#else
+        return std::shared_ptr<T>(std::shared_ptr<T>(), object);
+#endif
+    }
+
+    void* allocate(size_t size, size_t alignment) {
+        size_t padding = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+        if (cursor == nullptr || padding + size > remaining) {
+            size_t capacity = size + alignment > blockSize ? size + alignment : blockSize;
+            cursor = static_cast<char*>(::operator new(capacity));
+            blocks.push_back(cursor);
+            remaining = capacity;
+            reserved += capacity;
+            padding = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+        }
+
+        char* result = cursor + padding;
+        cursor = result + size;
+        remaining -= padding + size;
+        used += padding + size;
+        return result;
+    }
+
+    size_t bytesUsed() const { return used; }
+    size_t bytesReserved() const { return reserved; }
+    size_t objectCount() const { return objects; }
+
+private:
+    struct Destructor {
+        void (*destroy)(void*);
+        void* object;
+    };
+
+    template <typename T>
+    static void destroy(void* object) {
+        static_cast<T*>(object)->~T();
+    }
+
+    size_t blockSize;
+    std::vector<char*> blocks;
+    std::vector<Destructor> destructors;
+    char* cursor = nullptr;
+    size_t remaining = 0;
+    size_t used = 0;
+    size_t reserved = 0;
+    size_t objects = 0;
+#ifndef NDEBUG
+    std::shared_ptr<char> lifetime = std::make_shared<char>(0);
+#endif
+};
+
+// Allocates from `arena` when one is given, otherwise with make_shared.
+template <typename T, typename... Args>
+std::shared_ptr<T> arenaMake(SceneArena* arena, Args&&... args) {
+    if (arena)
+        return arena->make<T>(std::forward<Args>(args)...);
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+#endif
@@ -10,14 +10,22 @@
 class Sphere : public Hittable {
 public:
     Sphere(Vector3 _center, double _radius, std::shared_ptr<Material> _material)
-            : center(_center), radius(_radius), mat(_material) {
+            : center(_center), radius(_radius), mat(_material), isMoving(false) {
 
         auto rvec = Vector3(radius, radius, radius);
         bbox = AABB(center - rvec, center + rvec);
     }
 
+    // Moving sphere: the center travels linearly from center1 at time 0 to center2 at time 1.
+    Sphere(Vector3 center1, Vector3 center2, double _radius, std::shared_ptr<Material> _material)
+            : center(center1), radius(_radius), mat(_material), isMoving(true) {
+        centerVec = center2 - center1;
+        bbox = boundingBoxDuring(Interval(0, 1));
+    }
+
     bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const override {
-        Vector3 oc = r.origin() - center;
+        Vector3 currentCenter = centerAt(r.time());
+        Vector3 oc = r.origin() - currentCenter;
         auto a = r.direction().lengthSquared();
         auto half_b = dot(oc, r.direction());
         auto c = oc.lengthSquared() - radius * radius;
@@ -36,19 +44,49 @@ public:
         }
 
         outRec.t = root;
-        outRec.p = r.at(outRec.t);
-
-        Vector3 outwardNormal = (outRec.p - center) / radius;
-        outRec.setFaceNormal(r, outwardNormal);
-        getSphereUV(outwardNormal, outRec.u, outRec.v);
-        outRec.mat = mat;
+        outRec.object = this;
 
         return true;
     }
 
+    bool occluded(const Ray& r, double tMax) const override {
+        Vector3 oc = r.origin() - centerAt(r.time());
+        auto a = r.direction().lengthSquared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.lengthSquared() - radius * radius;
+
+        auto discriminant = half_b * half_b - a*c;
+        if (discriminant < 0)
+            return false;
+        auto sqrtd = sqrt(discriminant);
+
+        Interval ray_t(rayEpsilon, tMax);
+        return ray_t.surrounds((-half_b - sqrtd) / a) || ray_t.surrounds((-half_b + sqrtd) / a);
+    }
+
+    void finalize(const Ray& r, HitRecord& rec) const override {
+        rec.p = r.at(rec.t);
+
+        Vector3 outwardNormal = (rec.p - centerAt(r.time())) / radius;
+        rec.setFaceNormal(r, outwardNormal);
+        getSphereUV(outwardNormal, rec.u, rec.v);
+        rec.mat = mat;
+    }
+
     AABB boundingBox() const override { return bbox; }
 
+    AABB boundingBoxDuring(const Interval& time) const override {
+        if (!isMoving)
+            return bbox;
+
+        auto rvec = Vector3(radius, radius, radius);
+        AABB box0(centerAt(time.min) - rvec, centerAt(time.min) + rvec);
+        AABB box1(centerAt(time.max) - rvec, centerAt(time.max) + rvec);
+        return AABB(box0, box1);
+    }
+
     double pdfValue(const Vector3& origin, const Vector3& direction) const override {
+        // Only whether the direction reaches the sphere matters: hit() is distance-only.
         HitRecord rec;
         if (!this->hit(Ray(origin, direction), Interval(0.001, infinity), rec))
             return 0;
@@ -66,7 +104,14 @@ public:
         return uvw.local(randomToSphere(radius, distanceSquared));
     }
 
-private:
+    Vector3 centerAt(double time) const {
+        return isMoving ? center + time * centerVec : center;
+    }
+
+    Vector3 motion() const { return isMoving ? centerVec : Vector3(0, 0, 0); }
+    double sphereRadius() const { return radius; }
+    shared_ptr<Material> material() const { return mat; }
+
     static void getSphereUV(const Vector3& p, double& u, double& v) {
         auto theta = acos(-p.y());
         auto phi = atan2(-p.z(), p.x()) + pi;
@@ -74,6 +119,8 @@ private:
         v = theta / pi;
     }
 
+private:
+
     static Vector3 randomToSphere(double radius, double distance_squared) {
         auto r1 = randomDouble();
         auto r2 = randomDouble();
@@ -91,6 +138,8 @@ private:
     double radius;
     std::shared_ptr<Material> mat;
     AABB bbox;
+    bool isMoving;
+    Vector3 centerVec;
 };
 
 #endif
\ No newline at end of file
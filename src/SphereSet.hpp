@@ -0,0 +1,215 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "Utils.hpp"
+#include "FlatBVH.hpp"
+#include "ParallelBVHBuilder.hpp"
+#include "Sphere.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+// Many static spheres in one primitive. Centers, radii and material ids live in SoA arrays
+// grouped in batches of `batchSize` lanes; every BVH leaf owns one batch and its spheres are
+// intersected together (one AVX kernel when compiled with AVX, a scalar loop otherwise).
+class SphereSet : public Hittable {
+public:
+    static const uint32_t batchSize = 4;
+
+    void add(const Vector3& center, double radius, shared_ptr<Material> mat) {
+        sourceCenters.push_back(center);
+        sourceRadii.push_back(radius);
+        sourceMaterials.push_back(materialId(mat));
+        auto rvec = Vector3(radius, radius, radius);
+        bbox = AABB(bbox, AABB(center - rvec, center + rvec));
+    }
+
+    // Builds the BVH and lays the spheres out leaf by leaf. Call after the last add().
+    void build(unsigned threads = hardwareThreads()) {
+        std::vector<AABB> boxes;
+        boxes.reserve(sourceCenters.size());
+        for (size_t i = 0; i < sourceCenters.size(); i++) {
+            auto rvec = Vector3(sourceRadii[i], sourceRadii[i], sourceRadii[i]);
+            boxes.push_back(AABB(sourceCenters[i] - rvec, sourceCenters[i] + rvec));
+        }
+
+        std::vector<uint32_t> primIndices;
+        ParallelBVHBuilder builder(threads);
+        builder.batchLeafSize = batchSize;
+        builder.build(boxes, nodes, primIndices);
+
+        size_t leafCount = 0;
+        for (const auto& node : nodes)
+            leafCount += node.isLeaf() ? 1 : 0;
+
+        // Unused lanes hold NaN centers, which fail every comparison in the kernels.
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        size_t lanes = leafCount * batchSize;
+        centerX.assign(lanes, nan);
+        centerY.assign(lanes, nan);
+        centerZ.assign(lanes, nan);
+        radius.assign(lanes, 0);
+        material.assign(lanes, 0);
+
+        uint32_t batch = 0;
+        for (auto& node : nodes) {
+            if (!node.isLeaf())
+                continue;
+            for (uint32_t i = 0; i < node.count; i++) {
+                uint32_t prim = primIndices[node.left + i];
+                size_t lane = batch * batchSize + i;
+                centerX[lane] = sourceCenters[prim].x();
+                centerY[lane] = sourceCenters[prim].y();
+                centerZ[lane] = sourceCenters[prim].z();
+                radius[lane] = sourceRadii[prim];
+                material[lane] = sourceMaterials[prim];
+            }
+            node.left = batch++;
+        }
+    }
+
+    bool hit(const Ray& r, Interval ray_t, HitRecord& outRec) const override {
+        return traverseFlatBVHLeaves(nodes.empty() ? nullptr : nodes.data(), r, ray_t,
+                                     [&](const FlatBVHNode& leaf, Interval& t) {
+            double root;
+            int lane = hitBatch(leaf.left * batchSize, r, t, root);
+            if (lane < 0)
+                return false;
+            t.max = root;
+            outRec.t = root;
+            outRec.object = this;
+            outRec.primIndex = uint32_t(leaf.left * batchSize + lane);
+            return true;
+        });
+    }
+
+    bool occluded(const Ray& r, double tMax) const override {
+        Interval ray_t(rayEpsilon, tMax);
+        return occludedFlatBVHLeaves(nodes.empty() ? nullptr : nodes.data(), r, tMax, [&](const FlatBVHNode& leaf) {
+            double root;
+            return hitBatch(leaf.left * batchSize, r, ray_t, root) >= 0;
+        });
+    }
+
+    void finalize(const Ray& r, HitRecord& rec) const override {
+        uint32_t lane = uint32_t(rec.primIndex);
+        rec.p = r.at(rec.t);
+        Vector3 outwardNormal = (rec.p - Vector3(centerX[lane], centerY[lane], centerZ[lane])) / radius[lane];
+        rec.setFaceNormal(r, outwardNormal);
+        Sphere::getSphereUV(outwardNormal, rec.u, rec.v);
+        rec.mat = materials[material[lane]];
+    }
+
+    AABB boundingBox() const override { return bbox; }
+
+    size_t size() const { return sourceCenters.size(); }
+
+private:
+    // Closest root in ray_t over the batch starting at `first`. Returns its lane, or -1.
+    int hitBatch(size_t first, const Ray& r, const Interval& ray_t, double& outRoot) const {
+        Vector3 o = r.origin();
+        Vector3 d = r.direction();
+        double a = d.lengthSquared();
+
+#ifdef __AVX__
+        __m256d ocx = _mm256_sub_pd(_mm256_set1_pd(o.x()), _mm256_loadu_pd(&centerX[first]));
+        __m256d ocy = _mm256_sub_pd(_mm256_set1_pd(o.y()), _mm256_loadu_pd(&centerY[first]));
+        __m256d ocz = _mm256_sub_pd(_mm256_set1_pd(o.z()), _mm256_loadu_pd(&centerZ[first]));
+        __m256d rad = _mm256_loadu_pd(&radius[first]);
+
+        __m256d halfB = _mm256_add_pd(_mm256_mul_pd(ocx, _mm256_set1_pd(d.x())),
+                        _mm256_add_pd(_mm256_mul_pd(ocy, _mm256_set1_pd(d.y())),
+                                      _mm256_mul_pd(ocz, _mm256_set1_pd(d.z()))));
+        __m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx),
+                                  _mm256_add_pd(_mm256_mul_pd(ocy, ocy), _mm256_mul_pd(ocz, ocz))),
+                                  _mm256_mul_pd(rad, rad));
+        __m256d va = _mm256_set1_pd(a);
+        __m256d discriminant = _mm256_sub_pd(_mm256_mul_pd(halfB, halfB), _mm256_mul_pd(va, c));
+        __m256d real = _mm256_cmp_pd(discriminant, _mm256_setzero_pd(), _CMP_GE_OQ);
+        if (_mm256_movemask_pd(real) == 0)
+            return -1;
+
+        __m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(discriminant, _mm256_setzero_pd()));
+        __m256d negB = _mm256_sub_pd(_mm256_setzero_pd(), halfB);
+        __m256d nearRoot = _mm256_div_pd(_mm256_sub_pd(negB, sqrtd), va);
+        __m256d farRoot = _mm256_div_pd(_mm256_add_pd(negB, sqrtd), va);
+
+        // Same rule as Sphere::hit: the near root if it is inside ray_t, else the far root.
+        __m256d tMin = _mm256_set1_pd(ray_t.min);
+        __m256d tMax = _mm256_set1_pd(ray_t.max);
+        __m256d nearOk = _mm256_and_pd(_mm256_cmp_pd(nearRoot, tMin, _CMP_GT_OQ), _mm256_cmp_pd(nearRoot, tMax, _CMP_LT_OQ));
+        __m256d farOk = _mm256_and_pd(_mm256_cmp_pd(farRoot, tMin, _CMP_GT_OQ), _mm256_cmp_pd(farRoot, tMax, _CMP_LT_OQ));
+        __m256d root = _mm256_blendv_pd(farRoot, nearRoot, nearOk);
+        __m256d ok = _mm256_and_pd(real, _mm256_or_pd(nearOk, farOk));
+        int okMask = _mm256_movemask_pd(ok);
+        if (okMask == 0)
+            return -1;
+
+        alignas(32) double roots[batchSize];
+        _mm256_store_pd(roots, _mm256_blendv_pd(_mm256_set1_pd(infinity), root, ok));
+        int best = -1;
+        for (int lane = 0; lane < int(batchSize); lane++) {
+            if ((okMask & (1 << lane)) && (best < 0 || roots[lane] < roots[best]))
+                best = lane;
+        }
+        outRoot = roots[best];
+        return best;
+#else
+        int best = -1;
+        double closest = ray_t.max;
+        for (int lane = 0; lane < int(batchSize); lane++) {
+            size_t i = first + lane;
+            Vector3 oc = o - Vector3(centerX[i], centerY[i], centerZ[i]);
+            auto halfB = dot(oc, d);
+            auto c = oc.lengthSquared() - radius[i] * radius[i];
+            auto discriminant = halfB * halfB - a * c;
+            if (!(discriminant >= 0))
+                continue;
+            auto sqrtd = sqrt(discriminant);
+
+            auto root = (-halfB - sqrtd) / a;
+            if (!ray_t.surrounds(root)) {
+                root = (-halfB + sqrtd) / a;
+                if (!ray_t.surrounds(root))
+                    continue;
+            }
+            if (root < closest) {
+                closest = root;
+                best = lane;
+            }
+        }
+        outRoot = closest;
+        return best;
+#endif
+    }
+
+    uint32_t materialId(const shared_ptr<Material>& mat) {
+        auto found = materialIds.find(mat.get());
+        if (found != materialIds.end())
+            return found->second;
+        materials.push_back(mat);
+        uint32_t id = uint32_t(materials.size() - 1);
+        materialIds[mat.get()] = id;
+        return id;
+    }
+
+    std::vector<Vector3> sourceCenters;
+    std::vector<double> sourceRadii;
+    std::vector<uint32_t> sourceMaterials;
+
+    std::vector<FlatBVHNode> nodes;
+    std::vector<double> centerX, centerY, centerZ, radius;
+    std::vector<uint32_t> material;
+
+    std::vector< shared_ptr<Material> > materials;
+    std::unordered_map<const Material*, uint32_t> materialIds;
+    AABB bbox;
+};
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef UTIL_HPP
 #define UTIL_HPP
 
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <cstdlib>
@@ -18,10 +20,34 @@ inline double degrees2radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+// SplitMix64 finalizer: a cheap, well-mixed hash of a 64-bit value.
+inline uint64_t mixBits(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// The generator behind randomDouble, one per thread. Threads are numbered in order of first
+// use and each starts from a seed of its own; the first keeps mt19937's default seed.
+inline std::mt19937& randomGenerator() {
+    static std::atomic<uint64_t> threadCount{ 0 };
+    static thread_local std::mt19937 generator([]() {
+        uint64_t thread = threadCount++;
+        return thread == 0 ? std::mt19937::default_seed : uint32_t(mixBits(thread));
+    }());
+    return generator;
+}
+
+// Restarts the calling thread's stream, so that what follows depends only on `seed`.
+inline void seedRandom(uint64_t seed) {
+    randomGenerator().seed(uint32_t(mixBits(seed)));
+}
+
 inline double randomDouble() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+    static thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    return distribution(randomGenerator());
 }
 
 inline double randomDouble(double min, double max) {